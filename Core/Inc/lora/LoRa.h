@@ -74,6 +74,7 @@
 #define RegPreambleLsb			0x21
 #define RegPayloadLength		0x22
 #define RegModemConfig3			0x26
+#define RegRssiWideband			0x2C
 #define RegSyncWord				0x39
 #define RegDioMapping1			0x40
 #define RegDioMapping2			0x41
@@ -100,6 +101,7 @@ typedef struct LoRa_setting{
 
 	// Module settings:
 	int			current_mode;
+	int			tx_prev_mode;	// mode to restore after LoRa_transmit_end()
 	int 			frequency;
 	uint8_t			spredingFactor;
 	uint8_t			bandWidth;
@@ -144,10 +146,14 @@ void LoRa_setOCP(LoRa* _LoRa, uint8_t current);
 void LoRa_setTOMsb_setCRCon(LoRa* _LoRa);
 void LoRa_setSyncWord(LoRa* _LoRa, uint8_t syncword);
 uint8_t LoRa_transmit(LoRa* _LoRa, uint8_t* data, uint8_t length, uint16_t timeout);
+void LoRa_transmit_begin(LoRa* _LoRa);
+void LoRa_transmit_write(LoRa* _LoRa, const uint8_t* data, uint8_t length);
+uint8_t LoRa_transmit_end(LoRa* _LoRa, uint8_t length, uint16_t timeout);
 void LoRa_startReceiving(LoRa* _LoRa);
 uint8_t LoRa_receive(LoRa* _LoRa, uint8_t* data, uint8_t length);
 void LoRa_receive_IT(LoRa* _LoRa, uint8_t* data, uint8_t length); // not implemented
 int LoRa_getRSSI(LoRa* _LoRa);
+uint32_t LoRa_random(LoRa* _LoRa);
 
 uint8_t LoRa_single_transmit(LoRa* _LoRa, uint8_t* data, uint8_t length, uint16_t timeout);
 
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include "lora_message_types.h"
+
+/**
+ * Time-on-air accounting and duty-cycle enforcement.
+ *
+ * Every frame sent through lora_engine_send() is recorded here by message
+ * type and destination. A sliding window of fixed buckets keeps a running
+ * total so the duty-cycle check is O(1).
+ */
+
+// Sliding window resolution, window_ms is split into this many buckets
+#define LORA_AIRTIME_WINDOW_BUCKETS 60
+
+// Destinations tracked individually, the rest is summed into `other_dest`
+#define LORA_AIRTIME_MAX_DESTS 8
+
+// Message types tracked individually
+#define LORA_AIRTIME_MAX_MESSAGE_TYPES 16
+
+/**
+ * Radio settings needed to compute time on air (SX127x datasheet, 4.1.1.7).
+ */
+typedef struct {
+    uint8_t  spreading_factor;   // 7 .. 12
+    uint32_t bandwidth_hz;       // eg 125000
+    uint8_t  coding_rate;        // 1 .. 4 => 4/5 .. 4/8
+    uint16_t preamble;           // programmed preamble length in symbols
+    uint8_t  crc_on;
+    uint8_t  implicit_header;
+} LoraPhyParams;
+
+typedef enum {
+    LORA_DUTY_CYCLE_OFF = 0,     // record only
+    LORA_DUTY_CYCLE_REJECT,      // refuse sends over budget
+    LORA_DUTY_CYCLE_DEFER,       // queue sends that fit within max_defer_ms, refuse the rest
+} LoraDutyCyclePolicy;
+
+typedef struct {
+    uint32_t window_ms;          // eg 3600000 for EU868 (1 hour)
+    uint16_t budget_permille;    // eg 10 for 1 %, 0 = unlimited
+    LoraDutyCyclePolicy policy;
+    uint32_t max_defer_ms;
+} LoraDutyCycleConfig;
+
+typedef struct {
+    uint32_t frames;
+    uint64_t airtime_us;
+} LoraAirtimeTotal;
+
+typedef struct {
+    NodeId dest;
+    LoraAirtimeTotal total;
+} LoraAirtimeDestTotal;
+
+typedef struct {
+    LoraDutyCycleConfig config;
+    uint32_t bucket_ms;
+    uint32_t budget_us;
+
+    uint32_t buckets[LORA_AIRTIME_WINDOW_BUCKETS]; // airtime_us per bucket
+    uint8_t  head;               // bucket receiving new airtime
+    uint32_t head_start_ms;      // start time of buckets[head]
+    uint32_t window_us;          // running sum of buckets[]
+
+    LoraAirtimeTotal by_type[LORA_AIRTIME_MAX_MESSAGE_TYPES];
+    LoraAirtimeDestTotal by_dest[LORA_AIRTIME_MAX_DESTS];
+    uint8_t dest_count;
+    LoraAirtimeTotal other_dest;
+    LoraAirtimeTotal rejected;
+} LoraAirtimeLedger;
+
+/**
+*   time on air of a `payload_len` byte frame in microseconds.
+*/
+uint32_t lora_airtime_us(const LoraPhyParams *phy, uint8_t payload_len);
+
+/**
+*   raw PHY bit rate in bits/s, SF * BW / 2^SF * 4 / (4 + CR), the ceiling
+*   for any goodput.
+*/
+uint32_t lora_airtime_phy_bps(const LoraPhyParams *phy);
+
+/**
+*   initialize a ledger. cfg may be NULL for a 1 hour window with no budget.
+*/
+void lora_airtime_init(LoraAirtimeLedger *ledger,
+                       const LoraDutyCycleConfig *cfg,
+                       uint32_t now_ms);
+
+/**
+*   record a transmission of `airtime_us` to `dest`.
+*/
+void lora_airtime_record(LoraAirtimeLedger *ledger,
+                         uint32_t now_ms,
+                         uint8_t message_type,
+                         NodeId dest,
+                         uint32_t airtime_us);
+
+/**
+*   airtime used in the current window, in microseconds.
+*/
+uint32_t lora_airtime_window_us(LoraAirtimeLedger *ledger, uint32_t now_ms);
+
+/**
+*   Returns 1 if `airtime_us` more fits in the budget, 0 if not.
+*/
+uint8_t lora_airtime_admit(LoraAirtimeLedger *ledger,
+                           uint32_t now_ms,
+                           uint32_t airtime_us);
+
+/**
+*   milliseconds until `airtime_us` fits in the budget, 0 if it fits now,
+*   UINT32_MAX if it never will (larger than the whole budget).
+*/
+uint32_t lora_airtime_wait_ms(LoraAirtimeLedger *ledger,
+                              uint32_t now_ms,
+                              uint32_t airtime_us);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Bump allocator over a static buffer, for the few large blocks the radio
+ * stack needs at run time (stream reassembly) without a heap. Blocks are
+ * only given back all together, or back to a lora_arena_mark().
+ *
+ *     static uint8_t arena_mem[8 * 1024];
+ *     LoraArena arena;
+ *     lora_arena_init(&arena, arena_mem, sizeof(arena_mem));
+ */
+typedef struct {
+    uint8_t *base;
+    size_t   size;
+    size_t   used;
+} LoraArena;
+
+void lora_arena_init(LoraArena *arena, void *mem, size_t size);
+
+/**
+*   len bytes aligned to 4, or NULL if the arena is full.
+*/
+void *lora_arena_alloc(LoraArena *arena, size_t len);
+
+static inline size_t lora_arena_mark(const LoraArena *arena)
+{
+    return arena->used;
+}
+
+/**
+*   free everything allocated since mark.
+*/
+static inline void lora_arena_release(LoraArena *arena, size_t mark)
+{
+    if (mark <= arena->used) {
+        arena->used = mark;
+    }
+}
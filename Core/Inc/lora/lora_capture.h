@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lora_message_types.h"
+
+/**
+ * Raw frame capture for offline replay (Core/Tools/frame_replay.c).
+ *
+ * Build with LORA_CAPTURE_ENABLED=1 and the engine loop appends every
+ * received frame, with RSSI and a millisecond timestamp, to a static log in
+ * the binary format below. The log fills up and then counts drops until
+ * lora_capture_reset(). lora_capture_dump() prints it as hex lines.
+ *
+ * Log format, little endian:
+ *     header:  "LCAP"  u8 version  u8 node_id  u16 reserved
+ *     record:  u32 time_ms  i16 rssi  u8 len  u8 bytes[len]
+ */
+#ifndef LORA_CAPTURE_ENABLED
+#define LORA_CAPTURE_ENABLED 0
+#endif
+
+#ifndef LORA_CAPTURE_BYTES
+#define LORA_CAPTURE_BYTES 4096
+#endif
+
+#define LORA_CAPTURE_MAGIC        "LCAP"
+#define LORA_CAPTURE_VERSION      1
+#define LORA_CAPTURE_HEADER_SIZE  8
+#define LORA_CAPTURE_RECORD_SIZE  7  // without frame bytes
+
+#if LORA_CAPTURE_ENABLED
+
+/**
+*   start a new log for a node, drops everything captured so far.
+*/
+void lora_capture_reset(NodeId node_id);
+
+/**
+*   append a received frame. Returns 1 if stored, 0 if the log is full.
+*/
+uint8_t lora_capture_frame(uint32_t time_ms, int16_t rssi,
+                           const uint8_t *frame, uint8_t len);
+
+/**
+*   the log, header included, and its length in bytes.
+*/
+const uint8_t *lora_capture_log(size_t *len);
+
+/**
+*   frames that did not fit since the last reset.
+*/
+uint32_t lora_capture_dropped(void);
+
+/**
+*   print the log as "LCAP <hex>" lines, eg lora_capture_dump(uart_print).
+*/
+void lora_capture_dump(void (*print)(const char *line));
+
+#else
+
+#define lora_capture_reset(node_id)                     ((void)0)
+#define lora_capture_frame(time_ms, rssi, frame, len)   ((void)0)
+#define lora_capture_dump(print)                        ((void)0)
+
+#endif
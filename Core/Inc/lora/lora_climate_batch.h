@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include "lora_message_types.h"
+#include "lora_engine.h"
+
+/**
+ * On-node batching of climate readings into LORA_DATA_TYPE_CLIMATE_SERIES
+ * frames.
+ *
+ * Readings taken every interval_s are collected and sent as one delta
+ * encoded series, so N readings pay for one header and one preamble instead
+ * of N. A batch is due once it holds max_samples, once the next reading might
+ * not fit the frame, or once the first reading is max_age_ms old.
+ */
+typedef struct {
+    ClimateSeries series;
+    uint32_t first_ms;           // when samples[0] was added
+    uint8_t  max_samples;        // 1 .. LORA_CLIMATE_SERIES_MAX_SAMPLES
+    uint32_t max_age_ms;         // 0 = no age limit
+} LoraClimateBatch;
+
+/**
+*   start an empty batch.
+*/
+void lora_climate_batch_init(LoraClimateBatch *batch,
+                             uint16_t interval_s,
+                             uint8_t max_samples,
+                             uint32_t max_age_ms);
+
+/**
+*   append a reading. Returns 1, or 0 if the batch is full and has to be
+*   flushed first.
+*/
+uint8_t lora_climate_batch_add(LoraClimateBatch *batch,
+                               const ClimateData *sample,
+                               uint32_t now_ms);
+
+/**
+*   1 if the batch should be flushed now.
+*/
+uint8_t lora_climate_batch_due(const LoraClimateBatch *batch, uint32_t now_ms);
+
+/**
+*   send the batch as one LORA_DATA message and empty it. Returns 1 if sent
+*   or empty, 0 if the send failed, the readings are then kept.
+*/
+uint8_t lora_climate_batch_flush(LoraClimateBatch *batch,
+                                 LoraEngine *engine,
+                                 NodeId dest,
+                                 uint16_t timeout);
@@ -1,25 +1,52 @@
+#pragma once
+
 #include "lora_message_types.h"
+#include "lora_message_schema.h"
 #include <stdint.h>
 
 /**
- * Maximum number of bytes that lora_encode() will ever output for a single
- * LoraMessage, given current definitions in lora_message_types.h
+ * Frame sizes, from the message schema in lora_message_schema.h
+ *
+ *   LORA_HEADER_SIZE               legacy header: message_type, source, dest
+ *   LORA_MAX_HEADER_SIZE           longest header, compact with a seq byte
+ *   LORA_MAX_ENCODED_SIZE          most bytes lora_encode() will ever output
+ *   LORA_MAX_ENCODED_SIZE_OF(NAME) most bytes for one message type, eg
+ *                                  LORA_MAX_ENCODED_SIZE_OF(PING_REQUEST)
  *
- * Layout worst-case:
- *   1 byte  message_type
- *   1 byte  source
- *   1 byte  dest
- *   STREAM_SEQUENCE payload:
- *     1 byte  stream_type
- *     1 byte  stream_id
- *     2 bytes sequence_number
- *     1 byte  packet_index
- *     1 byte  packets_in_sequence
- *     1 byte  chunk_len
- *    128 bytes chunk (LORA_STREAM_MAX_CHUNK_SIZE)
- *  = 138 bytes total
+ * All are compile-time constants, use them to size buffers.
  */
-#define LORA_MAX_ENCODED_SIZE (3 + 1 + 1 + 2 + 1 + 1 + 1 + LORA_STREAM_MAX_CHUNK_SIZE)
+#define LORA_HEADER_SIZE 3
+#define LORA_MAX_HEADER_SIZE 4
+#define LORA_MAX_ENCODED_SIZE (LORA_MAX_HEADER_SIZE + LORA_MAX_PAYLOAD_SIZE)
+#define LORA_MAX_ENCODED_SIZE_OF(NAME) (LORA_MAX_HEADER_SIZE + LORA_WIRE_MAX_SIZE(NAME))
+
+/**
+ * Frame headers.
+ *
+ * Legacy, 3 bytes, what every node understands:
+ *     u8 message_type  u8 source  u8 dest
+ *
+ * Compact, 2 to 4 bytes, when msg->metadata.flags has LORA_FLAG_COMPACT:
+ *     u8 bits: 7 COMPACT (always 1), 6 ACK_REQ, 5 BCAST, 4 SHORT, 3..0 type
+ *     SHORT:      u8 source << 4 | dest      (both ids below 16)
+ *     otherwise:  u8 source  [u8 dest]       (no dest byte with BCAST)
+ *     ACK_REQ:    u8 seq                     (metadata.seq)
+ *
+ * Legacy types are all below 0x80, so bit 7 tells the formats apart and
+ * lora_decode() accepts both. Old nodes drop compact frames as an unknown
+ * type, so only send them to nodes known to understand them.
+ * The legacy header has no room for flags, LORA_FLAG_ACK_REQ and seq are
+ * not sent.
+ */
+#define LORA_HDR_COMPACT    0x80
+#define LORA_HDR_ACK_REQ    0x40
+#define LORA_HDR_BCAST      0x20
+#define LORA_HDR_SHORT      0x10
+#define LORA_HDR_TYPE_MASK  0x0F
+#define LORA_HDR_SHORT_ID_MAX 15
+
+// message types fit the 4 bit type of the compact header
+#define LORA_MESSAGE_TYPE_COUNT 16
 
 
 /**
@@ -39,6 +66,23 @@ uint8_t check_valid_lora_message(LoraMessage *lora_message);
  */
 uint8_t lora_decode(const uint8_t *buf, size_t len, LoraMessage *msg);
 
+/**
+ * Parse only the frame header, either format, to decide whether a frame is
+ * worth decoding before touching its payload.
+ *
+ * @return header length in bytes, or 0 if buf is too short for it.
+ */
+size_t lora_decode_header(const uint8_t *buf, size_t len,
+                          LoraMessageType *type, LoraMetadata *meta);
+
+/**
+ * Decode the payload that follows a header read with lora_decode_header().
+ * msg->message_type selects the decoder and must already be set.
+ *
+ * @return 0 on success, -1 on error, same rules as lora_decode().
+ */
+uint8_t lora_decode_payload(const uint8_t *payload, size_t len, LoraMessage *msg);
+
 /**
  * Encode a LoraMessage into a byte buffer.
  *
@@ -49,4 +93,257 @@ uint8_t lora_decode(const uint8_t *buf, size_t len, LoraMessage *msg);
  * @return Number of bytes written into buf on success, or 0 on error
  *         (e.g., buf_len too small or unsupported message type).
  */
-size_t lora_encode(const LoraMessage *msg, uint8_t *buf, size_t buf_len);
\ No newline at end of file
+size_t lora_encode(const LoraMessage *msg, uint8_t *buf, size_t buf_len);
+
+/**
+ * Exact number of bytes lora_encode() will write for msg.
+ *
+ * @return size in bytes, or 0 if msg can not be encoded.
+ */
+size_t lora_encoded_size(const LoraMessage *msg);
+
+/**
+ * Wire bytes of the samples of a LORA_DATA_TYPE_CLIMATE_SERIES payload.
+ * A series encodes while this is at most LORA_CLIMATE_SERIES_MAX_SAMPLE_BYTES.
+ *
+ * @return size in bytes, or 0 for no samples or too many.
+ */
+size_t lora_climate_series_sample_bytes(const ClimateSeries *series);
+
+/**
+ * Destination for lora_encode_to_sink(), eg an open SPI burst into the
+ * radio FIFO. Returns 1 if all len bytes were taken, 0 to stop encoding.
+ */
+typedef uint8_t (*LoraEncodeSink)(void *ctx, const uint8_t *data, size_t len);
+
+/**
+ * Encode a LoraMessage into a sink instead of a buffer.
+ *
+ * Header and fixed fields are gathered in a few bytes of stack and written
+ * together, chunk and raw bytes go to the sink straight from msg, so a
+ * frame is at most three sink writes and is never copied whole. Climate
+ * series samples are delta encoded on the stack first.
+ *
+ * @return Number of bytes written on success, or 0 on error or if the
+ *         sink refused data. Use lora_encoded_size() to know the length
+ *         up front.
+ */
+size_t lora_encode_to_sink(const LoraMessage *msg, LoraEncodeSink sink, void *ctx);
+
+/**
+ * LORA_AGGREGATE entries: u8 message_type, u8 payload length, payload.
+ * Entries share the header, and so source, dest and flags, of their frame.
+ */
+#define LORA_AGGREGATE_ENTRY_HEADER 2
+
+/**
+ * Append the payload of msg as one more entry of agg. msg can not be a
+ * LORA_AGGREGATE itself.
+ *
+ * @return bytes added, or 0 if msg can not be encoded or does not fit.
+ */
+size_t lora_aggregate_append(LoraAggregate *agg, const LoraMessage *msg);
+
+/**
+ * Decode the entry of container at *pos into msg, with the container's
+ * metadata, and advance *pos. Start with *pos = 0.
+ *
+ * @return 1 if msg was filled, 0 after the last entry or at a malformed one.
+ */
+uint8_t lora_aggregate_next(const LoraMessage *container, size_t *pos, LoraMessage *msg);
+
+/**
+ * Wrap msg into routed for a trip from msg's source to its dest of at most
+ * ttl hops, with seq 0. msg can not be a LORA_AGGREGATE or LORA_ROUTED.
+ *
+ * @return bytes of inner, or 0 if msg can not be encoded or does not fit.
+ */
+size_t lora_routed_wrap(LoraRouted *routed, const LoraMessage *msg, uint8_t ttl);
+
+/**
+ * The message inside a LORA_ROUTED container, with origin as source and
+ * target as dest, and no flags.
+ *
+ * @return 1 if msg was filled, 0 if inner is malformed.
+ */
+uint8_t lora_routed_unwrap(const LoraMessage *container, LoraMessage *msg);
+
+/**
+ * Compact in-memory message, for queues and anything else that holds
+ * messages in RAM.
+ *
+ * LoraMessage spends 4 bytes on each enum field and always reserves the
+ * largest payload: sizeof(LoraMessage) is 148 bytes with 4 byte enums
+ * (140 with -fshort-enums), whatever the message. A LoraPackedMessage
+ * keeps the payload in its wire encoding behind a length byte, so it takes
+ * LORA_PACKED_SIZE(payload_len) bytes: 5 for a ping, 13 for a stream
+ * sequence ack, at most LORA_PACKED_MAX_SIZE (140).
+ *
+ * Everything is uint8_t, and message_type onwards is exactly the encoded
+ * frame with a legacy header, so it can be transmitted or viewed without
+ * converting back.
+ * Storage for a variable-size one is usually a uint8_t array of
+ * LORA_PACKED_SIZE(n) in a queue.
+ */
+typedef struct {
+    uint8_t payload_len;     // bytes in payload[]
+    uint8_t flags;           // LoraMetadata.flags
+    uint8_t message_type;    // LoraMessageType
+    NodeId  source;
+    NodeId  dest;
+    uint8_t payload[];       // schema wire encoding
+} LoraPackedMessage;
+
+#define LORA_PACKED_SIZE(payload_len) (sizeof(LoraPackedMessage) + (payload_len))
+#define LORA_PACKED_MAX_SIZE          LORA_PACKED_SIZE(LORA_MAX_PAYLOAD_SIZE)
+
+/**
+ * Pack a LoraMessage into cap bytes of storage at packed.
+ *
+ * @return LORA_PACKED_SIZE() of the result, or 0 if msg can not be encoded
+ *         or does not fit.
+ */
+size_t lora_pack(const LoraMessage *msg, LoraPackedMessage *packed, size_t cap);
+
+/**
+ * Expand a packed message back to a LoraMessage.
+ *
+ * @return 0 on success, -1 on error, same rules as lora_decode().
+ */
+uint8_t lora_unpack(const LoraPackedMessage *packed, LoraMessage *msg);
+
+/**
+ * The encoded frame inside a packed message, ready to transmit.
+ */
+static inline const uint8_t *lora_packed_frame(const LoraPackedMessage *packed,
+                                               uint8_t *frame_len)
+{
+    *frame_len = (uint8_t)(LORA_HEADER_SIZE + packed->payload_len);
+    return &packed->message_type;
+}
+
+/**
+ * Zero-copy view of an encoded frame.
+ *
+ * lora_decode_view() validates a frame in place, either header format,
+ * with the same checks as lora_decode(), and points into the caller's buffer instead of copying.
+ * The view is only valid while that buffer is.
+ *
+ * Payload fields are read with lora_view_u8/u16/u32() at the
+ * LORA_VIEW_OFF_* offsets below, relative to view->payload. The offsets
+ * come from the message schema.
+ */
+typedef struct {
+    LoraMessageType message_type;
+    LoraMetadata    metadata;
+    const uint8_t  *payload;      // first byte after the header
+    size_t          payload_len;  // bytes from payload to the end of the frame
+} LoraMessageView;
+
+// LORA_DATA_REQUEST, LORA_DATA
+#define LORA_VIEW_OFF_DATA_TYPE               LORA_WIRE_OFFSET(DATA, data_type)
+#define LORA_VIEW_OFF_CLIMATE_TEMPERATURE     (LORA_WIRE_OFFSET(DATA, payload) + \
+                                               LORA_WIRE_OFFSET(CLIMATE_DATA, temperature_tenths))
+#define LORA_VIEW_OFF_CLIMATE_HUMIDITY        (LORA_WIRE_OFFSET(DATA, payload) + \
+                                               LORA_WIRE_OFFSET(CLIMATE_DATA, humidity_tenths))
+// LORA_COMMAND_REQUEST, LORA_COMMAND_RESPONSE
+#define LORA_VIEW_OFF_COMMAND_TYPE            LORA_WIRE_OFFSET(COMMAND_REQUEST, command_type)
+#define LORA_VIEW_OFF_COMMAND_VALUE           LORA_WIRE_OFFSET(COMMAND_REQUEST, command_value)
+#define LORA_VIEW_OFF_COMMAND_STATUS          LORA_WIRE_OFFSET(COMMAND_RESPONSE, command_status)
+// LORA_STREAM_REQUEST, LORA_STREAM_ANNOUNCE
+#define LORA_VIEW_OFF_STREAM_TYPE             LORA_WIRE_OFFSET(STREAM_REQUEST, stream_type)
+#define LORA_VIEW_OFF_ANNOUNCE_STREAM_ID      LORA_WIRE_OFFSET(STREAM_ANNOUNCE, stream_id)
+#define LORA_VIEW_OFF_ANNOUNCE_SEQUENCE       LORA_WIRE_OFFSET(STREAM_ANNOUNCE, sequence_number)
+#define LORA_VIEW_OFF_ANNOUNCE_PACKETS        LORA_WIRE_OFFSET(STREAM_ANNOUNCE, packets_in_sequence)
+#define LORA_VIEW_OFF_ANNOUNCE_FLAGS          LORA_WIRE_OFFSET(STREAM_ANNOUNCE, flags) // optional
+// LORA_STREAM_ANNOUNCE_ACK
+#define LORA_VIEW_OFF_ANNOUNCE_ACK_STREAM_ID  LORA_WIRE_OFFSET(STREAM_ANNOUNCE_ACK, stream_id)
+#define LORA_VIEW_OFF_ANNOUNCE_ACK_SEQUENCE   LORA_WIRE_OFFSET(STREAM_ANNOUNCE_ACK, sequence_number)
+// LORA_STREAM_SEQUENCE
+#define LORA_VIEW_OFF_SEQ_STREAM_TYPE         LORA_WIRE_OFFSET(STREAM_SEQUENCE, stream_type)
+#define LORA_VIEW_OFF_SEQ_STREAM_ID           LORA_WIRE_OFFSET(STREAM_SEQUENCE, stream_id)
+#define LORA_VIEW_OFF_SEQ_SEQUENCE            LORA_WIRE_OFFSET(STREAM_SEQUENCE, sequence_number)
+#define LORA_VIEW_OFF_SEQ_PACKET_INDEX        LORA_WIRE_OFFSET(STREAM_SEQUENCE, packet_index)
+#define LORA_VIEW_OFF_SEQ_PACKETS             LORA_WIRE_OFFSET(STREAM_SEQUENCE, packets_in_sequence)
+#define LORA_VIEW_OFF_SEQ_CHUNK_LEN           LORA_WIRE_OFFSET(STREAM_SEQUENCE, chunk_len)
+#define LORA_VIEW_OFF_SEQ_CHUNK               LORA_WIRE_OFFSET(STREAM_SEQUENCE, chunk)
+// LORA_STREAM_SEQUENCE_ACK
+#define LORA_VIEW_OFF_SEQ_ACK_STREAM_ID       LORA_WIRE_OFFSET(STREAM_SEQUENCE_ACK, stream_id)
+#define LORA_VIEW_OFF_SEQ_ACK_SEQUENCE        LORA_WIRE_OFFSET(STREAM_SEQUENCE_ACK, sequence_number)
+#define LORA_VIEW_OFF_SEQ_ACK_STATUS          LORA_WIRE_OFFSET(STREAM_SEQUENCE_ACK, status)
+#define LORA_VIEW_OFF_SEQ_ACK_MISSING         LORA_WIRE_OFFSET(STREAM_SEQUENCE_ACK, missing_bitmap)
+// LORA_STREAM_COMPLETE
+#define LORA_VIEW_OFF_COMPLETE_STREAM_ID      LORA_WIRE_OFFSET(STREAM_COMPLETE, stream_id)
+#define LORA_VIEW_OFF_COMPLETE_CRC32          LORA_WIRE_OFFSET(STREAM_COMPLETE, crc32) // optional
+
+/**
+ * Validate a frame and fill a view over it.
+ *
+ * @return 0 on success, -1 on error, same rules as lora_decode().
+ */
+uint8_t lora_decode_view(const uint8_t *buf, size_t len, LoraMessageView *view);
+
+static inline uint8_t lora_view_u8(const LoraMessageView *view, size_t off)
+{
+    return view->payload[off];
+}
+
+static inline uint16_t lora_view_u16(const LoraMessageView *view, size_t off)
+{
+    return (uint16_t)(view->payload[off] | ((uint16_t)view->payload[off + 1] << 8));
+}
+
+static inline uint32_t lora_view_u32(const LoraMessageView *view, size_t off)
+{
+    return  (uint32_t)view->payload[off]
+         | ((uint32_t)view->payload[off + 1] << 8)
+         | ((uint32_t)view->payload[off + 2] << 16)
+         | ((uint32_t)view->payload[off + 3] << 24);
+}
+
+/**
+ * view over a packed message, see lora_decode_view().
+ */
+static inline uint8_t lora_packed_view(const LoraPackedMessage *packed,
+                                       LoraMessageView *view)
+{
+    uint8_t frame_len;
+    const uint8_t *frame = lora_packed_frame(packed, &frame_len);
+    return lora_decode_view(frame, frame_len, view);
+}
+
+/**
+ * chunk of a LORA_STREAM_SEQUENCE view, straight from the frame buffer.
+ */
+static inline const uint8_t *lora_view_stream_chunk(const LoraMessageView *view,
+                                                    uint8_t *chunk_len)
+{
+    *chunk_len = view->payload[LORA_VIEW_OFF_SEQ_CHUNK_LEN];
+    return &view->payload[LORA_VIEW_OFF_SEQ_CHUNK];
+}
+
+/**
+ * LORA_STREAM_FLAG_* of a LORA_STREAM_ANNOUNCE view, 0 from older senders.
+ */
+static inline uint8_t lora_view_announce_flags(const LoraMessageView *view)
+{
+    return view->payload_len > LORA_VIEW_OFF_ANNOUNCE_FLAGS
+         ? view->payload[LORA_VIEW_OFF_ANNOUNCE_FLAGS] : 0;
+}
+
+/**
+ * crc32 of a LORA_STREAM_COMPLETE view, 0 from older senders.
+ */
+static inline uint32_t lora_view_complete_crc32(const LoraMessageView *view)
+{
+    return view->payload_len > LORA_VIEW_OFF_COMPLETE_CRC32
+         ? lora_view_u32(view, LORA_VIEW_OFF_COMPLETE_CRC32) : 0;
+}
+
+/**
+ * the raw bytes of a LORA_RAW view, all view->payload_len of them.
+ */
+static inline const uint8_t *lora_view_raw(const LoraMessageView *view)
+{
+    return view->payload;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * CRC-32 (IEEE 802.3, as zlib), fed incrementally, eg chunk by chunk as a
+ * stream arrives so a reassembled image is checked without a second pass:
+ *
+ *     uint32_t crc = lora_crc32_init();
+ *     crc = lora_crc32_update(crc, chunk, chunk_len);   // for each chunk
+ *     ok = lora_crc32_final(crc) == complete->crc32;
+ *
+ * On target the STM32 CRC unit does the work, on host a 1 KB table.
+ * The CRC unit is not locked, so do not update from an interrupt while
+ * the main loop may be updating too.
+ */
+#ifndef LORA_CRC_HW
+#ifdef USE_HAL_DRIVER
+#define LORA_CRC_HW 1
+#else
+#define LORA_CRC_HW 0
+#endif
+#endif
+
+static inline uint32_t lora_crc32_init(void)
+{
+    return 0xFFFFFFFFu;
+}
+
+/**
+*   add len bytes to a running CRC.
+*/
+uint32_t lora_crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+
+static inline uint32_t lora_crc32_final(uint32_t crc)
+{
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+*   crc with a piece appended whose own CRC was taken earlier, eg when it
+*   arrived out of order: part is lora_crc32_update(0, piece, len).
+*   Costs about as much as updating with len bytes.
+*/
+uint32_t lora_crc32_append(uint32_t crc, uint32_t part, size_t len);
+
+/**
+*   CRC-32 of one buffer.
+*/
+static inline uint32_t lora_crc32(const uint8_t *data, size_t len)
+{
+    return lora_crc32_final(lora_crc32_update(lora_crc32_init(), data, len));
+}
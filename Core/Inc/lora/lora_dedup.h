@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include "lora_message_types.h"
+
+/**
+ * Recently seen (source, seq) pairs, so a retransmitted or relayed frame
+ * is handled once. Two-way set associative: a pair can only live in one
+ * set, picked by hashing it, so a check looks at two entries whatever the
+ * traffic. The older way is replaced when a set is full. Entries expire
+ * after expiry_ms, which must outlast the sender's retransmissions.
+ */
+#define LORA_DEDUP_SETS 32   // power of two
+#define LORA_DEDUP_WAYS 2
+
+// longer than LORA_RELIABLE_MAX_RETRIES backed off retransmissions
+#define LORA_DEDUP_DEFAULT_EXPIRY_MS 120000
+
+typedef struct {
+    uint32_t seen_ms;
+    NodeId   source;
+    uint8_t  seq;
+    uint8_t  valid;
+} LoraDedupEntry;
+
+typedef struct {
+    LoraDedupEntry entries[LORA_DEDUP_SETS][LORA_DEDUP_WAYS];
+    uint32_t       expiry_ms;
+    uint32_t       duplicates;   // frames reported as seen
+} LoraDedup;
+
+/**
+*   empty the cache. expiry_ms 0 takes LORA_DEDUP_DEFAULT_EXPIRY_MS.
+*/
+void lora_dedup_init(LoraDedup *dedup, uint32_t expiry_ms);
+
+/**
+*   1 if (source, seq) was seen in the last expiry_ms, otherwise remember
+*   it and return 0.
+*/
+uint8_t lora_dedup_check(LoraDedup *dedup, NodeId source, uint8_t seq, uint32_t now_ms);
+
+/**
+*   1 if (source, seq) was seen in the last expiry_ms, without remembering
+*   it. For a receiver that only records a frame once it has been handled.
+*/
+uint8_t lora_dedup_seen(LoraDedup *dedup, NodeId source, uint8_t seq, uint32_t now_ms);
+
+/**
+*   remember (source, seq) as seen now.
+*/
+void lora_dedup_record(LoraDedup *dedup, NodeId source, uint8_t seq, uint32_t now_ms);
@@ -2,17 +2,77 @@
 
 #include <stdint.h>
 #include "lora_message_types.h"
+#include "lora_airtime.h"
+#include "lora_codec.h"
+#include "lora_reliable.h"
+#include "lora_dedup.h"
+#include "lora_timer.h"
+#include "lora_route.h"
+#include "lora_flood.h"
 
 typedef struct _LoraEngine LoraEngine;
+typedef struct _LoraStream LoraStream; // lora_stream.h
 
 typedef struct {
     NodeId local_id;
     uint8_t (*transmit)(void * _lora_ctx, uint8_t* data, uint8_t length, uint16_t timeout);
     uint8_t (*receive)(void * _lora_ctx, uint8_t* data, uint8_t length); // called when something is in the receive buffer
+    int (*get_rssi)(void * _lora_ctx); // RSSI of the last received packet in dBm, optional
     volatile uint8_t receive_ready_flag;
     void * lora_ctx;
+    uint32_t (*get_time_ms)(void); // monotonic millisecond clock, optional
+    LoraPhyParams phy;             // radio settings, used for time on air
+
+    // optional streaming transmit, set all three or none. The frame is then
+    // encoded straight into the radio FIFO instead of a stack buffer:
+    // begin, write() for each piece, end() with the total length. end()
+    // with length 0 aborts without sending.
+    uint8_t (*transmit_begin)(void * _lora_ctx);
+    LoraEncodeSink transmit_write;
+    uint8_t (*transmit_end)(void * _lora_ctx, uint8_t length, uint16_t timeout);
+
+    // optional, called by lora_engine_run_until() / lora_engine_loop() with
+    // nothing to do: sleep until an interrupt, or at most max_ms. Must not
+    // sleep if lora_engine_has_events(), checked with interrupts masked.
+    void (*idle)(void * _lora_ctx, LoraEngine *engine, uint32_t max_ms);
+
+    // optional, random bits that differ on every boot, eg radio noise. Seeds
+    // the sequence numbers, without it a node that reboots at the same tick
+    // starts them where it did before.
+    uint32_t (*get_entropy)(void * _lora_ctx);
 } LoraDriver;
 
+/**
+ * Events posted to the engine, usually from interrupt handlers.
+ */
+typedef enum {
+    LORA_EVENT_NONE = 0,
+    LORA_EVENT_RX_DONE,          // a frame is waiting in the radio
+    LORA_EVENT_TX_DONE,          // the radio finished sending
+    LORA_EVENT_TIMER,            // an application or engine timer expired
+} LoraEventType;
+
+// pending events, power of two
+#define LORA_EVENT_QUEUE_SIZE 8
+
+/**
+ * Outbound queue classes, drained highest first by lora_engine_poll().
+ */
+typedef enum {
+    LORA_PRIORITY_CONTROL = 0,   // commands, acks, pings
+    LORA_PRIORITY_TELEMETRY,     // data reports
+    LORA_PRIORITY_BULK,          // stream chunks, raw
+    LORA_PRIORITY_COUNT,
+} LoraPriority;
+
+// bytes of queue per class, each message takes 2 + LORA_PACKED_SIZE(payload)
+#define LORA_TX_QUEUE_CONTROL_BYTES   128
+#define LORA_TX_QUEUE_TELEMETRY_BYTES 256
+#define LORA_TX_QUEUE_BULK_BYTES      (2 * (2 + LORA_PACKED_MAX_SIZE))
+#define LORA_TX_QUEUE_BYTES (LORA_TX_QUEUE_CONTROL_BYTES + \
+                             LORA_TX_QUEUE_TELEMETRY_BYTES + \
+                             LORA_TX_QUEUE_BULK_BYTES)
+
 
 typedef void (*LoraPingReqHandler)(LoraEngine *engine,
                                    const LoraPingReq *msg,
@@ -54,6 +114,11 @@ typedef void (*LoraStreamSequenceHandler)(LoraEngine *engine,
                                           const LoraStreamSequence *msg,
                                           const LoraMetadata *meta);
 
+// zero-copy alternative to LoraStreamSequenceHandler, the chunk is read
+// straight from the receive buffer with lora_view_stream_chunk()
+typedef void (*LoraStreamSequenceViewHandler)(LoraEngine *engine,
+                                              const LoraMessageView *view);
+
 typedef void (*LoraStreamSequenceAckHandler)(LoraEngine *engine,
                                              const LoraStreamSequenceAck *msg,
                                              const LoraMetadata *meta);
@@ -62,6 +127,19 @@ typedef void (*LoraStreamCompleteHandler)(LoraEngine *engine,
                                           const LoraStreamComplete *msg,
                                           const LoraMetadata *meta);
 
+// outcome of lora_engine_send_reliable(): delivered 1 on ack, 0 after the last retry
+typedef void (*LoraDeliveryHandler)(LoraEngine *engine,
+                                    NodeId dest,
+                                    uint8_t seq,
+                                    uint8_t delivered);
+
+
+// which frame header lora_engine_send() uses, see lora_codec.h
+typedef enum {
+    LORA_HEADER_LEGACY = 0, // 3 byte header, understood by every node
+    LORA_HEADER_COMPACT,    // compact header to everyone
+    LORA_HEADER_AUTO,       // compact to peers heard sending compact frames, legacy otherwise
+} LoraHeaderMode;
 
 struct _LoraEngine {
     LoraDriver *driver;
@@ -80,8 +158,54 @@ struct _LoraEngine {
     LoraStreamAnnounceHandler    on_stream_announce;
     LoraStreamAnnounceAckHandler on_stream_announce_ack;
     LoraStreamSequenceHandler    on_stream_sequence;
+    LoraStreamSequenceViewHandler on_stream_sequence_view; // takes precedence over on_stream_sequence
     LoraStreamSequenceAckHandler on_stream_seq_ack;
     LoraStreamCompleteHandler    on_stream_complete;
+
+    LoraDeliveryHandler          on_delivery;
+
+    LoraAirtimeLedger            airtime;
+
+    LoraHeaderMode               header_mode;
+    uint8_t                      compact_peers[32]; // bit per NodeId, for LORA_HEADER_AUTO
+
+    uint32_t                     aggregate_window_ms; // 0 = send every message on its own
+    LoraMessage                  aggregate;           // held messages, entries_len 0 when none
+    uint32_t                     aggregate_since_ms;
+    uint16_t                     aggregate_timeout;
+
+    // single producer ring, posted from interrupts, drained by lora_engine_poll()
+    volatile uint8_t             events[LORA_EVENT_QUEUE_SIZE];
+    volatile uint8_t             event_head;
+    volatile uint8_t             event_tail;
+    uint32_t                     event_overflows;
+
+    // outbound queue, per class a FIFO of [u16 timeout][LoraPackedMessage]
+    uint8_t                      tx_queue[LORA_TX_QUEUE_BYTES];
+    uint16_t                     tx_queue_used[LORA_PRIORITY_COUNT];
+    uint32_t                     tx_queue_dropped;
+
+    // acknowledged sends, see lora_engine_send_reliable()
+    LoraReliable                 reliable;
+
+    // ack requested frames already handled, so a retransmission is acked
+    // again but never reaches its handler twice
+    LoraDedup                    dedup;
+
+    // stream transfers, set by lora_stream_init()
+    LoraStream                  *stream;
+
+    // application and protocol timers, advanced by lora_engine_poll()
+    LoraTimerWheel               timers;
+
+    // next hops for lora_engine_send_routed(), learned from what we hear
+    LoraRouteTable               routes;
+
+    // floods seen and rebroadcasts waiting, see lora_engine_flood()
+    LoraFlood                    flood;
+
+    // lora_engine_random(), seeded from driver->get_entropy
+    uint32_t                     rng;
 };
 
 /**
@@ -89,13 +213,125 @@ struct _LoraEngine {
 */
 void lora_engine_init(LoraEngine *engine, LoraDriver *driver);
 
+/**
+*   32 random bits, for sequence numbers and delays, not for keys.
+*/
+uint32_t lora_engine_random(LoraEngine *engine);
+
 /**
 *   send a LoraMessage over the LoraEngine.
+*   With aggregation on, small messages are held and 1 means held: they go
+*   out together in one LORA_AGGREGATE frame once the window ends, another
+*   dest or other flags are sent or the frame is full. Ack requests and
+*   LORA_PRIORITY_BULK messages are never held.
+*   Under LORA_DUTY_CYCLE_DEFER a message over budget is queued instead,
+*   and lora_engine_poll() sends it once the window has room for it.
 */
 uint8_t lora_engine_send(LoraEngine *engine,
                          LoraMessage *msg,
                          uint16_t timeout);
 
+/**
+*   send msg with LORA_FLAG_ACK_REQ and a per-dest seq, always with the
+*   compact header, and retransmit it until dest answers with a LORA_ACK,
+*   at most LORA_RELIABLE_MAX_RETRIES times. lora_engine_poll() runs the
+*   timers; on_delivery reports the outcome, engine->reliable.stats the
+*   retries, goodput and latency. Returns 0 if msg was not accepted: a
+*   broadcast, not encodable, or LORA_RELIABLE_MAX_PENDING already waiting.
+*   Attempts never go through the queue or an aggregate. Over the
+*   LORA_DUTY_CYCLE_DEFER budget an attempt waits for room without using up
+*   a retry. One refused by the duty cycle or not sent by the radio ends
+*   the message: a first attempt returns 0, a later one reports on_delivery 0.
+*/
+uint8_t lora_engine_send_reliable(LoraEngine *engine,
+                                  LoraMessage *msg,
+                                  uint16_t timeout);
+
+/**
+*   send msg to a node that may be out of range. With a route of more than
+*   one hop it goes to the next hop inside a LORA_ROUTED frame, which
+*   every node on the way passes on; otherwise it is lora_engine_send().
+*   Routes are learned from received frames, so a node is reachable once
+*   it or something it sent through the mesh has been heard. The inner
+*   message travels without flags, LORA_FLAG_ACK_REQ only covers one hop.
+*/
+uint8_t lora_engine_send_routed(LoraEngine *engine,
+                                LoraMessage *msg,
+                                uint16_t timeout);
+
+/**
+*   send msg to every node of the mesh, within ttl hops (0 for
+*   LORA_FLOOD_DEFAULT_TTL). Each node hands it to its handler once and
+*   rebroadcasts it after a random delay, unless it heard enough copies
+*   meanwhile, see lora_flood.h. It also teaches every node the way back
+*   to us. msg's dest is ignored.
+*/
+uint8_t lora_engine_flood(LoraEngine *engine,
+                          LoraMessage *msg,
+                          uint8_t ttl,
+                          uint16_t timeout);
+
+/**
+*   queue a message and return at once, lora_engine_poll() sends it
+*   between receptions, highest priority class first. Returns 0 if msg can
+*   not be encoded or its class is full.
+*/
+uint8_t lora_engine_queue(LoraEngine *engine,
+                          LoraMessage *msg,
+                          LoraPriority priority,
+                          uint16_t timeout);
+
+/**
+*   usual class of a message type, for lora_engine_queue().
+*/
+LoraPriority lora_engine_priority_of(LoraMessageType type);
+
+/**
+*   1 if messages are waiting in the outbound queue.
+*/
+uint8_t lora_engine_tx_pending(const LoraEngine *engine);
+
+/**
+*   send a packed message as is, no encoding, so always with the legacy
+*   header. Same duty-cycle rules as lora_engine_send(), except that
+*   nothing is queued: over budget it returns 0. source must already be set.
+*/
+uint8_t lora_engine_send_packed(LoraEngine *engine,
+                                const LoraPackedMessage *packed,
+                                uint16_t timeout);
+
+/**
+*   configure duty-cycle accounting/enforcement for lora_engine_send().
+*   resets the airtime ledger.
+*/
+void lora_engine_set_duty_cycle(LoraEngine *engine,
+                                const LoraDutyCycleConfig *cfg);
+
+/**
+*   hold messages for up to window_ms so messages to the same dest share a
+*   frame, one preamble and one header. 0 sends whatever is held and turns
+*   aggregation off. lora_engine_loop() sends held messages when the window
+*   ends, which needs driver->get_time_ms.
+*/
+void lora_engine_set_aggregation(LoraEngine *engine, uint32_t window_ms);
+
+/**
+*   send held messages now. Returns 1 if sent or none were held.
+*/
+uint8_t lora_engine_flush(LoraEngine *engine);
+
+/**
+*   choose the frame header for lora_engine_send(). LORA_HEADER_AUTO learns
+*   which peers understand the compact header from the frames they send.
+*/
+void lora_engine_set_header_mode(LoraEngine *engine, LoraHeaderMode mode);
+
+/**
+*   mark a peer as able (1) or unable (0) to receive compact headers, eg for
+*   nodes known to run new firmware before they have been heard from.
+*/
+void lora_engine_set_peer_compact(LoraEngine *engine, NodeId peer, uint8_t compact);
+
 /**
 *   pass a LoraMessage to this engine for processing through 
 *   the appropriate handler function.
@@ -106,7 +342,64 @@ void lora_engine_handle_message(LoraEngine *engine,
 
 
 /**
-* Main Loop for LoraEngine
+*   route a zero-copy view to a view handler, if one is registered for its type.
+*   Returns 1 if the view was consumed, 0 if the frame needs a full
+*   lora_decode() + lora_engine_handle_message().
+*/
+uint8_t lora_engine_handle_view(LoraEngine *engine,
+                                const LoraMessageView *view);
+
+/**
+*   decode and dispatch one received frame. Frames for other nodes, or of
+*   a type without a registered handler, are dropped after reading only
+*   the header. Returns 1 if a handler got the frame. An ack request is
+*   only acked once its handler has run, so one that fails to decode or
+*   has no handler is retransmitted instead of lost.
+*/
+uint8_t lora_engine_handle_frame(LoraEngine *engine,
+                                 const uint8_t *buf,
+                                 size_t len);
+
+/**
+*   queue an event, safe from one interrupt priority level. Returns 0 if
+*   the queue is full, the event is then dropped and counted.
+*/
+uint8_t lora_engine_post_event(LoraEngine *engine, LoraEventType event);
+
+/**
+*   1 if events are waiting for lora_engine_poll().
+*/
+uint8_t lora_engine_has_events(const LoraEngine *engine);
+
+/**
+*   run timer's callback delay_ms from now, from lora_engine_poll(). Set
+*   the callback with lora_timer_setup() first. Restarts a running timer.
+*   Needs driver->get_time_ms.
+*/
+void lora_engine_start_timer(LoraEngine *engine, LoraTimer *timer, uint32_t delay_ms);
+
+/**
+*   stop a timer started with lora_engine_start_timer().
+*/
+void lora_engine_stop_timer(LoraEngine *engine, LoraTimer *timer);
+
+/**
+*   handle every pending event and due timer, then send at most one queued
+*   message, so received frames are looked at between sends. Never blocks
+*   except in the handlers and that one send. driver->receive_ready_flag counts as
+*   an LORA_EVENT_RX_DONE for drivers that still set it. Returns the number
+*   of events handled.
+*/
+uint8_t lora_engine_poll(LoraEngine *engine);
+
+/**
+*   poll, sleeping through driver->idle in between, until get_time_ms()
+*   reaches deadline_ms. Needs driver->get_time_ms.
+*/
+void lora_engine_run_until(LoraEngine *engine, uint32_t deadline_ms);
+
+/**
+* Main Loop for LoraEngine, poll and idle forever
 */
 void lora_engine_loop(LoraEngine *engine);
 
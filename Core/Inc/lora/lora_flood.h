@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include "lora_message_types.h"
+#include "lora_codec.h"
+#include "lora_dedup.h"
+#include "lora_timer.h"
+
+/**
+ * Bookkeeping for managed flooding, see lora_engine_flood().
+ *
+ * A flooded message is a LORA_ROUTED frame to LORA_NODE_BROADCAST_ID,
+ * numbered per origin. Every node handles the first copy it hears and
+ * schedules one rebroadcast at a random point within
+ * LORA_FLOOD_DELAY_SLOTS times on air, so neighbours that heard the same
+ * copy do not all answer at once. Further copies heard while waiting are
+ * counted; at LORA_FLOOD_SUPPRESS_COPIES the rebroadcast is dropped, the
+ * neighbourhood is covered already. ttl bounds how far it goes.
+ */
+
+// default ttl of the floods we start
+#define LORA_FLOOD_DEFAULT_TTL 4
+
+// rebroadcast delay, in times on air of the frame
+#define LORA_FLOOD_DELAY_SLOTS 8
+
+// copies heard, the first included, that cancel our rebroadcast
+#define LORA_FLOOD_SUPPRESS_COPIES 3
+
+// rebroadcasts waiting for their delay at once
+#define LORA_FLOOD_MAX_PENDING 2
+
+typedef struct {
+    uint8_t   in_use;
+    NodeId    origin;
+    uint8_t   seq;
+    uint8_t   copies;          // heard so far
+    uint16_t  timeout;         // transmit timeout
+    LoraTimer timer;           // fires the rebroadcast
+    uint8_t   packed[LORA_PACKED_MAX_SIZE]; // LoraPackedMessage, ready to go
+} LoraFloodPending;
+
+typedef struct {
+    uint32_t originated;
+    uint32_t rebroadcast;
+    uint32_t suppressed;       // rebroadcasts cancelled by copies heard
+    uint32_t dropped;          // out of ttl or no free pending slot
+} LoraFloodStats;
+
+typedef struct {
+    LoraDedup        seen;     // (origin, seq) of every flood handled
+    uint8_t          next_seq; // of the routed frames we originate
+    LoraFloodPending pending[LORA_FLOOD_MAX_PENDING];
+    uint32_t         rng;
+    LoraFloodStats   stats;
+} LoraFlood;
+
+/**
+*   reset everything, seed picks the first seq and the delays.
+*/
+void lora_flood_init(LoraFlood *flood, uint32_t seed);
+
+/**
+*   seq for the next LORA_ROUTED frame we originate.
+*/
+static inline uint8_t lora_flood_next_seq(LoraFlood *flood)
+{
+    return flood->next_seq++;
+}
+
+/**
+*   1 if (origin, seq) was handled before; then the copy is counted against
+*   its pending rebroadcast. 0 the first time.
+*/
+uint8_t lora_flood_seen(LoraFlood *flood, NodeId origin, uint8_t seq, uint32_t now_ms);
+
+/**
+*   a free pending slot, NULL if all are waiting.
+*/
+LoraFloodPending *lora_flood_slot(LoraFlood *flood);
+
+/**
+*   random rebroadcast delay for a frame of airtime_ms on air.
+*/
+uint32_t lora_flood_delay_ms(LoraFlood *flood, uint32_t airtime_ms);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lora_codec.h"
+
+/**
+ * Streaming LZSS compression for stream chunks (LORA_STREAM_FLAG_LZSS).
+ *
+ * Heatshrink-style bit stream, MSB first:
+ *     literal:  1  u8 byte
+ *     match:    0  u9 distance - 1  u4 length - LORA_LZSS_MIN_MATCH
+ *
+ * Both sides keep a LORA_LZSS_WINDOW byte history, so an encoder or a
+ * decoder is well under 1 KB of RAM and needs no heap. Input can be fed in
+ * any pieces, output goes to a LoraEncodeSink. The compressed stream is only
+ * complete after lora_lzss_finish().
+ *
+ * lora_stream sends and receives the compressed bytes as they are: compress
+ * into the buffer or source given to lora_stream_send(), and decompress
+ * what arrived once lora_stream_rx_flags() says it is compressed.
+ */
+#define LORA_LZSS_WINDOW_BITS  9
+#define LORA_LZSS_LENGTH_BITS  4
+#define LORA_LZSS_WINDOW       (1u << LORA_LZSS_WINDOW_BITS)
+#define LORA_LZSS_MIN_MATCH    2
+#define LORA_LZSS_MAX_MATCH    (LORA_LZSS_MIN_MATCH + (1u << LORA_LZSS_LENGTH_BITS) - 1)
+
+// output is handed to the sink in pieces of up to this many bytes
+#define LORA_LZSS_OUT_BYTES    16
+
+typedef struct {
+    uint8_t  window[LORA_LZSS_WINDOW];          // history ring
+    uint16_t head;                              // next write position in window
+    uint16_t filled;                            // valid history bytes
+    uint8_t  lookahead[LORA_LZSS_MAX_MATCH];
+    uint8_t  lookahead_len;
+
+    uint32_t bits;                              // pending output bits, right aligned
+    uint8_t  bit_count;
+    uint8_t  out[LORA_LZSS_OUT_BYTES];
+    uint8_t  out_len;
+} LoraLzssEncoder;
+
+typedef struct {
+    uint8_t  window[LORA_LZSS_WINDOW];
+    uint16_t head;
+    uint16_t filled;                            // valid history bytes
+
+    uint32_t bits;                              // pending input bits, right aligned
+    uint8_t  bit_count;
+    uint8_t  out[LORA_LZSS_OUT_BYTES];
+    uint8_t  out_len;
+} LoraLzssDecoder;
+
+/**
+*   start a new compressed stream.
+*/
+void lora_lzss_encoder_init(LoraLzssEncoder *enc);
+
+/**
+*   compress len bytes. Returns 1, or 0 if the sink refused output.
+*/
+uint8_t lora_lzss_compress(LoraLzssEncoder *enc, const uint8_t *in, size_t len,
+                           LoraEncodeSink sink, void *ctx);
+
+/**
+*   compress what is left and pad the last byte. Returns 1, or 0 if the
+*   sink refused output. Start again with lora_lzss_encoder_init().
+*/
+uint8_t lora_lzss_finish(LoraLzssEncoder *enc, LoraEncodeSink sink, void *ctx);
+
+/**
+*   start decompressing a new stream.
+*/
+void lora_lzss_decoder_init(LoraLzssDecoder *dec);
+
+/**
+*   decompress len bytes of compressed stream, eg one chunk. Returns 1, or 0
+*   if the sink refused output or the data is corrupt.
+*/
+uint8_t lora_lzss_decompress(LoraLzssDecoder *dec, const uint8_t *in, size_t len,
+                             LoraEncodeSink sink, void *ctx);
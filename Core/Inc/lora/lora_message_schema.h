@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stddef.h>
+#include "lora_message_types.h"
+
+/**
+ * Over-the-air layout of every LoraMessageType, in one place.
+ *
+ * lora_codec.c expands these tables into the encoder, decoder, validator
+ * and exact size function of each message, and the wire structs below give
+ * compile-time offsets and maximum sizes. Adding a message type means adding
+ * its field list and one LORA_MESSAGE_SCHEMA row.
+ *
+ * Field kinds, encoded in order, integers little endian:
+ *     U8(field)                    1 byte (enums are sent as one byte)
+ *     U16(field)                   2 bytes
+ *     U32(field)                   4 bytes
+ *     U8_MEMBER(field, member)     1 byte from field.member (single member unions)
+ *     ZERO(field)                  not sent, cleared on decode
+ *     OPT_U8(field)                1 byte, always sent, 0 if an older sender
+ *                                  left it out. Must come last.
+ *     OPT_U32(field)               same with 4 bytes
+ *     BYTES(field, len_field, max) len_field bytes of field[], len_field must
+ *                                  be an earlier U8 field. Must come last.
+ *     UNION(tag_field, name, table) one member of a tagged union, chosen by
+ *                                  tag_field through a sub table. Must come last.
+ *     TAIL(field, len_field, max)  the rest of the frame into field[], len_field
+ *                                  is not sent, decode sets it. Must come last.
+ *     CUSTOM(codec, field, max)    up to max bytes written by hand coded
+ *                                  codec_size/_encode/_decode/_check functions
+ *                                  in lora_codec.c. Must come last.
+ */
+
+// LORA_DATA payloads, rows are (tag, member path, C type, NAME)
+#define LORA_SCHEMA_CLIMATE_DATA(F) \
+    F(U16, temperature_tenths)      \
+    F(U16, humidity_tenths)
+
+// samples: first absolute, then zig-zag varint deltas
+#define LORA_SCHEMA_CLIMATE_SERIES(F) \
+    F(U16, interval_s)                \
+    F(U8,  sample_count)              \
+    F(CUSTOM, climate_series, samples, LORA_CLIMATE_SERIES_MAX_SAMPLE_BYTES)
+
+#define LORA_DATA_SCHEMA(X) \
+    X(LORA_DATA_TYPE_CLIMATE,        payload.climate_data,   ClimateData,   CLIMATE_DATA) \
+    X(LORA_DATA_TYPE_CLIMATE_SERIES, payload.climate_series, ClimateSeries, CLIMATE_SERIES)
+
+// message payloads
+#define LORA_SCHEMA_RAW(F) \
+    F(TAIL, data, data_len, LORA_STREAM_MAX_CHUNK_SIZE)
+
+#define LORA_SCHEMA_PING_REQUEST(F) \
+    F(ZERO, _reserved)
+
+#define LORA_SCHEMA_PING_RESPONSE(F) \
+    F(ZERO, _reserved)
+
+#define LORA_SCHEMA_DATA_REQUEST(F) \
+    F(U8, data_type)
+
+#define LORA_SCHEMA_DATA(F) \
+    F(U8, data_type)        \
+    F(UNION, data_type, payload, LORA_DATA_SCHEMA)
+
+#define LORA_SCHEMA_COMMAND_REQUEST(F) \
+    F(U8, command_type)                \
+    F(U8_MEMBER, command_value, value)
+
+#define LORA_SCHEMA_COMMAND_RESPONSE(F) \
+    F(U8, command_type)                 \
+    F(U8, command_status)
+
+#define LORA_SCHEMA_STREAM_REQUEST(F) \
+    F(U8, stream_type)
+
+#define LORA_SCHEMA_STREAM_ANNOUNCE(F) \
+    F(U8,  stream_type)                \
+    F(U8,  stream_id)                  \
+    F(U16, sequence_number)            \
+    F(U8,  packets_in_sequence)        \
+    F(OPT_U8, flags)
+
+#define LORA_SCHEMA_STREAM_ANNOUNCE_ACK(F) \
+    F(U8,  stream_id)                      \
+    F(U16, sequence_number)
+
+#define LORA_SCHEMA_STREAM_SEQUENCE(F) \
+    F(U8,  stream_type)                \
+    F(U8,  stream_id)                  \
+    F(U16, sequence_number)            \
+    F(U8,  packet_index)               \
+    F(U8,  packets_in_sequence)        \
+    F(U8,  chunk_len)                  \
+    F(BYTES, chunk, chunk_len, LORA_STREAM_MAX_CHUNK_SIZE)
+
+#define LORA_SCHEMA_STREAM_SEQUENCE_ACK(F) \
+    F(U8,  stream_id)                      \
+    F(U16, sequence_number)                \
+    F(U8,  status)                         \
+    F(U32, missing_bitmap)
+
+#define LORA_SCHEMA_STREAM_COMPLETE(F) \
+    F(U8, stream_id)                   \
+    F(OPT_U32, crc32)
+
+#define LORA_SCHEMA_AGGREGATE(F) \
+    F(TAIL, entries, entries_len, LORA_AGGREGATE_MAX_BYTES)
+
+#define LORA_SCHEMA_ACK(F) \
+    F(U8, seq)
+
+#define LORA_SCHEMA_ROUTED(F) \
+    F(U8, origin)              \
+    F(U8, target)              \
+    F(U8, ttl)                 \
+    F(U8, hops)                \
+    F(U8, seq)                 \
+    F(TAIL, inner, inner_len, LORA_ROUTED_MAX_BYTES)
+
+/**
+ * Every message type: (LoraMessageType, LoraPayload member, C type, NAME)
+ * NAME selects LORA_SCHEMA_<NAME> and names the generated functions.
+ */
+#define LORA_MESSAGE_SCHEMA(X)                                                          \
+    X(LORA_RAW,                 raw,                 LoraRaw,               RAW)                 \
+    X(LORA_PING_REQUEST,        ping_req,            LoraPingReq,           PING_REQUEST)        \
+    X(LORA_PING_RESPONSE,       ping_resp,           LoraPingResp,          PING_RESPONSE)       \
+    X(LORA_DATA_REQUEST,        data_req,            LoraDataReq,           DATA_REQUEST)        \
+    X(LORA_DATA,                data,                LoraData,              DATA)                \
+    X(LORA_COMMAND_REQUEST,     command_req,         LoraCommandReq,        COMMAND_REQUEST)     \
+    X(LORA_COMMAND_RESPONSE,    command_resp,        LoraCommandResp,       COMMAND_RESPONSE)    \
+    X(LORA_STREAM_REQUEST,      stream_req,          LoraStreamRequest,     STREAM_REQUEST)      \
+    X(LORA_STREAM_ANNOUNCE,     stream_announce,     LoraStreamAnnounce,    STREAM_ANNOUNCE)     \
+    X(LORA_STREAM_ANNOUNCE_ACK, stream_announce_ack, LoraStreamAnnounceAck, STREAM_ANNOUNCE_ACK) \
+    X(LORA_STREAM_SEQUENCE,     stream_sequence,     LoraStreamSequence,    STREAM_SEQUENCE)     \
+    X(LORA_STREAM_SEQUENCE_ACK, stream_seq_ack,      LoraStreamSequenceAck, STREAM_SEQUENCE_ACK) \
+    X(LORA_STREAM_COMPLETE,     stream_complete,     LoraStreamComplete,    STREAM_COMPLETE)     \
+    X(LORA_AGGREGATE,           aggregate,           LoraAggregate,         AGGREGATE)           \
+    X(LORA_ACK,                 ack,                 LoraAck,               ACK)                 \
+    X(LORA_ROUTED,              routed,              LoraRouted,            ROUTED)
+
+/**
+ * Wire structs: one uint8_t array per field, so they have no padding and
+ * offsetof() is the on-air offset. Variable fields take their maximum size.
+ * Only used for sizes and offsets, never instantiated.
+ */
+#define LORA_WIRE_FIELD(kind, ...)             LORA_WIRE_##kind(__VA_ARGS__)
+#define LORA_WIRE_U8(field)                    uint8_t field[1];
+#define LORA_WIRE_U16(field)                   uint8_t field[2];
+#define LORA_WIRE_U32(field)                   uint8_t field[4];
+#define LORA_WIRE_U8_MEMBER(field, member)     uint8_t field[1];
+#define LORA_WIRE_ZERO(field)
+#define LORA_WIRE_OPT_U8(field)                uint8_t field[1];
+#define LORA_WIRE_OPT_U32(field)               uint8_t field[4];
+#define LORA_WIRE_BYTES(field, len_field, max) uint8_t field[max];
+#define LORA_WIRE_TAIL(field, len_field, max)  uint8_t field[max];
+#define LORA_WIRE_CUSTOM(codec, field, max)    uint8_t field[max];
+#define LORA_WIRE_UNION(tag_field, name, table) \
+    LoraWireUnion_##table name;
+#define LORA_WIRE_UNION_MEMBER(tag, path, ctype, NAME) \
+    uint8_t NAME[LORA_WIRE_MAX_SIZE(NAME)];
+
+#define LORA_WIRE_STRUCT(type_id, member, ctype, NAME) \
+    typedef struct { LORA_SCHEMA_##NAME(LORA_WIRE_FIELD) uint8_t _wire_end; } LoraWire_##NAME;
+
+// maximum payload size of NAME in bytes
+#define LORA_WIRE_MAX_SIZE(NAME)        offsetof(LoraWire_##NAME, _wire_end)
+// offset of a payload field from the start of the payload
+#define LORA_WIRE_OFFSET(NAME, field)   offsetof(LoraWire_##NAME, field)
+
+LORA_DATA_SCHEMA(LORA_WIRE_STRUCT)
+
+// largest member of each UNION sub table
+typedef union { LORA_DATA_SCHEMA(LORA_WIRE_UNION_MEMBER) } LoraWireUnion_LORA_DATA_SCHEMA;
+
+LORA_MESSAGE_SCHEMA(LORA_WIRE_STRUCT)
+
+/**
+ * Minimum payload size: everything but BYTES, TAIL, UNION, OPT and CUSTOM fields.
+ */
+#define LORA_WIRE_MIN_FIELD(kind, ...)             LORA_WIRE_MIN_##kind(__VA_ARGS__)
+#define LORA_WIRE_MIN_U8(field)                    + 1
+#define LORA_WIRE_MIN_U16(field)                   + 2
+#define LORA_WIRE_MIN_U32(field)                   + 4
+#define LORA_WIRE_MIN_U8_MEMBER(field, member)     + 1
+#define LORA_WIRE_MIN_ZERO(field)
+#define LORA_WIRE_MIN_OPT_U8(field)
+#define LORA_WIRE_MIN_OPT_U32(field)
+#define LORA_WIRE_MIN_BYTES(field, len_field, max)
+#define LORA_WIRE_MIN_UNION(tag_field, name, table)
+#define LORA_WIRE_MIN_TAIL(field, len_field, max)
+#define LORA_WIRE_MIN_CUSTOM(codec, field, max)
+
+#define LORA_WIRE_MIN_ENUM(type_id, member, ctype, NAME) \
+    LORA_WIRE_MIN_SIZE_##NAME = 0 LORA_SCHEMA_##NAME(LORA_WIRE_MIN_FIELD),
+
+enum {
+    LORA_DATA_SCHEMA(LORA_WIRE_MIN_ENUM)
+    LORA_MESSAGE_SCHEMA(LORA_WIRE_MIN_ENUM)
+};
+
+#define LORA_WIRE_MIN_SIZE(NAME) LORA_WIRE_MIN_SIZE_##NAME
+
+/**
+ * Largest payload of any message type. The +1/-1 keeps payload-less
+ * messages from declaring zero length arrays.
+ */
+#define LORA_WIRE_ANY_MEMBER(type_id, member, ctype, NAME) \
+    uint8_t NAME[LORA_WIRE_MAX_SIZE(NAME) + 1];
+
+typedef union {
+    LORA_MESSAGE_SCHEMA(LORA_WIRE_ANY_MEMBER)
+} LoraWireAnyPayload;
+
+#define LORA_MAX_PAYLOAD_SIZE (sizeof(LoraWireAnyPayload) - 1)
@@ -9,6 +9,17 @@ typedef uint8_t NodeId;
 #define LORA_STREAM_MAX_CHUNK_SIZE 128
 #define LORA_STREAM_MAX_PACKETS_PER_SEQ 32
 
+/**
+    Message Type:
+        RAW
+
+        Only data_len bytes are sent, the length comes from the frame length.
+*/
+typedef struct {
+    uint8_t data_len;
+    uint8_t data[LORA_STREAM_MAX_CHUNK_SIZE];
+} LoraRaw;
+
 /**
     Message Type:
         PING
@@ -29,12 +40,28 @@ typedef struct {
     int16_t humidity_tenths;
 } ClimateData;
 
+// Up to this many readings in one LORA_DATA_TYPE_CLIMATE_SERIES frame,
+// fewer if the deltas are large, see lora_climate_series_sample_bytes()
+#define LORA_CLIMATE_SERIES_MAX_SAMPLES 32
+
+// Wire budget for the samples of a series, keeps it within LORA_MAX_ENCODED_SIZE
+#define LORA_CLIMATE_SERIES_MAX_SAMPLE_BYTES 128
+
+// samples[i] was taken interval_s * i seconds after samples[0]
+typedef struct {
+    uint16_t interval_s;
+    uint8_t sample_count;
+    ClimateData samples[LORA_CLIMATE_SERIES_MAX_SAMPLES];
+} ClimateSeries;
+
 typedef enum  {
     LORA_DATA_TYPE_CLIMATE = 1,
+    LORA_DATA_TYPE_CLIMATE_SERIES = 2,
 } LoraDataType;
 
 typedef union {
     ClimateData climate_data;
+    ClimateSeries climate_series;
     // will add more data types later, so keep the union here
 } LoraDataPayload;
 
@@ -99,8 +126,12 @@ typedef struct {
     uint8_t stream_id;
     uint16_t sequence_number; // announce a sequence number
     uint8_t packets_in_sequence;
+    uint8_t flags;            // LORA_STREAM_FLAG_*, absent from old senders' frames (0)
 } LoraStreamAnnounce;
 
+// LoraStreamAnnounce.flags
+#define LORA_STREAM_FLAG_LZSS 0x01 // chunks carry one lora_lzss compressed byte stream, compressed by the application
+
 typedef struct {
     uint8_t stream_id;
     uint16_t sequence_number; // May be an undefined number of sequences at this point.
@@ -133,8 +164,58 @@ typedef struct {
 // sent by sender when entire stream contents has been sent
 typedef struct {
     uint8_t stream_id;
+    uint32_t crc32;           // lora_crc32() of the whole stream, 0 = not sent (older senders)
 } LoraStreamComplete;
 
+/**
+    Message Type:
+        AGGREGATE
+
+        Several messages to the same dest in one frame, each entry is
+        u8 message_type, u8 payload length, payload. Build and walk it with
+        lora_aggregate_append() / lora_aggregate_next().
+*/
+#define LORA_AGGREGATE_MAX_BYTES 128
+
+typedef struct {
+    uint8_t entries_len;      // bytes used in entries[], not sent
+    uint8_t entries[LORA_AGGREGATE_MAX_BYTES];
+} LoraAggregate;
+
+/**
+    Message Type:
+        ACK
+
+        Acknowledges the frame from dest that carried LORA_FLAG_ACK_REQ and
+        this seq, see lora_engine_send_reliable().
+*/
+typedef struct {
+    uint8_t seq;
+} LoraAck;
+
+/**
+    Message Type:
+        ROUTED
+
+        A message on its way from origin to target over several hops. The
+        frame's source and dest are the hop it is on; inner is the message
+        type then its payload, as sent from origin to target. Every
+        forwarder takes one off ttl and adds one to hops. Build and open it
+        with lora_routed_wrap() / lora_routed_unwrap(). A target of
+        LORA_NODE_BROADCAST_ID floods the whole mesh, see lora_flood.h.
+*/
+#define LORA_ROUTED_MAX_BYTES 128
+
+typedef struct {
+    NodeId  origin;
+    NodeId  target;
+    uint8_t ttl;              // hops it may still take
+    uint8_t hops;             // hops taken so far
+    uint8_t seq;              // numbered per origin, tells flood copies apart
+    uint8_t inner_len;        // bytes used in inner[], not sent
+    uint8_t inner[LORA_ROUTED_MAX_BYTES];
+} LoraRouted;
+
 /**
     LoraMessage
         - Message Type 
@@ -159,15 +240,27 @@ typedef enum {
     LORA_STREAM_SEQUENCE = 10,
     LORA_STREAM_SEQUENCE_ACK = 11,
     LORA_STREAM_COMPLETE = 12,
+
+    LORA_AGGREGATE = 13,
+
+    LORA_ACK = 14,
+
+    LORA_ROUTED = 15,
 } LoraMessageType;
 
 typedef struct {
     NodeId source;
     NodeId dest;
+    uint8_t flags; // LORA_FLAG_*
+    uint8_t seq;   // per dest sequence number, only sent with LORA_FLAG_ACK_REQ
 } LoraMetadata;
 
+// LoraMetadata.flags
+#define LORA_FLAG_ACK_REQ  0x01 // sender asks for an acknowledgement
+#define LORA_FLAG_COMPACT  0x02 // compact frame header, see lora_codec.h
+
  typedef union {
-    uint8_t         raw[LORA_STREAM_MAX_CHUNK_SIZE];
+    LoraRaw         raw;
 
     LoraPingReq     ping_req;
     LoraPingResp    ping_resp;
@@ -184,6 +277,12 @@ typedef struct {
     LoraStreamSequence stream_sequence;
     LoraStreamSequenceAck stream_seq_ack;
     LoraStreamComplete stream_complete;
+
+    LoraAggregate aggregate;
+
+    LoraAck ack;
+
+    LoraRouted routed;
 } LoraPayload;
 
 typedef struct {
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Cycle-accurate profiling of the radio stack using the Cortex-M4 DWT
+ * cycle counter (CYCCNT, 170 MHz on the G431).
+ *
+ * Build with LORA_PROFILE_ENABLED=1 to turn it on. When disabled every
+ * macro and API call below compiles to nothing, so instrumented code pays
+ * no cost and host builds never touch CMSIS.
+ *
+ * Usage:
+ *     LORA_PROFILE_START(t);
+ *     ... code under test ...
+ *     LORA_PROFILE_STOP(t, LORA_PROFILE_DECODE);
+ */
+#ifndef LORA_PROFILE_ENABLED
+#define LORA_PROFILE_ENABLED 0
+#endif
+
+// Handler zones are indexed by LoraMessageType, keep room for all of them
+#define LORA_PROFILE_MAX_MESSAGE_TYPES 16
+
+// Histogram bucket i counts samples with 4^i <= cycles < 4^(i+1)
+#define LORA_PROFILE_HIST_BUCKETS 16
+
+typedef enum {
+    LORA_PROFILE_SPI_READ = 0,      // LoRa_readReg
+    LORA_PROFILE_SPI_WRITE,         // LoRa_writeReg
+    LORA_PROFILE_SPI_BURST_WRITE,   // LoRa_BurstWrite
+    LORA_PROFILE_RECEIVE,           // LoRa_receive
+    LORA_PROFILE_DECODE,            // lora_decode
+    LORA_PROFILE_HANDLE_MESSAGE,    // lora_engine_handle_message, handler included
+
+    // one zone per handler, use LORA_PROFILE_HANDLER(message_type)
+    LORA_PROFILE_HANDLER_BASE,
+    LORA_PROFILE_ZONE_COUNT = LORA_PROFILE_HANDLER_BASE + LORA_PROFILE_MAX_MESSAGE_TYPES
+} LoraProfileZone;
+
+#define LORA_PROFILE_HANDLER(message_type) \
+    ((LoraProfileZone)(LORA_PROFILE_HANDLER_BASE + (message_type)))
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;  // mean = total_cycles / count
+    uint16_t histogram[LORA_PROFILE_HIST_BUCKETS]; // saturates at 0xFFFF
+} LoraProfileStats;
+
+#if LORA_PROFILE_ENABLED
+
+#include "stm32g4xx.h"
+
+static inline uint32_t lora_profile_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+#define LORA_PROFILE_START(var) \
+    uint32_t var = lora_profile_cycles()
+#define LORA_PROFILE_STOP(var, zone) \
+    lora_profile_record((zone), lora_profile_cycles() - (var))
+
+/**
+*   enable the DWT cycle counter and clear all zones.
+*/
+void lora_profile_init(void);
+
+/**
+*   clear all zones, keeps the counter running.
+*/
+void lora_profile_reset(void);
+
+/**
+*   add one sample of `cycles` to `zone`.
+*/
+void lora_profile_record(LoraProfileZone zone, uint32_t cycles);
+
+/**
+*   returns the stats of a zone, NULL if out of range.
+*/
+const LoraProfileStats *lora_profile_get(LoraProfileZone zone);
+
+/**
+*   print one line per zone that has samples, eg lora_profile_report(uart_print).
+*/
+void lora_profile_report(void (*print)(const char *line));
+
+#else
+
+#define LORA_PROFILE_START(var)        ((void)0)
+#define LORA_PROFILE_STOP(var, zone)   ((void)0)
+
+#define lora_profile_init()            ((void)0)
+#define lora_profile_reset()           ((void)0)
+#define lora_profile_record(zone, cycles) ((void)0)
+#define lora_profile_get(zone)         ((const LoraProfileStats *)0)
+#define lora_profile_report(print)     ((void)0)
+
+#endif
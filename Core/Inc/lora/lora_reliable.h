@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include "lora_message_types.h"
+#include "lora_codec.h"
+
+/**
+ * Bookkeeping for acknowledged sends, see lora_engine_send_reliable().
+ *
+ * Each destination gets its own sequence numbers and round trip estimate.
+ * A message is kept, packed, until its LORA_ACK arrives or it has been
+ * retransmitted LORA_RELIABLE_MAX_RETRIES times. The retransmission
+ * timeout is the measured RTT (srtt + 4 * rttvar, RFC 6298) but never less
+ * than the time on air of the frame and its ack, doubled on every retry
+ * and jittered so nodes that collided do not collide again.
+ */
+
+// messages waiting for an ack at once
+#define LORA_RELIABLE_MAX_PENDING 4
+
+// destinations with their own seq and RTT, the least recently used is reused
+#define LORA_RELIABLE_MAX_PEERS 8
+
+#define LORA_RELIABLE_MAX_RETRIES 4
+
+// receiver turnaround on top of the two times on air, before any RTT sample
+#define LORA_RELIABLE_TURNAROUND_MS 50
+
+// backoff stops doubling here
+#define LORA_RELIABLE_MAX_RTO_MS 30000
+
+typedef struct {
+    NodeId   id;
+    uint8_t  next_seq;
+    uint16_t srtt_ms;          // 0 = no sample yet
+    uint16_t rttvar_ms;
+    uint32_t last_used_ms;
+} LoraReliablePeer;
+
+typedef struct {
+    uint8_t  in_use;
+    NodeId   dest;
+    uint8_t  seq;
+    uint8_t  retries;
+    uint8_t  deferred;         // attempt waiting for duty-cycle budget until retry_at_ms
+    uint8_t  frame_len;        // bytes on air per attempt
+    uint16_t timeout;          // transmit timeout, for every attempt
+    uint32_t first_sent_ms;
+    uint32_t sent_ms;          // start of the latest attempt
+    uint32_t retry_at_ms;
+    uint8_t  packed[LORA_PACKED_MAX_SIZE]; // LoraPackedMessage
+} LoraReliablePending;
+
+/**
+ * Goodput is delivered_bytes / tx_bytes, latency_total_ms / delivered the
+ * mean delivery latency.
+ */
+typedef struct {
+    uint32_t sent;             // messages accepted
+    uint32_t delivered;        // acknowledged
+    uint32_t failed;           // retries exhausted
+    uint32_t retries;          // retransmissions
+    uint32_t tx_bytes;         // frame bytes put on air, retransmissions included
+    uint32_t delivered_bytes;  // frame bytes of delivered messages, once each
+    uint32_t latency_total_ms; // first attempt to ack, delivered messages
+    uint32_t latency_max_ms;
+} LoraReliableStats;
+
+typedef struct {
+    LoraReliablePeer    peers[LORA_RELIABLE_MAX_PEERS];
+    uint8_t             peer_count;
+    LoraReliablePending pending[LORA_RELIABLE_MAX_PENDING];
+    uint32_t            rng;
+    LoraReliableStats   stats;
+} LoraReliable;
+
+/**
+*   reset everything, seed picks the first seq of each peer and the jitter.
+*/
+void lora_reliable_init(LoraReliable *rel, uint32_t seed);
+
+/**
+*   a free pending slot, NULL if all are waiting for acks.
+*/
+LoraReliablePending *lora_reliable_slot(LoraReliable *rel);
+
+/**
+*   next sequence number for dest.
+*/
+uint8_t lora_reliable_next_seq(LoraReliable *rel, NodeId dest, uint32_t now_ms);
+
+/**
+*   schedule the next retransmission of p, sent at p->sent_ms. min_rtt_ms is
+*   the time on air of the frame and of its ack plus turnaround.
+*/
+void lora_reliable_arm(LoraReliable *rel, LoraReliablePending *p, uint32_t min_rtt_ms);
+
+/**
+*   match an ack from source. Frees the slot, updates RTT and stats.
+*   Returns 1 if it acknowledged a pending message.
+*/
+uint8_t lora_reliable_ack(LoraReliable *rel, NodeId source, uint8_t seq, uint32_t now_ms);
+
+/**
+*   the pending message whose timer is due, or NULL.
+*/
+LoraReliablePending *lora_reliable_due(LoraReliable *rel, uint32_t now_ms);
+
+/**
+*   ms until the next retransmission timer, UINT32_MAX if none.
+*/
+uint32_t lora_reliable_next_deadline(const LoraReliable *rel, uint32_t now_ms);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include "lora_message_types.h"
+
+/**
+ * Next-hop routing table for LORA_ROUTED frames, see
+ * lora_engine_send_routed().
+ *
+ * Nothing is configured up front. Every frame heard is a one hop route to
+ * its sender, and every routed frame a route back to its origin through
+ * the neighbour that passed it on, one hop longer than it has come. An
+ * entry gives way to a route with no more hops, or is updated in place by
+ * its own next hop; it is dropped after expiry_ms without traffic to
+ * refresh it. When the table is full the stalest entry is replaced.
+ */
+
+#define LORA_ROUTE_MAX_ENTRIES 16
+
+// ttl of the frames we originate, and the longest route kept. Floods
+// teach routes as long as their ttl, so keep this at least
+// LORA_FLOOD_DEFAULT_TTL; a loop costs at most this many frames.
+#define LORA_ROUTE_MAX_HOPS 8
+
+#define LORA_ROUTE_DEFAULT_EXPIRY_MS 600000
+
+typedef struct {
+    NodeId   dest;
+    NodeId   next_hop;
+    uint8_t  hops;             // 1 = in direct range, 0 = free entry
+    uint32_t updated_ms;
+} LoraRouteEntry;
+
+typedef struct {
+    uint32_t forwarded;        // routed frames passed on
+    uint32_t dropped;          // out of ttl, or no way on but back
+} LoraRouteStats;
+
+typedef struct {
+    LoraRouteEntry entries[LORA_ROUTE_MAX_ENTRIES];
+    uint32_t       expiry_ms;
+    LoraRouteStats stats;
+} LoraRouteTable;
+
+/**
+*   empty table. expiry_ms 0 takes LORA_ROUTE_DEFAULT_EXPIRY_MS.
+*/
+void lora_route_init(LoraRouteTable *table, uint32_t expiry_ms);
+
+/**
+*   dest was heard hops away through next_hop.
+*/
+void lora_route_learn(LoraRouteTable *table,
+                      NodeId dest,
+                      NodeId next_hop,
+                      uint8_t hops,
+                      uint32_t now_ms);
+
+/**
+*   the live route to dest, NULL if there is none.
+*/
+const LoraRouteEntry *lora_route_lookup(const LoraRouteTable *table,
+                                        NodeId dest,
+                                        uint32_t now_ms);
+
+/**
+*   forget every route through next_hop, eg when it stopped answering.
+*/
+void lora_route_forget_hop(LoraRouteTable *table, NodeId next_hop);
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * SPI transaction tracer for the SX127x driver (LoRa.c).
+ *
+ * Build with LORA_SPI_TRACE_ENABLED=1 to record every LoRa_readReg,
+ * LoRa_writeReg and LoRa_BurstWrite into a ring, tagged with the high level
+ * LoRa_* operation it belongs to. lora_spi_trace_dump() prints the ring as
+ * text lines which Core/Tools/spi_trace_analyze turns into a report.
+ *
+ * When disabled every macro and API call compiles to nothing.
+ */
+#ifndef LORA_SPI_TRACE_ENABLED
+#define LORA_SPI_TRACE_ENABLED 0
+#endif
+
+#ifndef LORA_SPI_TRACE_DEPTH
+#define LORA_SPI_TRACE_DEPTH 128
+#endif
+
+// dump format version, bump when LoraSpiTraceRecord or the line format changes
+#define LORA_SPI_TRACE_VERSION 1
+
+// High level operations, shared with the host tool so names stay in sync
+#define LORA_SPI_TRACE_OPS(X) \
+    X(NONE)                   \
+    X(INIT)                   \
+    X(GOTO_MODE)              \
+    X(SET_LDO)                \
+    X(SET_FREQUENCY)          \
+    X(SET_SPREADING_FACTOR)   \
+    X(SET_POWER)              \
+    X(SET_OCP)                \
+    X(SET_CRC)                \
+    X(SET_SYNC_WORD)          \
+    X(TRANSMIT)               \
+    X(RECEIVE)                \
+    X(GET_RSSI)               \
+    X(RANDOM)
+
+#define LORA_SPI_TRACE_OP_ENUM(name) LORA_SPI_OP_##name,
+typedef enum {
+    LORA_SPI_TRACE_OPS(LORA_SPI_TRACE_OP_ENUM)
+    LORA_SPI_OP_COUNT
+} LoraSpiTraceOp;
+#undef LORA_SPI_TRACE_OP_ENUM
+
+#define LORA_SPI_TRACE_WRITE 0x01   // flags: 0 = register read
+#define LORA_SPI_TRACE_BURST 0x02   // flags: LoRa_BurstWrite
+
+typedef struct {
+    uint32_t start_cycles;  // DWT CYCCNT when CS went low
+    uint32_t bus_cycles;    // cycles CS was held low
+    uint8_t  reg;           // register address, R/W bit stripped
+    uint8_t  flags;         // LORA_SPI_TRACE_*
+    uint8_t  len;           // data bytes, saturates at 255
+    uint8_t  op;            // LoraSpiTraceOp
+    uint8_t  value;         // first data byte
+} LoraSpiTraceRecord;
+
+#if LORA_SPI_TRACE_ENABLED
+
+#include "stm32g4xx.h"
+
+static inline uint32_t lora_spi_trace_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+/**
+*   enable the DWT cycle counter and empty the ring.
+*/
+void lora_spi_trace_init(void);
+
+/**
+*   empty the ring.
+*/
+void lora_spi_trace_reset(void);
+
+/**
+*   called by LoRa.c for every transaction.
+*/
+void lora_spi_trace_record(uint8_t reg, uint8_t flags, uint16_t len,
+                           uint8_t value, uint32_t start_cycles);
+
+/**
+*   tag the following transactions with `op`, unless an outer op is active.
+*   returns the op to hand back to lora_spi_trace_end_op().
+*/
+uint8_t lora_spi_trace_begin_op(uint8_t op);
+void lora_spi_trace_end_op(uint8_t prev_op);
+
+/**
+*   print the ring, oldest first, eg lora_spi_trace_dump(uart_print).
+*   records are not removed.
+*/
+void lora_spi_trace_dump(void (*print)(const char *line));
+
+#define LORA_SPI_TRACE_START(var) \
+    uint32_t var = lora_spi_trace_cycles()
+#define LORA_SPI_TRACE_RECORD(reg, flags, len, value, var) \
+    lora_spi_trace_record((reg), (flags), (len), (value), (var))
+#define LORA_SPI_TRACE_OP_BEGIN(op) \
+    uint8_t _spi_trace_prev_op = lora_spi_trace_begin_op(LORA_SPI_OP_##op)
+#define LORA_SPI_TRACE_OP_END() \
+    lora_spi_trace_end_op(_spi_trace_prev_op)
+
+#else
+
+#define LORA_SPI_TRACE_START(var)                          ((void)0)
+#define LORA_SPI_TRACE_RECORD(reg, flags, len, value, var) ((void)0)
+#define LORA_SPI_TRACE_OP_BEGIN(op)                        ((void)0)
+#define LORA_SPI_TRACE_OP_END()                            ((void)0)
+
+#define lora_spi_trace_init()      ((void)0)
+#define lora_spi_trace_reset()     ((void)0)
+#define lora_spi_trace_dump(print) ((void)0)
+
+#endif
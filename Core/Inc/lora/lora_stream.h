@@ -0,0 +1,252 @@
+#pragma once
+
+#include <stdint.h>
+#include "lora_message_types.h"
+#include "lora_engine.h"
+#include "lora_arena.h"
+
+/**
+ * Stream transfer over the LORA_STREAM_* messages, sender and receiver.
+ *
+ * A stream is cut into sequences of up to LORA_STREAM_MAX_PACKETS_PER_SEQ
+ * packets of LORA_STREAM_MAX_CHUNK_SIZE bytes. Only the last packet of the
+ * stream may be shorter and only the last sequence may have fewer packets,
+ * so a chunk's offset follows from sequence_number and packet_index.
+ *
+ *   sender                               receiver
+ *   STREAM_ANNOUNCE (seq n, packets) -->
+ *                                    <-- STREAM_ANNOUNCE_ACK
+ *   STREAM_SEQUENCE x packets        -->     back to back
+ *                                    <-- STREAM_SEQUENCE_ACK (missing_bitmap)
+ *   STREAM_SEQUENCE missing only     -->     until missing_bitmap is 0
+ *   ... next sequence ...
+ *   STREAM_COMPLETE (crc32)          -->     ack requested
+ *
+ * The receiver acks a sequence when its last packet arrives, or when no
+ * packet came for two packet times. A sender that hears nothing announces
+ * the same sequence again, which the receiver answers with where it is:
+ * an ANNOUNCE_ACK if it has nothing yet, a SEQUENCE_ACK otherwise. All
+ * timeouts come from the time on air of the frames involved.
+ *
+ * The sender pulls its data from a LoraStreamSource as packets go out, so
+ * a transfer can be far larger than RAM: flash, an SPI memory or a sensor
+ * read on demand. It keeps LORA_STREAM_READ_AHEAD chunks, read while it
+ * waits for acks so a burst is not held up by the source; retransmissions
+ * read their chunk again.
+ *
+ * The receiver either hands every chunk to on_chunk, or, with a buffer
+ * from lora_stream_rx_reserve(), copies it from the radio frame straight to
+ * its final offset. A stream that outgrows the buffer is refused at the
+ * announce of the sequence that would not fit. Either way each chunk's CRC
+ * is taken as it arrives and chained in stream order once its sequence is
+ * complete, so on_done can say whether the stream matches the sender's.
+ *
+ * One transfer each way at a time. lora_stream_init() takes over the
+ * engine's stream handlers; lora_engine_poll() drives the timers and queues
+ * the packets in LORA_PRIORITY_BULK, one whenever the queue has run empty,
+ * so receptions and control messages get in between.
+ */
+
+// receiver's ack timeout, in packet times without a packet
+#define LORA_STREAM_ACK_IDLE_PACKETS 2
+
+// extra time for the far side to turn around, on top of time on air
+#define LORA_STREAM_TURNAROUND_MS 50
+
+// announces without an answer before the sender gives up
+#define LORA_STREAM_MAX_RETRIES 5
+
+#define LORA_STREAM_SEQUENCE_BYTES \
+    ((uint32_t)LORA_STREAM_MAX_PACKETS_PER_SEQ * LORA_STREAM_MAX_CHUNK_SIZE)
+
+// chunks the sender holds read ahead, LORA_STREAM_MAX_CHUNK_SIZE bytes each
+#define LORA_STREAM_READ_AHEAD 3
+
+/**
+ * Where the sender gets its data. read() copies len bytes from offset into
+ * buf and returns how many it copied; anything short of len ends the
+ * transfer as failed. Offsets can repeat and go backwards for
+ * retransmissions, and are never past length.
+ */
+typedef struct {
+    uint32_t (*read)(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len);
+    void    *ctx;
+    uint32_t length;
+} LoraStreamSource;
+
+typedef enum {
+    LORA_STREAM_TX_IDLE = 0,
+    LORA_STREAM_TX_ANNOUNCE,     // waiting for an answer to an announce
+    LORA_STREAM_TX_BURST,        // packets of to_send going out
+    LORA_STREAM_TX_WAIT_ACK,     // burst sent, waiting for the sequence ack
+} LoraStreamTxState;
+
+typedef enum {
+    LORA_STREAM_RX_IDLE = 0,
+    LORA_STREAM_RX_RECEIVING,
+} LoraStreamRxState;
+
+/**
+ * Goodput is bytes_delivered * 8000 / (finished_ms - started_ms) bits/s,
+ * compare with lora_airtime_phy_bps().
+ */
+typedef struct {
+    uint32_t started_ms;
+    uint32_t finished_ms;
+    uint32_t bytes_delivered;    // acknowledged by the receiver
+    uint32_t packets_sent;       // first transmissions
+    uint32_t packets_resent;     // flagged in a missing_bitmap
+    uint32_t announces;          // including retries
+    uint32_t airtime_us;         // every frame the sender put on air
+} LoraStreamStats;
+
+typedef struct {
+    LoraStreamTxState state;
+    NodeId   dest;
+    LoraStreamType type;
+    uint8_t  stream_id;
+    uint8_t  flags;              // LORA_STREAM_FLAG_*
+    LoraStreamSource source;
+    uint32_t len;
+    uint32_t crc32;              // running over first sends, final once idle
+
+    uint16_t sequence;
+    uint8_t  packets;            // in the current sequence
+    uint8_t  retries;
+    uint32_t to_send;            // bit per packet still to (re)send
+    uint32_t sent;               // bit per packet sent at least once
+    uint32_t deadline_ms;
+
+    // read ahead, direct mapped: chunk n lives in slot n % LORA_STREAM_READ_AHEAD
+    uint32_t ahead_chunk[LORA_STREAM_READ_AHEAD];  // UINT32_MAX = empty
+    uint8_t  ahead_len[LORA_STREAM_READ_AHEAD];
+    uint8_t  ahead[LORA_STREAM_READ_AHEAD][LORA_STREAM_MAX_CHUNK_SIZE];
+
+    LoraStreamStats stats;
+} LoraStreamSender;
+
+typedef struct {
+    LoraStreamRxState state;
+    NodeId   source;
+    LoraStreamType type;
+    uint8_t  stream_id;
+    uint8_t  flags;
+
+    uint16_t sequence;
+    uint8_t  packets;
+    uint32_t received;           // bit per packet of the current sequence
+    uint8_t  burst_last;         // last packet the sender's burst will carry
+    uint32_t ack_at_ms;          // 0 = no ack due
+    uint32_t last_rx_ms;
+    uint32_t length;             // end of the furthest chunk so far
+    uint32_t crc32;              // running CRC of the completed sequences
+    uint32_t packet_crc[LORA_STREAM_MAX_PACKETS_PER_SEQ]; // of each chunk of the current one, from 0
+} LoraStreamReceiver;
+
+// a received chunk, offset bytes into the stream; may come out of order.
+// Not called when the receiver has a buffer.
+typedef void (*LoraStreamChunkHandler)(LoraStream *stream,
+                                       uint32_t offset,
+                                       const uint8_t *data,
+                                       uint8_t len);
+
+// the sender says the stream is complete; crc32 0 if it did not send one.
+// ok 0 if the bytes received do not match crc32, the stream is then to be
+// thrown away; the sender is not told.
+typedef void (*LoraStreamDoneHandler)(LoraStream *stream,
+                                      uint32_t length,
+                                      uint32_t crc32,
+                                      uint8_t ok);
+
+// our transfer ended, every byte acknowledged (1) or given up (0)
+typedef void (*LoraStreamSentHandler)(LoraStream *stream, uint8_t ok);
+
+// a peer asked for a stream, answer with lora_stream_send()
+typedef void (*LoraStreamRequestedHandler)(LoraStream *stream,
+                                           NodeId peer,
+                                           LoraStreamType type);
+
+struct _LoraStream {
+    LoraEngine         *engine;
+    LoraStreamSender    tx;
+    LoraStreamReceiver  rx;
+    uint8_t             next_stream_id;
+
+    uint8_t            *rx_buffer;   // reassembly, NULL to use on_chunk
+    uint32_t            rx_capacity;
+
+    LoraStreamChunkHandler     on_chunk;
+    LoraStreamDoneHandler      on_done;
+    LoraStreamSentHandler      on_sent;
+    LoraStreamRequestedHandler on_request;
+};
+
+/**
+*   attach to engine: sets its on_stream_* handlers and engine->stream.
+*/
+void lora_stream_init(LoraStream *stream, LoraEngine *engine);
+
+/**
+*   reassemble received streams in capacity bytes taken from arena, for the
+*   lifetime of the arena. Returns 0 if the arena is too small.
+*/
+uint8_t lora_stream_rx_reserve(LoraStream *stream, LoraArena *arena, uint32_t capacity);
+
+/**
+*   the CRC-32 of the stream received, in a buffer or through on_chunk,
+*   which on_done compared with the sender's. Valid in on_done.
+*/
+static inline uint32_t lora_stream_rx_crc32(const LoraStream *stream)
+{
+    return stream->rx.crc32 ^ 0xFFFFFFFFu;
+}
+
+/**
+*   the LORA_STREAM_FLAG_* its sender announced. With LORA_STREAM_FLAG_LZSS
+*   the bytes received are one lora_lzss stream, for the application to
+*   decompress in order, eg from the buffer in on_done. Valid in on_done.
+*/
+static inline uint8_t lora_stream_rx_flags(const LoraStream *stream)
+{
+    return stream->rx.flags;
+}
+
+/**
+*   start sending source->length bytes from source to dest. The source must
+*   stay readable until on_sent. Returns 0 if a transfer is already running.
+*   flags are only announced: for LORA_STREAM_FLAG_LZSS the source already
+*   holds the compressed bytes. The stream can not compress on the way,
+*   retransmissions read chunks again at fixed offsets and the receiver
+*   gets them out of order.
+*/
+uint8_t lora_stream_send_from(LoraStream *stream,
+                              NodeId dest,
+                              LoraStreamType type,
+                              const LoraStreamSource *source,
+                              uint8_t flags);
+
+/**
+*   lora_stream_send_from() for len bytes at data, which must stay valid
+*   until on_sent.
+*/
+uint8_t lora_stream_send(LoraStream *stream,
+                         NodeId dest,
+                         LoraStreamType type,
+                         const uint8_t *data,
+                         uint32_t len,
+                         uint8_t flags);
+
+/**
+*   ask peer for a stream of type.
+*/
+uint8_t lora_stream_request(LoraStream *stream, NodeId peer, LoraStreamType type);
+
+/**
+*   timers and the next packet, called by lora_engine_poll().
+*/
+void lora_stream_poll(LoraStream *stream);
+
+/**
+*   ms until lora_stream_poll() has work, UINT32_MAX if none.
+*/
+uint32_t lora_stream_next_deadline(const LoraStream *stream);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Hierarchical timing wheel with 1 ms ticks.
+ *
+ * LORA_TIMER_LEVELS wheels of LORA_TIMER_SLOTS slots each; level n has
+ * slots of LORA_TIMER_SLOTS^n ms. A timer goes into the level its time
+ * left falls in and, when that slot comes round, drops to a lower level
+ * until level 0 fires it on its millisecond. Start and stop are O(1), a
+ * timer is moved at most once per level, and an occupancy bitmap per
+ * level finds the next slot due without walking empty ones, however long
+ * the clock jumped.
+ *
+ * Timers are owned by the caller and linked into the wheel, nothing is
+ * allocated. Times further out than the wheel spans are parked in the top
+ * level and looked at again once per rotation.
+ */
+
+#define LORA_TIMER_SLOT_BITS 5   // occupied[] is a bit per slot in a uint32_t
+#define LORA_TIMER_SLOTS     (1u << LORA_TIMER_SLOT_BITS)
+#define LORA_TIMER_LEVELS    4   // 2^20 ms, about 17 minutes
+
+typedef struct _LoraTimer LoraTimer;
+
+// runs from lora_timer_wheel_advance(); may start or stop any timer,
+// this one included
+typedef void (*LoraTimerCallback)(LoraTimer *timer, void *ctx);
+
+struct _LoraTimer {
+    LoraTimer        *next;
+    LoraTimer       **pprev;       // NULL when not started
+    uint32_t          expires_ms;
+    uint8_t           level;       // where it is linked, for stop
+    uint8_t           slot;
+    LoraTimerCallback callback;
+    void             *ctx;
+};
+
+typedef struct {
+    LoraTimer *slots[LORA_TIMER_LEVELS][LORA_TIMER_SLOTS];
+    uint32_t   occupied[LORA_TIMER_LEVELS];  // bit per non-empty slot
+    LoraTimer *expired;                      // started already due, fired next advance
+    uint32_t   now_ms;                       // time of the last advance
+} LoraTimerWheel;
+
+/**
+*   empty wheel, time starts at now_ms.
+*/
+void lora_timer_wheel_init(LoraTimerWheel *wheel, uint32_t now_ms);
+
+/**
+*   set what a timer calls, before its first start.
+*/
+void lora_timer_setup(LoraTimer *timer, LoraTimerCallback callback, void *ctx);
+
+/**
+*   fire timer at expires_ms, restarting it if it was running. A time
+*   already passed fires on the next advance. expires_ms must be less than
+*   2^31 ms ahead.
+*/
+void lora_timer_start(LoraTimerWheel *wheel, LoraTimer *timer, uint32_t expires_ms);
+
+/**
+*   stop timer, fine if it is not running.
+*/
+void lora_timer_stop(LoraTimerWheel *wheel, LoraTimer *timer);
+
+static inline uint8_t lora_timer_running(const LoraTimer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/**
+*   move the wheel to now_ms and run the callbacks of every timer due.
+*/
+void lora_timer_wheel_advance(LoraTimerWheel *wheel, uint32_t now_ms);
+
+/**
+*   ms from now_ms until the wheel has work, UINT32_MAX if empty. Timers in
+*   the upper levels count from when they drop a level, which is never
+*   after they expire.
+*/
+uint32_t lora_timer_wheel_next_deadline(const LoraTimerWheel *wheel, uint32_t now_ms);
@@ -7,6 +7,8 @@
 
 
 #include "LoRa.h"
+#include "lora_profile.h"
+#include "lora_spi_trace.h"
 
 
 uint8_t SetupLoraWithPins(LoRa * lora,
@@ -153,6 +155,7 @@ void LoRa_reset(LoRa* _LoRa){
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_gotoMode(LoRa* _LoRa, int mode){
+	LORA_SPI_TRACE_OP_BEGIN(GOTO_MODE);
 	uint8_t    read;
 	uint8_t    data;
 
@@ -178,6 +181,7 @@ void LoRa_gotoMode(LoRa* _LoRa, int mode){
 
 	LoRa_write(_LoRa, RegOpMode, data);
 	//HAL_Delay(10);
+	LORA_SPI_TRACE_OP_END();
 }
 
 
@@ -197,6 +201,8 @@ void LoRa_gotoMode(LoRa* _LoRa, int mode){
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_readReg(LoRa* _LoRa, uint8_t* address, uint16_t r_length, uint8_t* output, uint16_t w_length){
+	LORA_PROFILE_START(t);
+	LORA_SPI_TRACE_START(tr);
 	HAL_GPIO_WritePin(_LoRa->CS_port, _LoRa->CS_pin, GPIO_PIN_RESET);
 	HAL_SPI_Transmit(_LoRa->hSPIx, address, r_length, TRANSMIT_TIMEOUT);
 	while (HAL_SPI_GetState(_LoRa->hSPIx) != HAL_SPI_STATE_READY)
@@ -205,6 +211,8 @@ void LoRa_readReg(LoRa* _LoRa, uint8_t* address, uint16_t r_length, uint8_t* out
 	while (HAL_SPI_GetState(_LoRa->hSPIx) != HAL_SPI_STATE_READY)
 		;
 	HAL_GPIO_WritePin(_LoRa->CS_port, _LoRa->CS_pin, GPIO_PIN_SET);
+	LORA_SPI_TRACE_RECORD(address[0], 0, w_length, output[0], tr);
+	LORA_PROFILE_STOP(t, LORA_PROFILE_SPI_READ);
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -223,6 +231,8 @@ void LoRa_readReg(LoRa* _LoRa, uint8_t* address, uint16_t r_length, uint8_t* out
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_writeReg(LoRa* _LoRa, uint8_t* address, uint16_t r_length, uint8_t* values, uint16_t w_length){
+	LORA_PROFILE_START(t);
+	LORA_SPI_TRACE_START(tr);
 	HAL_GPIO_WritePin(_LoRa->CS_port, _LoRa->CS_pin, GPIO_PIN_RESET);
 	HAL_SPI_Transmit(_LoRa->hSPIx, address, r_length, TRANSMIT_TIMEOUT);
 	while (HAL_SPI_GetState(_LoRa->hSPIx) != HAL_SPI_STATE_READY)
@@ -231,6 +241,8 @@ void LoRa_writeReg(LoRa* _LoRa, uint8_t* address, uint16_t r_length, uint8_t* va
 	while (HAL_SPI_GetState(_LoRa->hSPIx) != HAL_SPI_STATE_READY)
 		;
 	HAL_GPIO_WritePin(_LoRa->CS_port, _LoRa->CS_pin, GPIO_PIN_SET);
+	LORA_SPI_TRACE_RECORD(address[0], LORA_SPI_TRACE_WRITE, w_length, values[0], tr);
+	LORA_PROFILE_STOP(t, LORA_PROFILE_SPI_WRITE);
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -245,6 +257,7 @@ void LoRa_writeReg(LoRa* _LoRa, uint8_t* address, uint16_t r_length, uint8_t* va
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_setLowDataRateOptimization(LoRa* _LoRa, uint8_t value){
+	LORA_SPI_TRACE_OP_BEGIN(SET_LDO);
 	uint8_t	data;
 	uint8_t	read;
 
@@ -257,6 +270,7 @@ void LoRa_setLowDataRateOptimization(LoRa* _LoRa, uint8_t value){
 
 	LoRa_write(_LoRa, RegModemConfig3, data);
 	HAL_Delay(10);
+	LORA_SPI_TRACE_OP_END();
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -287,6 +301,7 @@ void LoRa_setAutoLDO(LoRa* _LoRa){
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_setFrequency(LoRa* _LoRa, int freq){
+	LORA_SPI_TRACE_OP_BEGIN(SET_FREQUENCY);
 	uint8_t  data;
 	uint32_t F;
 	F = (freq * 524288)>>5;
@@ -305,6 +320,7 @@ void LoRa_setFrequency(LoRa* _LoRa, int freq){
 	data = F >> 0;
 	LoRa_write(_LoRa, RegFrLsb, data);
 	HAL_Delay(5);
+	LORA_SPI_TRACE_OP_END();
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -319,6 +335,7 @@ void LoRa_setFrequency(LoRa* _LoRa, int freq){
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_setSpreadingFactor(LoRa* _LoRa, int SF){
+	LORA_SPI_TRACE_OP_BEGIN(SET_SPREADING_FACTOR);
 	uint8_t	data;
 	uint8_t	read;
 
@@ -335,6 +352,7 @@ void LoRa_setSpreadingFactor(LoRa* _LoRa, int SF){
 	HAL_Delay(10);
 
 	LoRa_setAutoLDO(_LoRa);
+	LORA_SPI_TRACE_OP_END();
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -349,6 +367,7 @@ void LoRa_setSpreadingFactor(LoRa* _LoRa, int SF){
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_setPower(LoRa* _LoRa, uint8_t power){
+	LORA_SPI_TRACE_OP_BEGIN(SET_POWER);
 	LoRa_write(_LoRa, RegPaConfig, power);
 	HAL_Delay(10);
 
@@ -360,6 +379,7 @@ void LoRa_setPower(LoRa* _LoRa, uint8_t power){
 		LoRa_write(_LoRa, RegPaDac, 0x84); // RegPaDac
 	}
 	HAL_Delay(10);
+	LORA_SPI_TRACE_OP_END();
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -374,6 +394,7 @@ void LoRa_setPower(LoRa* _LoRa, uint8_t power){
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_setOCP(LoRa* _LoRa, uint8_t current){
+	LORA_SPI_TRACE_OP_BEGIN(SET_OCP);
 	uint8_t	OcpTrim = 0;
 
 	if(current<45)
@@ -389,6 +410,7 @@ void LoRa_setOCP(LoRa* _LoRa, uint8_t current){
 	OcpTrim = OcpTrim + (1 << 5);
 	LoRa_write(_LoRa, RegOcp, OcpTrim);
 	HAL_Delay(10);
+	LORA_SPI_TRACE_OP_END();
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -402,6 +424,7 @@ void LoRa_setOCP(LoRa* _LoRa, uint8_t current){
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_setTOMsb_setCRCon(LoRa* _LoRa){
+	LORA_SPI_TRACE_OP_BEGIN(SET_CRC);
 	uint8_t read, data;
 
 	read = LoRa_read(_LoRa, RegModemConfig2);
@@ -409,6 +432,7 @@ void LoRa_setTOMsb_setCRCon(LoRa* _LoRa){
 	data = read | 0x07;
 	LoRa_write(_LoRa, RegModemConfig2, data);\
 	HAL_Delay(10);
+	LORA_SPI_TRACE_OP_END();
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -422,8 +446,10 @@ void LoRa_setTOMsb_setCRCon(LoRa* _LoRa){
 		returns     : Nothing
 \* ----------------------------------------------------------------------------- */
 void LoRa_setSyncWord(LoRa* _LoRa, uint8_t syncword){
+	LORA_SPI_TRACE_OP_BEGIN(SET_SYNC_WORD);
 	LoRa_write(_LoRa, RegSyncWord, syncword);
 	HAL_Delay(10);
+	LORA_SPI_TRACE_OP_END();
 }
 
 /* ----------------------------------------------------------------------------- *\
@@ -486,6 +512,8 @@ void LoRa_BurstWrite(LoRa* _LoRa, uint8_t address, uint8_t *value, uint8_t lengt
 	uint8_t addr;
 	addr = address | 0x80;
 
+	LORA_PROFILE_START(t);
+	LORA_SPI_TRACE_START(tr);
 	//NSS = 1
 	HAL_GPIO_WritePin(_LoRa->CS_port, _LoRa->CS_pin, GPIO_PIN_RESET);
 
@@ -499,6 +527,8 @@ void LoRa_BurstWrite(LoRa* _LoRa, uint8_t address, uint8_t *value, uint8_t lengt
 	//NSS = 0
 	//HAL_Delay(5);
 	HAL_GPIO_WritePin(_LoRa->CS_port, _LoRa->CS_pin, GPIO_PIN_SET);
+	LORA_SPI_TRACE_RECORD(address, LORA_SPI_TRACE_WRITE | LORA_SPI_TRACE_BURST, length, value[0], tr);
+	LORA_PROFILE_STOP(t, LORA_PROFILE_SPI_BURST_WRITE);
 }
 /* ----------------------------------------------------------------------------- *\
 		name        : LoRa_isvalid
@@ -516,26 +546,16 @@ uint8_t LoRa_isvalid(LoRa* _LoRa){
 }
 
 /* ----------------------------------------------------------------------------- *\
-		name        : LoRa_transmit
+		name        : LoRa_waitTxDone
 
-		description : Transmit data
+		description : Key the transmitter for the frame in the FIFO and poll for
+					  TX_DONE, then go back to mode
 
-		arguments   :
-			LoRa*    LoRa     --> LoRa object handler
-			uint8_t  data			--> A pointer to the data you wanna send
-			uint8_t	 length   --> Size of your data in Bytes
-			uint16_t timeOut	--> Timeout in milliseconds
 		returns     : 1 in case of success, 0 in case of timeout
 \* ----------------------------------------------------------------------------- */
-uint8_t LoRa_transmit(LoRa* _LoRa, uint8_t* data, uint8_t length, uint16_t timeout){
+static uint8_t LoRa_waitTxDone(LoRa* _LoRa, int mode, uint16_t timeout){
 	uint8_t read;
 
-	int mode = _LoRa->current_mode;
-	LoRa_gotoMode(_LoRa, STNBY_MODE);
-	read = LoRa_read(_LoRa, RegFiFoTxBaseAddr);
-	LoRa_write(_LoRa, RegFiFoAddPtr, read);
-	LoRa_write(_LoRa, RegPayloadLength, length);
-	LoRa_BurstWrite(_LoRa, RegFiFo, data, length);
 	LoRa_gotoMode(_LoRa, TRANSMIT_MODE);
 	while(1){
 		read = LoRa_read(_LoRa, RegIrqFlags);
@@ -554,6 +574,113 @@ uint8_t LoRa_transmit(LoRa* _LoRa, uint8_t* data, uint8_t length, uint16_t timeo
 	}
 }
 
+/* ----------------------------------------------------------------------------- *\
+		name        : LoRa_transmit
+
+		description : Transmit data
+
+		arguments   :
+			LoRa*    LoRa     --> LoRa object handler
+			uint8_t  data			--> A pointer to the data you wanna send
+			uint8_t	 length   --> Size of your data in Bytes
+			uint16_t timeOut	--> Timeout in milliseconds
+		returns     : 1 in case of success, 0 in case of timeout
+\* ----------------------------------------------------------------------------- */
+uint8_t LoRa_transmit(LoRa* _LoRa, uint8_t* data, uint8_t length, uint16_t timeout){
+	uint8_t read;
+
+	LORA_SPI_TRACE_OP_BEGIN(TRANSMIT);
+	int mode = _LoRa->current_mode;
+	LoRa_gotoMode(_LoRa, STNBY_MODE);
+	read = LoRa_read(_LoRa, RegFiFoTxBaseAddr);
+	LoRa_write(_LoRa, RegFiFoAddPtr, read);
+	LoRa_write(_LoRa, RegPayloadLength, length);
+	LoRa_BurstWrite(_LoRa, RegFiFo, data, length);
+	uint8_t status = LoRa_waitTxDone(_LoRa, mode, timeout);
+	LORA_SPI_TRACE_OP_END();
+	return status;
+}
+
+/* ----------------------------------------------------------------------------- *\
+		name        : LoRa_transmit_begin
+
+		description : Start a streamed transmit. Opens a burst write into the
+					  FIFO that LoRa_transmit_write() appends to, so a frame can
+					  be written piece by piece without assembling it first.
+					  Must be followed by LoRa_transmit_end().
+
+		arguments   :
+			LoRa*    LoRa     --> LoRa object handler
+
+		returns     : Nothing
+\* ----------------------------------------------------------------------------- */
+void LoRa_transmit_begin(LoRa* _LoRa){
+	uint8_t read;
+	uint8_t addr = RegFiFo | 0x80;
+
+	LORA_SPI_TRACE_OP_BEGIN(TRANSMIT);
+	_LoRa->tx_prev_mode = _LoRa->current_mode;
+	LoRa_gotoMode(_LoRa, STNBY_MODE);
+	read = LoRa_read(_LoRa, RegFiFoTxBaseAddr);
+	LoRa_write(_LoRa, RegFiFoAddPtr, read);
+
+	HAL_GPIO_WritePin(_LoRa->CS_port, _LoRa->CS_pin, GPIO_PIN_RESET);
+	HAL_SPI_Transmit(_LoRa->hSPIx, &addr, 1, TRANSMIT_TIMEOUT);
+	while (HAL_SPI_GetState(_LoRa->hSPIx) != HAL_SPI_STATE_READY)
+		;
+	LORA_SPI_TRACE_OP_END();
+}
+
+/* ----------------------------------------------------------------------------- *\
+		name        : LoRa_transmit_write
+
+		description : Append bytes to the FIFO burst opened by LoRa_transmit_begin()
+
+		arguments   :
+			LoRa*    LoRa     --> LoRa object handler
+			uint8_t  data			--> bytes to append
+			uint8_t	 length   --> number of bytes
+
+		returns     : Nothing
+\* ----------------------------------------------------------------------------- */
+void LoRa_transmit_write(LoRa* _LoRa, const uint8_t* data, uint8_t length){
+	LORA_PROFILE_START(t);
+	LORA_SPI_TRACE_START(tr);
+	HAL_SPI_Transmit(_LoRa->hSPIx, (uint8_t *)data, length, TRANSMIT_TIMEOUT);
+	while (HAL_SPI_GetState(_LoRa->hSPIx) != HAL_SPI_STATE_READY)
+		;
+	LORA_SPI_TRACE_RECORD(RegFiFo, LORA_SPI_TRACE_WRITE | LORA_SPI_TRACE_BURST, length, data[0], tr);
+	LORA_PROFILE_STOP(t, LORA_PROFILE_SPI_BURST_WRITE);
+}
+
+/* ----------------------------------------------------------------------------- *\
+		name        : LoRa_transmit_end
+
+		description : Close the FIFO burst and transmit the streamed frame.
+					  A length of 0 aborts: nothing is sent and the previous
+					  mode is restored.
+
+		arguments   :
+			LoRa*    LoRa     --> LoRa object handler
+			uint8_t	 length   --> total bytes written since LoRa_transmit_begin()
+			uint16_t timeOut	--> Timeout in milliseconds
+		returns     : 1 in case of success, 0 in case of timeout or abort
+\* ----------------------------------------------------------------------------- */
+uint8_t LoRa_transmit_end(LoRa* _LoRa, uint8_t length, uint16_t timeout){
+	HAL_GPIO_WritePin(_LoRa->CS_port, _LoRa->CS_pin, GPIO_PIN_SET);
+
+	if(length == 0){
+		LoRa_gotoMode(_LoRa, _LoRa->tx_prev_mode);
+		return 0;
+	}
+
+	LORA_SPI_TRACE_OP_BEGIN(TRANSMIT);
+	LoRa_write(_LoRa, RegPayloadLength, length);
+	uint8_t status = LoRa_waitTxDone(_LoRa, _LoRa->tx_prev_mode, timeout);
+	LORA_SPI_TRACE_OP_END();
+	return status;
+}
+
 /* ----------------------------------------------------------------------------- *\
 		name        : LoRa_startReceiving
 
@@ -585,6 +712,8 @@ uint8_t LoRa_receive(LoRa* _LoRa, uint8_t* data, uint8_t length){
 	uint8_t number_of_bytes;
 	uint8_t min = 0;
 
+	LORA_PROFILE_START(t);
+	LORA_SPI_TRACE_OP_BEGIN(RECEIVE);
 	for(int i=0; i<length; i++)
 		data[i]=0;
 
@@ -600,6 +729,8 @@ uint8_t LoRa_receive(LoRa* _LoRa, uint8_t* data, uint8_t length){
 			data[i] = LoRa_read(_LoRa, RegFiFo);
 	}
 	LoRa_gotoMode(_LoRa, RXCONTIN_MODE);
+	LORA_SPI_TRACE_OP_END();
+	LORA_PROFILE_STOP(t, LORA_PROFILE_RECEIVE);
     return min;
 }
 
@@ -629,10 +760,39 @@ void LoRa_spi_enable(LoRa* _LoRa) {
 \* ----------------------------------------------------------------------------- */
 int LoRa_getRSSI(LoRa* _LoRa){
 	uint8_t read;
+	LORA_SPI_TRACE_OP_BEGIN(GET_RSSI);
 	read = LoRa_read(_LoRa, RegPktRssiValue);
+	LORA_SPI_TRACE_OP_END();
 	return -164 + read;
 }
 
+/* ----------------------------------------------------------------------------- *\
+		name        : LoRa_random
+
+		description : collect random bits from the wideband RSSI, whose LSB is
+		              receiver noise while the radio listens
+
+		arguments   :
+			LoRa* LoRa        --> LoRa object handler
+
+		returns     : 32 random bits, different on every boot. The radio is
+		              back in its previous mode afterwards.
+\* ----------------------------------------------------------------------------- */
+uint32_t LoRa_random(LoRa* _LoRa){
+	uint32_t bits = 0;
+	int mode = _LoRa->current_mode;
+
+	LORA_SPI_TRACE_OP_BEGIN(RANDOM);
+	LoRa_gotoMode(_LoRa, RXCONTIN_MODE);
+	// 64 samples folded into 32 bits, the xor of two evens out a biased LSB
+	for(int i = 0; i < 64; i++){
+		bits = (bits << 1 | bits >> 31) ^ (LoRa_read(_LoRa, RegRssiWideband) & 0x01);
+	}
+	LoRa_gotoMode(_LoRa, mode);
+	LORA_SPI_TRACE_OP_END();
+	return bits;
+}
+
 /* ----------------------------------------------------------------------------- *\
 		name        : LoRa_init
 
@@ -648,6 +808,7 @@ uint16_t LoRa_init(LoRa* _LoRa){
 	uint8_t    read;
 
 	if(LoRa_isvalid(_LoRa)){
+			LORA_SPI_TRACE_OP_BEGIN(INIT);
 			LoRa_spi_enable(_LoRa);
 			HAL_Delay(10);
 		// goto sleep mode:
@@ -703,6 +864,7 @@ uint16_t LoRa_init(LoRa* _LoRa){
 			HAL_Delay(10);
 
 			read = LoRa_read(_LoRa, RegVersion);
+			LORA_SPI_TRACE_OP_END();
 			if(read == 0x12 )
 				return LORA_OK;
 			else
@@ -715,10 +877,12 @@ uint16_t LoRa_init(LoRa* _LoRa){
 
 uint8_t LoRa_single_transmit(LoRa* _LoRa, uint8_t* data, uint8_t length, uint16_t timeout)
 {
+	LORA_SPI_TRACE_OP_BEGIN(TRANSMIT);
 	LoRa_gotoMode(_LoRa, TRANSMIT_MODE);
 	HAL_Delay(10);
 	uint8_t status = LoRa_transmit(_LoRa, data, length, timeout);
 	HAL_Delay(10);
 	LoRa_startReceiving(_LoRa);
+	LORA_SPI_TRACE_OP_END();
 	return status;
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "lora_airtime.h"
+#include <string.h>
+
+#define LORA_AIRTIME_DEFAULT_WINDOW_MS 3600000UL
+
+uint32_t lora_airtime_us(const LoraPhyParams *phy, uint8_t payload_len)
+{
+    if (!phy || phy->bandwidth_hz == 0 ||
+        phy->spreading_factor < 6 || phy->spreading_factor > 12) {
+        return 0;
+    }
+
+    int32_t sf = phy->spreading_factor;
+    int32_t cr = phy->coding_rate;
+
+    // low data rate optimize is on when a symbol lasts more than 16 ms,
+    // same rule as LoRa_setAutoLDO() uses to program the radio
+    int32_t de = (((uint32_t)1 << sf) * 1000UL / phy->bandwidth_hz) > 16;
+
+    int32_t num = 8 * (int32_t)payload_len - 4 * sf + 28
+                + 16 * (phy->crc_on ? 1 : 0)
+                - 20 * (phy->implicit_header ? 1 : 0);
+    int32_t den = 4 * (sf - 2 * de);
+    int32_t blocks = num > 0 ? (num + den - 1) / den : 0;
+
+    uint32_t payload_symbols = 8 + (uint32_t)(blocks * (cr + 4));
+
+    // count in quarter symbols so the 4.25 symbol preamble tail stays exact
+    uint64_t quarter_symbols = 4ULL * phy->preamble + 17 + 4ULL * payload_symbols;
+
+    return (uint32_t)(((quarter_symbols << sf) * 1000000ULL)
+                      / (4ULL * phy->bandwidth_hz));
+}
+
+uint32_t lora_airtime_phy_bps(const LoraPhyParams *phy)
+{
+    if (!phy || phy->spreading_factor < 6 || phy->spreading_factor > 12) {
+        return 0;
+    }
+
+    return (uint32_t)(((uint64_t)phy->spreading_factor * phy->bandwidth_hz * 4)
+                      / (((uint64_t)1 << phy->spreading_factor) * (4 + phy->coding_rate)));
+}
+
+void lora_airtime_init(LoraAirtimeLedger *ledger,
+                       const LoraDutyCycleConfig *cfg,
+                       uint32_t now_ms)
+{
+    memset(ledger, 0, sizeof(*ledger));
+
+    if (cfg) {
+        ledger->config = *cfg;
+    }
+    if (ledger->config.window_ms == 0) {
+        ledger->config.window_ms = LORA_AIRTIME_DEFAULT_WINDOW_MS;
+    }
+
+    ledger->bucket_ms = ledger->config.window_ms / LORA_AIRTIME_WINDOW_BUCKETS;
+    if (ledger->bucket_ms == 0) {
+        ledger->bucket_ms = 1;
+    }
+    ledger->budget_us = ledger->config.window_ms * ledger->config.budget_permille;
+    ledger->head_start_ms = now_ms;
+}
+
+// Retire buckets that slid out of the window. At most one pass over the
+// buckets no matter how long we were idle, so this stays constant time.
+static void advance(LoraAirtimeLedger *ledger, uint32_t now_ms)
+{
+    uint32_t elapsed = now_ms - ledger->head_start_ms;
+    if (elapsed < ledger->bucket_ms) {
+        return;
+    }
+
+    uint32_t steps = elapsed / ledger->bucket_ms;
+    if (steps >= LORA_AIRTIME_WINDOW_BUCKETS) {
+        memset(ledger->buckets, 0, sizeof(ledger->buckets));
+        ledger->window_us = 0;
+        ledger->head_start_ms += steps * ledger->bucket_ms;
+        return;
+    }
+
+    while (steps--) {
+        ledger->head = (uint8_t)((ledger->head + 1) % LORA_AIRTIME_WINDOW_BUCKETS);
+        ledger->window_us -= ledger->buckets[ledger->head];
+        ledger->buckets[ledger->head] = 0;
+        ledger->head_start_ms += ledger->bucket_ms;
+    }
+}
+
+static void add_total(LoraAirtimeTotal *total, uint32_t airtime_us)
+{
+    total->frames++;
+    total->airtime_us += airtime_us;
+}
+
+static LoraAirtimeTotal *dest_total(LoraAirtimeLedger *ledger, NodeId dest)
+{
+    for (uint8_t i = 0; i < ledger->dest_count; i++) {
+        if (ledger->by_dest[i].dest == dest) {
+            return &ledger->by_dest[i].total;
+        }
+    }
+
+    if (ledger->dest_count < LORA_AIRTIME_MAX_DESTS) {
+        LoraAirtimeDestTotal *d = &ledger->by_dest[ledger->dest_count++];
+        d->dest = dest;
+        return &d->total;
+    }
+
+    return &ledger->other_dest;
+}
+
+void lora_airtime_record(LoraAirtimeLedger *ledger,
+                         uint32_t now_ms,
+                         uint8_t message_type,
+                         NodeId dest,
+                         uint32_t airtime_us)
+{
+    advance(ledger, now_ms);
+
+    ledger->buckets[ledger->head] += airtime_us;
+    ledger->window_us += airtime_us;
+
+    if (message_type < LORA_AIRTIME_MAX_MESSAGE_TYPES) {
+        add_total(&ledger->by_type[message_type], airtime_us);
+    }
+    add_total(dest_total(ledger, dest), airtime_us);
+}
+
+uint32_t lora_airtime_window_us(LoraAirtimeLedger *ledger, uint32_t now_ms)
+{
+    advance(ledger, now_ms);
+    return ledger->window_us;
+}
+
+uint8_t lora_airtime_admit(LoraAirtimeLedger *ledger,
+                           uint32_t now_ms,
+                           uint32_t airtime_us)
+{
+    if (ledger->budget_us == 0) {
+        return 1;
+    }
+
+    advance(ledger, now_ms);
+    return (uint64_t)ledger->window_us + airtime_us <= ledger->budget_us;
+}
+
+uint32_t lora_airtime_wait_ms(LoraAirtimeLedger *ledger,
+                              uint32_t now_ms,
+                              uint32_t airtime_us)
+{
+    if (lora_airtime_admit(ledger, now_ms, airtime_us)) {
+        return 0;
+    }
+    if (airtime_us > ledger->budget_us) {
+        return UINT32_MAX;
+    }
+
+    uint32_t need = ledger->window_us + airtime_us - ledger->budget_us;
+    uint32_t freed = 0;
+
+    // walk from the oldest bucket, bucket k retires k bucket lengths after head_start
+    for (uint32_t k = 1; k <= LORA_AIRTIME_WINDOW_BUCKETS; k++) {
+        freed += ledger->buckets[(ledger->head + k) % LORA_AIRTIME_WINDOW_BUCKETS];
+        if (freed >= need) {
+            return ledger->head_start_ms + k * ledger->bucket_ms - now_ms;
+        }
+    }
+
+    return ledger->config.window_ms;
+}
@@ -0,0 +1,19 @@
+#include "lora_arena.h"
+
+void lora_arena_init(LoraArena *arena, void *mem, size_t size)
+{
+    arena->base = (uint8_t *)mem;
+    arena->size = size;
+    arena->used = 0;
+}
+
+void *lora_arena_alloc(LoraArena *arena, size_t len)
+{
+    size_t start = (arena->used + 3) & ~(size_t)3;
+    if (start > arena->size || len > arena->size - start) {
+        return NULL;
+    }
+
+    arena->used = start + len;
+    return &arena->base[start];
+}
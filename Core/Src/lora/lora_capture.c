@@ -0,0 +1,76 @@
+#include "lora_capture.h"
+
+#if LORA_CAPTURE_ENABLED
+
+#include <stdio.h>
+#include <string.h>
+
+static uint8_t log_buf[LORA_CAPTURE_BYTES];
+static size_t  log_len;
+static uint32_t dropped;
+
+void lora_capture_reset(NodeId node_id)
+{
+    memcpy(log_buf, LORA_CAPTURE_MAGIC, 4);
+    log_buf[4] = LORA_CAPTURE_VERSION;
+    log_buf[5] = node_id;
+    log_buf[6] = 0;
+    log_buf[7] = 0;
+
+    log_len = LORA_CAPTURE_HEADER_SIZE;
+    dropped = 0;
+}
+
+uint8_t lora_capture_frame(uint32_t time_ms, int16_t rssi,
+                           const uint8_t *frame, uint8_t len)
+{
+    if (log_len == 0) {
+        lora_capture_reset(LORA_NODE_BROADCAST_ID);
+    }
+
+    if (log_len + LORA_CAPTURE_RECORD_SIZE + len > sizeof(log_buf)) {
+        dropped++;
+        return 0;
+    }
+
+    uint8_t *p = &log_buf[log_len];
+    p[0] = (uint8_t)(time_ms);
+    p[1] = (uint8_t)(time_ms >> 8);
+    p[2] = (uint8_t)(time_ms >> 16);
+    p[3] = (uint8_t)(time_ms >> 24);
+    p[4] = (uint8_t)((uint16_t)rssi);
+    p[5] = (uint8_t)((uint16_t)rssi >> 8);
+    p[6] = len;
+    memcpy(&p[LORA_CAPTURE_RECORD_SIZE], frame, len);
+
+    log_len += LORA_CAPTURE_RECORD_SIZE + len;
+    return 1;
+}
+
+const uint8_t *lora_capture_log(size_t *len)
+{
+    *len = log_len;
+    return log_buf;
+}
+
+uint32_t lora_capture_dropped(void)
+{
+    return dropped;
+}
+
+void lora_capture_dump(void (*print)(const char *line))
+{
+    // 32 log bytes per line
+    char line[5 + 2 * 32 + 1];
+
+    for (size_t pos = 0; pos < log_len; pos += 32) {
+        size_t n = log_len - pos < 32 ? log_len - pos : 32;
+        memcpy(line, "LCAP ", 5);
+        for (size_t i = 0; i < n; i++) {
+            snprintf(&line[5 + 2 * i], 3, "%02x", log_buf[pos + i]);
+        }
+        print(line);
+    }
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include "lora_climate_batch.h"
+#include "lora_codec.h"
+
+// worst case wire bytes of one more reading, two 3 byte varints
+#define NEXT_SAMPLE_MAX_BYTES 6
+
+static uint8_t batch_full(const LoraClimateBatch *batch)
+{
+    const ClimateSeries *series = &batch->series;
+
+    return series->sample_count >= batch->max_samples ||
+           lora_climate_series_sample_bytes(series) + NEXT_SAMPLE_MAX_BYTES >
+               LORA_CLIMATE_SERIES_MAX_SAMPLE_BYTES;
+}
+
+void lora_climate_batch_init(LoraClimateBatch *batch,
+                             uint16_t interval_s,
+                             uint8_t max_samples,
+                             uint32_t max_age_ms)
+{
+    if (!batch) {
+        return;
+    }
+
+    if (max_samples == 0 || max_samples > LORA_CLIMATE_SERIES_MAX_SAMPLES) {
+        max_samples = LORA_CLIMATE_SERIES_MAX_SAMPLES;
+    }
+
+    batch->series.interval_s   = interval_s;
+    batch->series.sample_count = 0;
+    batch->first_ms    = 0;
+    batch->max_samples = max_samples;
+    batch->max_age_ms  = max_age_ms;
+}
+
+uint8_t lora_climate_batch_add(LoraClimateBatch *batch,
+                               const ClimateData *sample,
+                               uint32_t now_ms)
+{
+    if (!batch || !sample) {
+        return 0;
+    }
+
+    ClimateSeries *series = &batch->series;
+    if (series->sample_count && batch_full(batch)) {
+        return 0;
+    }
+
+    if (series->sample_count == 0) {
+        batch->first_ms = now_ms;
+    }
+    series->samples[series->sample_count++] = *sample;
+    return 1;
+}
+
+uint8_t lora_climate_batch_due(const LoraClimateBatch *batch, uint32_t now_ms)
+{
+    if (!batch || batch->series.sample_count == 0) {
+        return 0;
+    }
+
+    if (batch_full(batch)) {
+        return 1;
+    }
+    return batch->max_age_ms && (uint32_t)(now_ms - batch->first_ms) >= batch->max_age_ms;
+}
+
+uint8_t lora_climate_batch_flush(LoraClimateBatch *batch,
+                                 LoraEngine *engine,
+                                 NodeId dest,
+                                 uint16_t timeout)
+{
+    if (!batch || !engine) {
+        return 0;
+    }
+    if (batch->series.sample_count == 0) {
+        return 1;
+    }
+
+    LoraMessage msg = {0};
+    msg.message_type = LORA_DATA;
+    msg.metadata.dest = dest;
+    msg.payload.data.data_type = LORA_DATA_TYPE_CLIMATE_SERIES;
+    msg.payload.data.payload.climate_series = batch->series;
+
+    if (!lora_engine_send(engine, &msg, timeout)) {
+        return 0;
+    }
+
+    batch->series.sample_count = 0;
+    return 1;
+}
@@ -1,4 +1,5 @@
 #include "lora_codec.h"
+#include "lora_profile.h"
 #include <string.h> // memcpy
 #include <stdbool.h>
 
@@ -31,341 +32,829 @@ static uint32_t read_u32_le(const uint8_t *src)
         | ((uint32_t)src[3] << 24));
 }
 
-size_t lora_encode(const LoraMessage *msg, uint8_t *buf, size_t buf_len)
-{
-    if (!msg || !buf || buf_len < 3) {
-        return 0;
-    }
+#define PAYLOAD_INVALID ((size_t)-1)
 
-    size_t pos = 0;
+/*
+ * CUSTOM climate_series: samples[0] as two u16, then per sample the zig-zag
+ * varint of the temperature delta and of the humidity delta. A reading that
+ * moves by a few tenths per interval costs 2 bytes instead of 4.
+ */
+#define SERIES_VARINT_MAX 3 // zig-zag of a 17 bit delta
 
-    // Common header: message_type + metadata
-    // FIRST 3 BYTES OF PACKET
-    buf[pos++] = (uint8_t)msg->message_type;
-    buf[pos++] = msg->metadata.source;
-    buf[pos++] = msg->metadata.dest;
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
 
-    // Encode payload depending on message_type
-    switch (msg->message_type) {
-        case LORA_RAW:
-            // Raw: copy fixed LORA_STREAM_MAX_CHUNK_SIZE bytes
-            if (buf_len < pos + LORA_STREAM_MAX_CHUNK_SIZE) {
-                return 0;
-            }
-            memcpy(&buf[pos], msg->payload.raw, LORA_STREAM_MAX_CHUNK_SIZE);
-            pos += LORA_STREAM_MAX_CHUNK_SIZE;
-            break;
+static inline size_t varint_size(uint32_t v)
+{
+    return v < 0x80 ? 1 : v < 0x4000 ? 2 : 3;
+}
 
-        case LORA_PING_REQUEST:
-            // No payload; we ignore _reserved and just send header
-            break;
+static size_t write_varint(uint8_t *dst, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        dst[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    dst[n++] = (uint8_t)v;
+    return n;
+}
 
-        case LORA_PING_RESPONSE:
-            // No payload; ignore _reserved
-            break;
+// adds the delta to *value, 0 if the varint is cut short, too long or overflows
+static size_t read_varint_delta(const uint8_t *src, size_t len, int16_t *value)
+{
+    uint32_t v = 0;
 
-        case LORA_DATA_REQUEST: {
-            if (buf_len < pos + 1) {
+    for (size_t n = 0; n < len && n < SERIES_VARINT_MAX; n++) {
+        v |= (uint32_t)(src[n] & 0x7F) << (7 * n);
+        if (!(src[n] & 0x80)) {
+            int32_t next = *value + ((int32_t)(v >> 1) ^ -(int32_t)(v & 1));
+            if (next < INT16_MIN || next > INT16_MAX) {
                 return 0;
             }
-            buf[pos++] = (uint8_t)msg->payload.data_req.data_type;
-            break;
+            *value = (int16_t)next;
+            return n + 1;
         }
+    }
+    return 0;
+}
 
-        case LORA_DATA: {
-            if (buf_len < pos + 1) {
-                return 0;
-            }
-            const LoraData *d = &msg->payload.data;
-            buf[pos++] = (uint8_t)d->data_type;
+size_t lora_climate_series_sample_bytes(const ClimateSeries *series)
+{
+    if (!series || series->sample_count == 0 ||
+        series->sample_count > LORA_CLIMATE_SERIES_MAX_SAMPLES) {
+        return 0;
+    }
 
-            switch (d->data_type) {
-        case LORA_DATA_TYPE_CLIMATE: {
-            if (buf_len < pos + 4) {
-                return 0;
-            }
-            write_u16_le(&buf[pos],
-                        (uint16_t)d->payload.climate_data.temperature_tenths);
-            pos += 2;
-            write_u16_le(&buf[pos],
-                        (uint16_t)d->payload.climate_data.humidity_tenths);
-            pos += 2;
-            break;
+    const ClimateData *s = series->samples;
+    size_t n = 4;
+    for (uint8_t i = 1; i < series->sample_count; i++) {
+        n += varint_size(zigzag(s[i].temperature_tenths - s[i - 1].temperature_tenths));
+        n += varint_size(zigzag(s[i].humidity_tenths - s[i - 1].humidity_tenths));
+    }
+    return n;
+}
+
+static size_t climate_series_size(const ClimateSeries *p)
+{
+    size_t n = lora_climate_series_sample_bytes(p);
+    return n == 0 || n > LORA_CLIMATE_SERIES_MAX_SAMPLE_BYTES ? PAYLOAD_INVALID : n;
+}
+
+static size_t climate_series_encode(const ClimateSeries *p, uint8_t *buf)
+{
+    const ClimateData *s = p->samples;
+
+    write_u16_le(&buf[0], (uint16_t)s[0].temperature_tenths);
+    write_u16_le(&buf[2], (uint16_t)s[0].humidity_tenths);
+
+    size_t pos = 4;
+    for (uint8_t i = 1; i < p->sample_count; i++) {
+        pos += write_varint(&buf[pos], zigzag(s[i].temperature_tenths - s[i - 1].temperature_tenths));
+        pos += write_varint(&buf[pos], zigzag(s[i].humidity_tenths - s[i - 1].humidity_tenths));
+    }
+    return pos;
+}
+
+// walks count samples of a whole CLIMATE_SERIES payload, out may be NULL
+static uint8_t climate_series_walk(const uint8_t *buf, size_t len, ClimateData *out)
+{
+    uint8_t count = buf[LORA_WIRE_OFFSET(CLIMATE_SERIES, sample_count)];
+    size_t pos = LORA_WIRE_OFFSET(CLIMATE_SERIES, samples);
+
+    if (count == 0 || count > LORA_CLIMATE_SERIES_MAX_SAMPLES || len - pos < 4) {
+        return -1;
+    }
+
+    ClimateData sample = {
+        .temperature_tenths = (int16_t)read_u16_le(&buf[pos]),
+        .humidity_tenths    = (int16_t)read_u16_le(&buf[pos + 2]),
+    };
+    pos += 4;
+
+    for (uint8_t i = 0; ; i++) {
+        if (out) {
+            out[i] = sample;
         }
-        default:
-            // Unknown data type for now: treat as error
+        if (i + 1 == count) {
             return 0;
         }
-        break;
-    }
 
-    case LORA_COMMAND_REQUEST: {
-        if (buf_len < pos + 2) {
-            return 0;
+        size_t n = read_varint_delta(&buf[pos], len - pos, &sample.temperature_tenths);
+        if (n == 0) {
+            return -1;
         }
-        buf[pos++] = (uint8_t)msg->payload.command_req.command_type;
-        buf[pos++] = msg->payload.command_req.command_value.value;
-        break;
+        pos += n;
+        n = read_varint_delta(&buf[pos], len - pos, &sample.humidity_tenths);
+        if (n == 0) {
+            return -1;
+        }
+        pos += n;
     }
+}
 
-    case LORA_COMMAND_RESPONSE: {
-        if (buf_len < pos + 2) {
-            return 0;
-        }
-        buf[pos++] = (uint8_t)msg->payload.command_resp.command_type;
-        buf[pos++] = (uint8_t)msg->payload.command_resp.command_status;
-        break;
+static uint8_t climate_series_decode(const uint8_t *buf, size_t len, ClimateSeries *p)
+{
+    return climate_series_walk(buf, len, p->samples);
+}
+
+static uint8_t climate_series_check(const uint8_t *buf, size_t len)
+{
+    return climate_series_walk(buf, len, NULL);
+}
+
+// a function, so payload-less messages don't compare len < 0
+static inline bool too_short(size_t len, size_t need)
+{
+    return len < need;
+}
+
+/*
+ * Per message functions, expanded from lora_message_schema.h:
+ *
+ *   payload_size_NAME(p)         exact payload bytes, PAYLOAD_INVALID if p
+ *                                can not be encoded
+ *   encode_NAME(p, buf)          write the payload, buf already checked
+ *   stream_NAME(p, buf, pos, ..) write the payload to a sink, after the pos
+ *                                bytes already in buf, 0 if the sink failed
+ *   decode_NAME(buf, len, p)     0 on success, -1 on a short or bad payload
+ *   check_NAME(buf, len)         decode_NAME's checks without the copy
+ *
+ * Fixed fields are covered by one LORA_WIRE_MIN_SIZE check per message,
+ * made by the caller before decode_NAME / check_NAME: the codec table for
+ * messages, the UNION case for sub payloads. Only BYTES, TAIL, UNION and
+ * CUSTOM fields check again.
+ *
+ * A CUSTOM(codec, ..) field calls codec_size(p) and codec_encode(p, buf) for
+ * its own bytes, codec_decode(buf, len, p) and codec_check(buf, len) get the
+ * whole payload.
+ */
+
+// exact size
+#define SIZE_FIELD(kind, ...)           SIZE_##kind(__VA_ARGS__)
+#define SIZE_U8(field)
+#define SIZE_U16(field)
+#define SIZE_U32(field)
+#define SIZE_U8_MEMBER(field, member)
+#define SIZE_ZERO(field)
+#define SIZE_OPT_U8(field)              n += 1;
+#define SIZE_OPT_U32(field)             n += 4;
+#define SIZE_BYTES(field, len_field, max)                   \
+    if (p->len_field > (max)) return PAYLOAD_INVALID;       \
+    n += p->len_field;
+#define SIZE_TAIL                       SIZE_BYTES
+#define SIZE_UNION(tag_field, name, table)                  \
+    switch (p->tag_field) {                                 \
+    table(SIZE_UNION_CASE)                                  \
+    default: return PAYLOAD_INVALID;                        \
+    }
+#define SIZE_UNION_CASE(tag, path, ctype, NAME)             \
+    case tag: {                                             \
+        size_t sub = payload_size_##NAME(&p->path);         \
+        if (sub == PAYLOAD_INVALID) return PAYLOAD_INVALID; \
+        n += sub;                                           \
+        break;                                              \
+    }
+#define SIZE_CUSTOM(codec, field, max) {                    \
+        size_t sub = codec##_size(p);                       \
+        if (sub == PAYLOAD_INVALID) return PAYLOAD_INVALID; \
+        n += sub;                                           \
     }
 
-    case LORA_STREAM_REQUEST: {
-        if (buf_len < pos + 1) {
-            return 0;
-        }
-        buf[pos++] = (uint8_t)msg->payload.stream_req.stream_type;
-        break;
+// encode
+#define ENC_FIELD(kind, ...)            ENC_##kind(__VA_ARGS__)
+#define ENC_U8(field)                   buf[pos++] = (uint8_t)p->field;
+#define ENC_U16(field)                  write_u16_le(&buf[pos], (uint16_t)p->field); pos += 2;
+#define ENC_U32(field)                  write_u32_le(&buf[pos], (uint32_t)p->field); pos += 4;
+#define ENC_U8_MEMBER(field, member)    buf[pos++] = (uint8_t)p->field.member;
+#define ENC_ZERO(field)
+#define ENC_OPT_U8(field)               ENC_U8(field)
+#define ENC_OPT_U32(field)              ENC_U32(field)
+#define ENC_BYTES(field, len_field, max) \
+    memcpy(&buf[pos], p->field, p->len_field); pos += p->len_field;
+#define ENC_TAIL                        ENC_BYTES
+#define ENC_UNION(tag_field, name, table) \
+    switch (p->tag_field) {               \
+    table(ENC_UNION_CASE)                 \
+    default: break;                       \
+    }
+#define ENC_UNION_CASE(tag, path, ctype, NAME) \
+    case tag: pos += encode_##NAME(&p->path, &buf[pos]); break;
+#define ENC_CUSTOM(codec, field, max)   pos += codec##_encode(p, &buf[pos]);
+
+// decode
+#define DEC_FIELD(kind, ...)            DEC_##kind(__VA_ARGS__)
+#define DEC_U8(field)                   p->field = buf[pos++];
+#define DEC_U16(field)                  p->field = read_u16_le(&buf[pos]); pos += 2;
+#define DEC_U32(field)                  p->field = read_u32_le(&buf[pos]); pos += 4;
+#define DEC_U8_MEMBER(field, member)    p->field.member = buf[pos++];
+#define DEC_ZERO(field)                 p->field = 0;
+#define DEC_OPT_U8(field)               p->field = len > pos ? buf[pos++] : 0;
+#define DEC_OPT_U32(field)                                      \
+    if (len == pos) {                                           \
+        p->field = 0;                                           \
+    } else if (len - pos < 4) {                                 \
+        return -1;                                              \
+    } else {                                                    \
+        DEC_U32(field)                                          \
+    }
+#define DEC_BYTES(field, len_field, max)                        \
+    if (p->len_field > (max) || len - pos < p->len_field) {     \
+        return -1;                                              \
+    }                                                           \
+    memcpy(p->field, &buf[pos], p->len_field); pos += p->len_field;
+#define DEC_TAIL(field, len_field, max)                         \
+    if (len - pos > (max)) {                                    \
+        return -1;                                              \
+    }                                                           \
+    p->len_field = (uint8_t)(len - pos);                        \
+    memcpy(p->field, &buf[pos], len - pos); pos = len;
+#define DEC_UNION(tag_field, name, table) \
+    switch (p->tag_field) {               \
+    table(DEC_UNION_CASE)                 \
+    default: return -1;                   \
+    }
+#define DEC_UNION_CASE(tag, path, ctype, NAME)                      \
+    case tag:                                                       \
+        if (too_short(len - pos, LORA_WIRE_MIN_SIZE(NAME))) {       \
+            return -1;                                              \
+        }                                                           \
+        return decode_##NAME(&buf[pos], len - pos, &p->path);
+#define DEC_CUSTOM(codec, field, max)   return codec##_decode(buf, len, p);
+
+// check, U8 fields become locals so BYTES and UNION can refer to them
+#define CHK_FIELD(kind, ...)            CHK_##kind(__VA_ARGS__)
+#define CHK_U8(field)                   uint8_t field = buf[pos++]; (void)field;
+#define CHK_U16(field)                  pos += 2;
+#define CHK_U32(field)                  pos += 4;
+#define CHK_U8_MEMBER(field, member)    pos += 1;
+#define CHK_ZERO(field)
+#define CHK_OPT_U8(field)
+#define CHK_OPT_U32(field)                                      \
+    if (len != pos && len - pos < 4) {                          \
+        return -1;                                              \
+    }
+#define CHK_BYTES(field, len_field, max)                        \
+    if (len_field > (max) || len - pos < len_field) {           \
+        return -1;                                              \
+    }                                                           \
+    pos += len_field;
+#define CHK_TAIL(field, len_field, max)                         \
+    if (len - pos > (max)) {                                    \
+        return -1;                                              \
+    }
+#define CHK_UNION(tag_field, name, table) \
+    switch (tag_field) {                  \
+    table(CHK_UNION_CASE)                 \
+    default: return -1;                   \
+    }
+#define CHK_UNION_CASE(tag, path, ctype, NAME)                      \
+    case tag:                                                       \
+        if (too_short(len - pos, LORA_WIRE_MIN_SIZE(NAME))) {       \
+            return -1;                                              \
+        }                                                           \
+        return check_##NAME(&buf[pos], len - pos);
+#define CHK_CUSTOM(codec, field, max)   return codec##_check(buf, len);
+
+// sink, fixed fields gather in buf, BYTES, TAIL and CUSTOM go to the sink directly
+#define SINK_FIELD(kind, ...)           SINK_##kind(__VA_ARGS__)
+#define SINK_U8                         ENC_U8
+#define SINK_U16                        ENC_U16
+#define SINK_U32                        ENC_U32
+#define SINK_U8_MEMBER                  ENC_U8_MEMBER
+#define SINK_ZERO                       ENC_ZERO
+#define SINK_OPT_U8                     ENC_OPT_U8
+#define SINK_OPT_U32                    ENC_OPT_U32
+#define SINK_UNION(tag_field, name, table) \
+    switch (p->tag_field) {               \
+    table(SINK_UNION_CASE)                \
+    default: return 0;                    \
+    }
+#define SINK_UNION_CASE(tag, path, ctype, NAME) \
+    case tag: return stream_##NAME(&p->path, buf, pos, sink, ctx);
+#define SINK_DIRECT(data, n)                                    \
+    if (pos && !sink(ctx, buf, pos)) return 0;                  \
+    pos = 0;                                                    \
+    if ((n) && !sink(ctx, (const uint8_t *)(data), (n))) return 0;
+#define SINK_BYTES(field, len_field, max) SINK_DIRECT(p->field, p->len_field)
+#define SINK_TAIL                       SINK_BYTES
+#define SINK_CUSTOM(codec, field, max) {                        \
+        uint8_t direct[max];                                    \
+        size_t n = codec##_encode(p, direct);                   \
+        SINK_DIRECT(direct, n)                                  \
     }
 
-    case LORA_STREAM_ANNOUNCE: {
-        if (buf_len < pos + 1 + 1 + 2 + 1) {
-            return 0;
-        }
-        const LoraStreamAnnounce *sa = &msg->payload.stream_announce;
-        buf[pos++] = (uint8_t)sa->stream_type;
-        buf[pos++] = sa->stream_id;
-        write_u16_le(&buf[pos], sa->sequence_number);
-        pos += 2;
-        buf[pos++] = sa->packets_in_sequence;
-        break;
+// bytes of each payload that never pass through the sink scratch buffer
+#define DIRECT_FIELD(kind, ...)         DIRECT_##kind(__VA_ARGS__)
+#define DIRECT_U8(field)
+#define DIRECT_U16(field)
+#define DIRECT_U32(field)
+#define DIRECT_U8_MEMBER(field, member)
+#define DIRECT_ZERO(field)
+#define DIRECT_OPT_U8(field)
+#define DIRECT_OPT_U32(field)
+#define DIRECT_UNION(tag_field, name, table) + sizeof(LoraWireUnion_##table)
+#define DIRECT_BYTES(field, len_field, max) + (max)
+#define DIRECT_TAIL(field, len_field, max) + (max)
+#define DIRECT_CUSTOM(codec, field, max) + (max)
+
+#define SINK_SCRATCH_MEMBER(type_id, member, ctype, NAME) \
+    uint8_t NAME[LORA_WIRE_MAX_SIZE(NAME) - (0 LORA_SCHEMA_##NAME(DIRECT_FIELD)) + 1];
+
+typedef union {
+    LORA_MESSAGE_SCHEMA(SINK_SCRATCH_MEMBER)
+} SinkScratchPayload;
+
+// a UNION member continues in the scratch left by its message
+typedef union {
+    LORA_DATA_SCHEMA(SINK_SCRATCH_MEMBER)
+} SinkScratchSubPayload;
+
+#define SINK_SCRATCH_SIZE \
+    (LORA_MAX_HEADER_SIZE + sizeof(SinkScratchPayload) - 1 + sizeof(SinkScratchSubPayload) - 1)
+
+#define SCHEMA_FUNCTIONS(type_id, member, ctype, NAME)                  \
+    static size_t payload_size_##NAME(const ctype *p)                   \
+    {                                                                   \
+        size_t n = LORA_WIRE_MIN_SIZE(NAME);                            \
+        LORA_SCHEMA_##NAME(SIZE_FIELD)                                  \
+        (void)p;                                                        \
+        return n;                                                       \
+    }                                                                   \
+                                                                        \
+    static size_t encode_##NAME(const ctype *p, uint8_t *buf)           \
+    {                                                                   \
+        size_t pos = 0;                                                 \
+        LORA_SCHEMA_##NAME(ENC_FIELD)                                   \
+        (void)p; (void)buf;                                             \
+        return pos;                                                     \
+    }                                                                   \
+                                                                        \
+    static uint8_t stream_##NAME(const ctype *p, uint8_t *buf, size_t pos, \
+                                 LoraEncodeSink sink, void *ctx)        \
+    {                                                                   \
+        LORA_SCHEMA_##NAME(SINK_FIELD)                                  \
+        (void)p;                                                        \
+        return pos == 0 || sink(ctx, buf, pos);                         \
+    }                                                                   \
+                                                                        \
+    static uint8_t decode_##NAME(const uint8_t *buf, size_t len, ctype *p) \
+    {                                                                   \
+        size_t pos = 0;                                                 \
+        LORA_SCHEMA_##NAME(DEC_FIELD)                                   \
+        (void)buf; (void)len; (void)pos;                                \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    static uint8_t check_##NAME(const uint8_t *buf, size_t len)         \
+    {                                                                   \
+        size_t pos = 0;                                                 \
+        LORA_SCHEMA_##NAME(CHK_FIELD)                                   \
+        (void)buf; (void)len; (void)pos;                                \
+        return 0;                                                       \
     }
 
-    case LORA_STREAM_ANNOUNCE_ACK: {
-        if (buf_len < pos + 1 + 2) {
-            return 0;
-        }
-        const LoraStreamAnnounceAck *aa = &msg->payload.stream_announce_ack;
-        buf[pos++] = aa->stream_id;
-        write_u16_le(&buf[pos], aa->sequence_number);
-        pos += 2;
-        break;
+// sub payloads first, the message functions call them
+LORA_DATA_SCHEMA(SCHEMA_FUNCTIONS)
+LORA_MESSAGE_SCHEMA(SCHEMA_FUNCTIONS)
+
+/*
+ * Receive side table, indexed by message type, so decoding a frame is one
+ * lookup and one length check instead of a switch.
+ */
+typedef struct {
+    uint8_t min_len;          // LORA_WIRE_MIN_SIZE of the payload
+    uint8_t (*decode)(const uint8_t *buf, size_t len, LoraMessage *msg);
+    uint8_t (*check)(const uint8_t *buf, size_t len);
+} CodecEntry;
+
+#define DECODE_MESSAGE_FUNCTION(type_id, member, ctype, NAME)                   \
+    static uint8_t decode_message_##NAME(const uint8_t *buf, size_t len,        \
+                                         LoraMessage *msg)                      \
+    {                                                                           \
+        return decode_##NAME(buf, len, (ctype *)&msg->payload.member);          \
     }
+LORA_MESSAGE_SCHEMA(DECODE_MESSAGE_FUNCTION)
 
-    case LORA_STREAM_SEQUENCE: {
-        const LoraStreamSequence *ss = &msg->payload.stream_sequence;
-        uint8_t chunk_len = ss->chunk_len;
-        if (chunk_len > LORA_STREAM_MAX_CHUNK_SIZE) {
-            return 0;
-        }
+#define CODEC_ENTRY(type_id, member, ctype, NAME) \
+    [type_id] = { LORA_WIRE_MIN_SIZE(NAME), decode_message_##NAME, check_##NAME },
 
-        if (buf_len < pos + 1 + 1 + 2 + 1 + 1 + 1 + chunk_len) {
-            return 0;
-        }
+static const CodecEntry codec_table[LORA_MESSAGE_TYPE_COUNT] = {
+    LORA_MESSAGE_SCHEMA(CODEC_ENTRY)
+};
 
-        buf[pos++] = (uint8_t)ss->stream_type;
-        buf[pos++] = ss->stream_id;
-        write_u16_le(&buf[pos], ss->sequence_number);
-        pos += 2;
-        buf[pos++] = ss->packet_index;
-        buf[pos++] = ss->packets_in_sequence;
-        buf[pos++] = ss->chunk_len;
+// NULL for types this codec does not know
+static inline const CodecEntry *codec_entry(LoraMessageType type)
+{
+    if ((unsigned)type >= LORA_MESSAGE_TYPE_COUNT || !codec_table[type].decode) {
+        return NULL;
+    }
+    return &codec_table[type];
+}
 
-        memcpy(&buf[pos], ss->chunk, chunk_len);
-        pos += chunk_len;
-        break;
+_Static_assert(LORA_MAX_ENCODED_SIZE <= 255, "largest frame must fit the SX127x FIFO");
+
+static inline uint8_t use_short_ids(const LoraMetadata *meta)
+{
+    return meta->source <= LORA_HDR_SHORT_ID_MAX &&
+           (meta->dest <= LORA_HDR_SHORT_ID_MAX || meta->dest == LORA_NODE_BROADCAST_ID);
+}
+
+static inline size_t header_size(const LoraMessage *msg)
+{
+    const LoraMetadata *meta = &msg->metadata;
+
+    if (!(meta->flags & LORA_FLAG_COMPACT)) {
+        return LORA_HEADER_SIZE;
     }
 
-    case LORA_STREAM_SEQUENCE_ACK: {
-        if (buf_len < pos + 1 + 2 + 1 + 4) {
-            return 0;
+    size_t n = (use_short_ids(meta) || meta->dest == LORA_NODE_BROADCAST_ID) ? 2 : 3;
+    return (meta->flags & LORA_FLAG_ACK_REQ) ? n + 1 : n;
+}
+
+// writes header_size(msg) bytes
+static inline void encode_header(const LoraMessage *msg, uint8_t *buf)
+{
+    const LoraMetadata *meta = &msg->metadata;
+
+    if (!(meta->flags & LORA_FLAG_COMPACT)) {
+        buf[0] = (uint8_t)msg->message_type;
+        buf[1] = meta->source;
+        buf[2] = meta->dest;
+        return;
+    }
+
+    uint8_t bcast = meta->dest == LORA_NODE_BROADCAST_ID;
+    uint8_t b0 = LORA_HDR_COMPACT | ((uint8_t)msg->message_type & LORA_HDR_TYPE_MASK);
+    if (meta->flags & LORA_FLAG_ACK_REQ) {
+        b0 |= LORA_HDR_ACK_REQ;
+    }
+    if (bcast) {
+        b0 |= LORA_HDR_BCAST;
+    }
+
+    size_t n;
+    if (use_short_ids(meta)) {
+        buf[0] = b0 | LORA_HDR_SHORT;
+        buf[1] = (uint8_t)(meta->source << 4 | (bcast ? 0 : meta->dest));
+        n = 2;
+    } else {
+        buf[0] = b0;
+        buf[1] = meta->source;
+        n = 2;
+        if (!bcast) {
+            buf[n++] = meta->dest;
         }
-        const LoraStreamSequenceAck *ack = &msg->payload.stream_seq_ack;
-        buf[pos++] = ack->stream_id;
-        write_u16_le(&buf[pos], ack->sequence_number);
-        pos += 2;
-        buf[pos++] = (uint8_t)ack->status;
-        write_u32_le(&buf[pos], ack->missing_bitmap);
-        pos += 4;
-        break;
     }
 
-    case LORA_STREAM_COMPLETE: {
-        if (buf_len < pos + 1) {
+    if (b0 & LORA_HDR_ACK_REQ) {
+        buf[n] = meta->seq;
+    }
+}
+
+/*
+ * Parse either header format. Returns the header length, 0 if buf is too
+ * short for the header it starts with.
+ */
+static inline size_t decode_header(const uint8_t *buf, size_t len,
+                                   LoraMessageType *type, LoraMetadata *meta)
+{
+    uint8_t b0 = buf[0];
+
+    if (!(b0 & LORA_HDR_COMPACT)) {
+        if (len < LORA_HEADER_SIZE) {
             return 0;
         }
-        buf[pos++] = msg->payload.stream_complete.stream_id;
-        break;
+        *type        = (LoraMessageType)b0;
+        meta->source = buf[1];
+        meta->dest   = buf[2];
+        meta->flags  = 0;
+        meta->seq    = 0;
+        return LORA_HEADER_SIZE;
+    }
+
+    size_t ids = (b0 & (LORA_HDR_SHORT | LORA_HDR_BCAST)) ? 2 : 3;
+    size_t hdr = (b0 & LORA_HDR_ACK_REQ) ? ids + 1 : ids;
+    if (len < hdr) {
+        return 0;
+    }
+
+    *type       = (LoraMessageType)(b0 & LORA_HDR_TYPE_MASK);
+    meta->flags = LORA_FLAG_COMPACT | ((b0 & LORA_HDR_ACK_REQ) ? LORA_FLAG_ACK_REQ : 0);
+
+    if (b0 & LORA_HDR_SHORT) {
+        meta->source = buf[1] >> 4;
+        meta->dest   = buf[1] & 0x0F;
+    } else {
+        meta->source = buf[1];
+        meta->dest   = ids == 3 ? buf[2] : 0;
+    }
+    if (b0 & LORA_HDR_BCAST) {
+        meta->dest = LORA_NODE_BROADCAST_ID;
+    }
+    meta->seq = hdr > ids ? buf[ids] : 0;
+    return hdr;
+}
+
+size_t lora_encoded_size(const LoraMessage *msg)
+{
+    if (!msg) {
+        return 0;
     }
 
+    size_t n;
+
+    switch (msg->message_type) {
+#define SIZE_CASE(type_id, member, ctype, NAME)                             \
+    case type_id:                                                           \
+        n = payload_size_##NAME((const ctype *)&msg->payload.member);       \
+        break;
+    LORA_MESSAGE_SCHEMA(SIZE_CASE)
+#undef SIZE_CASE
     default:
-        // Unsupported message type
         return 0;
     }
 
-    return pos;
+    return n == PAYLOAD_INVALID ? 0 : header_size(msg) + n;
 }
 
-uint8_t lora_decode(const uint8_t *buf, size_t len, LoraMessage *msg)
+// payload of msg only, PAYLOAD_INVALID if it can not be encoded in cap bytes
+static size_t encode_payload(const LoraMessage *msg, uint8_t *buf, size_t cap)
 {
-    if (!buf || !msg || len < 3) {
-        return -1;
+    switch (msg->message_type) {
+#define PAYLOAD_CASE(type_id, member, ctype, NAME)                          \
+    case type_id: {                                                         \
+        const ctype *p = (const ctype *)&msg->payload.member;               \
+        size_t n = payload_size_##NAME(p);                                  \
+        if (n == PAYLOAD_INVALID || cap < n) {                              \
+            return PAYLOAD_INVALID;                                         \
+        }                                                                   \
+        return encode_##NAME(p, buf);                                       \
+    }
+    LORA_MESSAGE_SCHEMA(PAYLOAD_CASE)
+#undef PAYLOAD_CASE
+    default:
+        return PAYLOAD_INVALID;
     }
+}
 
-    size_t pos = 0;
+size_t lora_encode(const LoraMessage *msg, uint8_t *buf, size_t buf_len)
+{
+    if (!msg || !buf) {
+        return 0;
+    }
 
-    msg->message_type = (LoraMessageType)buf[pos++];
-    msg->metadata.source = buf[pos++];
-    msg->metadata.dest   = buf[pos++];
+    size_t hdr = header_size(msg);
+    if (buf_len < hdr) {
+        return 0;
+    }
+
+    // sized first, so the generated encoders write without further checks
+    size_t n = encode_payload(msg, &buf[hdr], buf_len - hdr);
+    if (n == PAYLOAD_INVALID) {
+        return 0;
+    }
+
+    encode_header(msg, buf);
+    return hdr + n;
+}
+
+size_t lora_encode_to_sink(const LoraMessage *msg, LoraEncodeSink sink, void *ctx)
+{
+    if (!msg || !sink) {
+        return 0;
+    }
+
+    uint8_t scratch[SINK_SCRATCH_SIZE];
 
     switch (msg->message_type) {
-    case LORA_RAW: {
-        if (len < pos + LORA_STREAM_MAX_CHUNK_SIZE) {
-            return -1;
-        }
-        memcpy(msg->payload.raw, &buf[pos], LORA_STREAM_MAX_CHUNK_SIZE);
-        pos += LORA_STREAM_MAX_CHUNK_SIZE;
-        break;
+#define SINK_CASE(type_id, member, ctype, NAME)                             \
+    case type_id: {                                                         \
+        const ctype *p = (const ctype *)&msg->payload.member;               \
+        size_t n = payload_size_##NAME(p);                                  \
+        if (n == PAYLOAD_INVALID) {                                         \
+            return 0;                                                       \
+        }                                                                   \
+        encode_header(msg, scratch);                                        \
+        if (!stream_##NAME(p, scratch, header_size(msg), sink, ctx)) {      \
+            return 0;                                                       \
+        }                                                                   \
+        return header_size(msg) + n;                                        \
+    }
+    LORA_MESSAGE_SCHEMA(SINK_CASE)
+#undef SINK_CASE
+    default:
+        return 0;
     }
+}
 
-    case LORA_PING_REQUEST:
-        msg->payload.ping_req._reserved = 0;
-        break;
+_Static_assert(offsetof(LoraPackedMessage, payload) ==
+               offsetof(LoraPackedMessage, message_type) + LORA_HEADER_SIZE,
+               "packed message header must match the frame header");
 
-    case LORA_PING_RESPONSE:
-        msg->payload.ping_resp._reserved = 0;
-        break;
+size_t lora_pack(const LoraMessage *msg, LoraPackedMessage *packed, size_t cap)
+{
+    if (!packed || cap < LORA_PACKED_SIZE(0)) {
+        return 0;
+    }
 
-    case LORA_DATA_REQUEST: {
-        if (len < pos + 1) {
-            return -1;
-        }
-        msg->payload.data_req.data_type = (LoraDataType)buf[pos++];
-        break;
+    if (!msg) {
+        return 0;
     }
 
-    case LORA_DATA: {
-        if (len < pos + 1) {
-            return -1;
-        }
-        LoraData *d = &msg->payload.data;
-        d->data_type = (LoraDataType)buf[pos++];
+    // always a legacy header, the flags are kept aside
+    LoraMessage legacy = *msg;
+    legacy.metadata.flags = 0;
 
-        switch (d->data_type) {
-        case LORA_DATA_TYPE_CLIMATE: {
-            if (len < pos + 4) {
-                return -1;
-            }
-            int16_t t = (int16_t)read_u16_le(&buf[pos]); pos += 2;
-            int16_t h = (int16_t)read_u16_le(&buf[pos]); pos += 2;
-            d->payload.climate_data.temperature_tenths = t;
-            d->payload.climate_data.humidity_tenths    = h;
-            break;
-        }
-        default:
-            // Unknown data type for now
-            return -1;
-        }
-        break;
+    size_t frame_cap = cap - offsetof(LoraPackedMessage, message_type);
+    size_t len = lora_encode(&legacy, &packed->message_type, frame_cap);
+    if (len == 0) {
+        return 0;
     }
 
-    case LORA_COMMAND_REQUEST: {
-        if (len < pos + 2) {
-            return -1;
-        }
-        msg->payload.command_req.command_type =
-            (CommandType)buf[pos++];
-        msg->payload.command_req.command_value.value = buf[pos++];
-        break;
+    packed->payload_len = (uint8_t)(len - LORA_HEADER_SIZE);
+    packed->flags = msg->metadata.flags;
+    return LORA_PACKED_SIZE(packed->payload_len);
+}
+
+uint8_t lora_unpack(const LoraPackedMessage *packed, LoraMessage *msg)
+{
+    if (!packed) {
+        return -1;
     }
 
-    case LORA_COMMAND_RESPONSE: {
-        if (len < pos + 2) {
-            return -1;
-        }
-        msg->payload.command_resp.command_type =
-            (CommandType)buf[pos++];
-        msg->payload.command_resp.command_status =
-            (CommandStatus)buf[pos++];
-        break;
+    uint8_t frame_len;
+    const uint8_t *frame = lora_packed_frame(packed, &frame_len);
+    if (lora_decode(frame, frame_len, msg) != 0) {
+        return -1;
     }
 
-    case LORA_STREAM_REQUEST: {
-        if (len < pos + 1) {
-            return -1;
-        }
-        msg->payload.stream_req.stream_type =
-            (LoraStreamType)buf[pos++];
-        break;
+    msg->metadata.flags = packed->flags;
+    return 0;
+}
+
+static uint8_t decode_payload(const uint8_t *payload, size_t plen, LoraMessage *msg)
+{
+    const CodecEntry *entry = codec_entry(msg->message_type);
+    if (!entry || plen < entry->min_len) {
+        return -1;
     }
+    return entry->decode(payload, plen, msg);
+}
 
-    case LORA_STREAM_ANNOUNCE: {
-        if (len < pos + 1 + 1 + 2 + 1) {
-            return -1;
-        }
-        LoraStreamAnnounce *sa = &msg->payload.stream_announce;
-        sa->stream_type = (LoraStreamType)buf[pos++];
-        sa->stream_id   = buf[pos++];
-        sa->sequence_number = read_u16_le(&buf[pos]); pos += 2;
-        sa->packets_in_sequence = buf[pos++];
-        break;
+static uint8_t decode_message(const uint8_t *buf, size_t len, LoraMessage *msg)
+{
+    if (!buf || !msg || len == 0) {
+        return -1;
     }
 
-    case LORA_STREAM_ANNOUNCE_ACK: {
-        if (len < pos + 1 + 2) {
-            return -1;
-        }
-        LoraStreamAnnounceAck *aa = &msg->payload.stream_announce_ack;
-        aa->stream_id = buf[pos++];
-        aa->sequence_number = read_u16_le(&buf[pos]); pos += 2;
-        break;
+    size_t hdr = decode_header(buf, len, &msg->message_type, &msg->metadata);
+    if (hdr == 0) {
+        return -1;
     }
 
-    case LORA_STREAM_SEQUENCE: {
-        if (len < pos + 1 + 1 + 2 + 1 + 1 + 1) {
-            return -1;
-        }
-        LoraStreamSequence *ss = &msg->payload.stream_sequence;
-        ss->stream_type       = (LoraStreamType)buf[pos++];
-        ss->stream_id         = buf[pos++];
-        ss->sequence_number   = read_u16_le(&buf[pos]); pos += 2;
-        ss->packet_index      = buf[pos++];
-        ss->packets_in_sequence = buf[pos++];
-        ss->chunk_len         = buf[pos++];
-
-        if (ss->chunk_len > LORA_STREAM_MAX_CHUNK_SIZE) {
-            return -1;
-        }
-        if (len < pos + ss->chunk_len) {
-            return -1;
-        }
+    return decode_payload(&buf[hdr], len - hdr, msg);
+}
 
-        memcpy(ss->chunk, &buf[pos], ss->chunk_len);
-        pos += ss->chunk_len;
-        break;
+uint8_t lora_decode(const uint8_t *buf, size_t len, LoraMessage *msg)
+{
+    LORA_PROFILE_START(t);
+    uint8_t status = decode_message(buf, len, msg);
+    LORA_PROFILE_STOP(t, LORA_PROFILE_DECODE);
+    return status;
+}
+
+uint8_t lora_decode_payload(const uint8_t *payload, size_t len, LoraMessage *msg)
+{
+    if (!payload || !msg) {
+        return -1;
     }
 
-    case LORA_STREAM_SEQUENCE_ACK: {
-        if (len < pos + 1 + 2 + 1 + 4) {
-            return -1;
-        }
-        LoraStreamSequenceAck *ack = &msg->payload.stream_seq_ack;
-        ack->stream_id       = buf[pos++];
-        ack->sequence_number = read_u16_le(&buf[pos]); pos += 2;
-        ack->status          = (LoraStreamStatus)buf[pos++];
-        ack->missing_bitmap  = read_u32_le(&buf[pos]); pos += 4;
-        break;
+    LORA_PROFILE_START(t);
+    uint8_t status = decode_payload(payload, len, msg);
+    LORA_PROFILE_STOP(t, LORA_PROFILE_DECODE);
+    return status;
+}
+
+uint8_t lora_decode_view(const uint8_t *buf, size_t len, LoraMessageView *view)
+{
+    if (!buf || !view) {
+        return -1;
     }
 
-    case LORA_STREAM_COMPLETE: {
-        if (len < pos + 1) {
-            return -1;
-        }
-        msg->payload.stream_complete.stream_id = buf[pos++];
-        break;
+    size_t hdr = lora_decode_header(buf, len, &view->message_type, &view->metadata);
+    if (hdr == 0) {
+        return -1;
     }
 
-    default:
+    view->payload     = &buf[hdr];
+    view->payload_len = len - hdr;
+
+    const CodecEntry *entry = codec_entry(view->message_type);
+    if (!entry || view->payload_len < entry->min_len) {
         return -1;
     }
+    return entry->check(view->payload, view->payload_len);
+}
 
-    return 0;
+size_t lora_decode_header(const uint8_t *buf, size_t len,
+                          LoraMessageType *type, LoraMetadata *meta)
+{
+    if (!buf || !type || !meta || len == 0) {
+        return 0;
+    }
+    return decode_header(buf, len, type, meta);
 }
 
+size_t lora_aggregate_append(LoraAggregate *agg, const LoraMessage *msg)
+{
+    if (!agg || !msg || msg->message_type == LORA_AGGREGATE ||
+        agg->entries_len + LORA_AGGREGATE_ENTRY_HEADER > LORA_AGGREGATE_MAX_BYTES) {
+        return 0;
+    }
+
+    uint8_t *entry = &agg->entries[agg->entries_len];
+    size_t cap = LORA_AGGREGATE_MAX_BYTES - agg->entries_len - LORA_AGGREGATE_ENTRY_HEADER;
+    size_t n = encode_payload(msg, &entry[LORA_AGGREGATE_ENTRY_HEADER], cap);
+    if (n == PAYLOAD_INVALID) {
+        return 0;
+    }
+
+    entry[0] = (uint8_t)msg->message_type;
+    entry[1] = (uint8_t)n;
+    agg->entries_len += (uint8_t)(LORA_AGGREGATE_ENTRY_HEADER + n);
+    return LORA_AGGREGATE_ENTRY_HEADER + n;
+}
+
+uint8_t lora_aggregate_next(const LoraMessage *container, size_t *pos, LoraMessage *msg)
+{
+    if (!container || !pos || !msg || container->message_type != LORA_AGGREGATE) {
+        return 0;
+    }
+
+    const LoraAggregate *agg = &container->payload.aggregate;
+    size_t at = *pos;
+    if (at + LORA_AGGREGATE_ENTRY_HEADER > agg->entries_len) {
+        return 0;
+    }
+
+    const uint8_t *entry = &agg->entries[at];
+    size_t len = entry[1];
+    if (entry[0] == LORA_AGGREGATE ||
+        len > agg->entries_len - at - LORA_AGGREGATE_ENTRY_HEADER) {
+        return 0;
+    }
+
+    msg->message_type = (LoraMessageType)entry[0];
+    msg->metadata = container->metadata;
+    if (decode_payload(&entry[LORA_AGGREGATE_ENTRY_HEADER], len, msg) != 0) {
+        return 0;
+    }
+
+    *pos = at + LORA_AGGREGATE_ENTRY_HEADER + len;
+    return 1;
+}
+
+size_t lora_routed_wrap(LoraRouted *routed, const LoraMessage *msg, uint8_t ttl)
+{
+    if (!routed || !msg || msg->message_type == LORA_AGGREGATE ||
+        msg->message_type == LORA_ROUTED) {
+        return 0;
+    }
+
+    size_t n = encode_payload(msg, &routed->inner[1], LORA_ROUTED_MAX_BYTES - 1);
+    if (n == PAYLOAD_INVALID) {
+        return 0;
+    }
+
+    routed->origin    = msg->metadata.source;
+    routed->target    = msg->metadata.dest;
+    routed->ttl       = ttl;
+    routed->hops      = 0;
+    routed->seq       = 0;
+    routed->inner[0]  = (uint8_t)msg->message_type;
+    routed->inner_len = (uint8_t)(1 + n);
+    return 1 + n;
+}
+
+uint8_t lora_routed_unwrap(const LoraMessage *container, LoraMessage *msg)
+{
+    if (!container || !msg || container->message_type != LORA_ROUTED) {
+        return 0;
+    }
+
+    const LoraRouted *routed = &container->payload.routed;
+    if (routed->inner_len < 1 || routed->inner[0] == LORA_AGGREGATE ||
+        routed->inner[0] == LORA_ROUTED) {
+        return 0;
+    }
+
+    msg->message_type    = (LoraMessageType)routed->inner[0];
+    msg->metadata.source = routed->origin;
+    msg->metadata.dest   = routed->target;
+    msg->metadata.flags  = 0;
+    msg->metadata.seq    = 0;
+    return decode_payload(&routed->inner[1], routed->inner_len - 1u, msg) == 0;
+}
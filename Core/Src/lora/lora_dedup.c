@@ -0,0 +1,65 @@
+#include "lora_dedup.h"
+#include <string.h>
+
+void lora_dedup_init(LoraDedup *dedup, uint32_t expiry_ms)
+{
+    memset(dedup, 0, sizeof(*dedup));
+    dedup->expiry_ms = expiry_ms ? expiry_ms : LORA_DEDUP_DEFAULT_EXPIRY_MS;
+}
+
+// the entry of (source, seq), or NULL with *victim the way it would take
+static LoraDedupEntry *dedup_find(LoraDedup *dedup, NodeId source, uint8_t seq,
+                                  uint32_t now_ms, LoraDedupEntry **victim)
+{
+    // consecutive seqs of one source land in consecutive sets
+    LoraDedupEntry *set = dedup->entries[(seq + source * 7u) & (LORA_DEDUP_SETS - 1)];
+    *victim = &set[0];
+
+    for (uint8_t way = 0; way < LORA_DEDUP_WAYS; way++) {
+        LoraDedupEntry *e = &set[way];
+
+        if (e->valid && now_ms - e->seen_ms >= dedup->expiry_ms) {
+            e->valid = 0;
+        }
+        if (e->valid && e->source == source && e->seq == seq) {
+            return e;
+        }
+
+        if ((*victim)->valid && (!e->valid || (int32_t)(e->seen_ms - (*victim)->seen_ms) < 0)) {
+            *victim = e;
+        }
+    }
+    return NULL;
+}
+
+uint8_t lora_dedup_seen(LoraDedup *dedup, NodeId source, uint8_t seq, uint32_t now_ms)
+{
+    LoraDedupEntry *victim;
+    if (dedup_find(dedup, source, seq, now_ms, &victim)) {
+        dedup->duplicates++;
+        return 1;
+    }
+    return 0;
+}
+
+void lora_dedup_record(LoraDedup *dedup, NodeId source, uint8_t seq, uint32_t now_ms)
+{
+    LoraDedupEntry *victim;
+    if (dedup_find(dedup, source, seq, now_ms, &victim)) {
+        return;
+    }
+
+    victim->seen_ms = now_ms;
+    victim->source  = source;
+    victim->seq     = seq;
+    victim->valid   = 1;
+}
+
+uint8_t lora_dedup_check(LoraDedup *dedup, NodeId source, uint8_t seq, uint32_t now_ms)
+{
+    if (lora_dedup_seen(dedup, source, seq, now_ms)) {
+        return 1;
+    }
+    lora_dedup_record(dedup, source, seq, now_ms);
+    return 0;
+}
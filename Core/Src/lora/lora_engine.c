@@ -1,18 +1,306 @@
 #include "lora_engine.h"
 #include "lora_codec.h"
+#include "lora_profile.h"
+#include "lora_capture.h"
+#include "lora_stream.h"
 #include <string.h>
 
+static uint32_t engine_now(LoraEngine *engine)
+{
+    return engine->driver->get_time_ms ? engine->driver->get_time_ms() : 0;
+}
+
+static void engine_flood_fire(LoraTimer *timer, void *ctx);
+
 void lora_engine_init(LoraEngine *engine, LoraDriver *driver)
 {
     memset(engine, 0, sizeof(*engine));
     engine->driver = driver;
+    lora_airtime_init(&engine->airtime, NULL, engine_now(engine));
+    // the clock is about the same on every boot, only the entropy is not
+    engine->rng = (driver->get_entropy ? driver->get_entropy(driver->lora_ctx) : 0) ^
+                  (uint32_t)driver->local_id << 24 ^ engine_now(engine) ^ 0x9E3779B9u;
+    lora_reliable_init(&engine->reliable, lora_engine_random(engine));
+    lora_dedup_init(&engine->dedup, 0);
+    lora_timer_wheel_init(&engine->timers, engine_now(engine));
+    lora_route_init(&engine->routes, 0);
+    lora_flood_init(&engine->flood, lora_engine_random(engine));
+    for (uint8_t i = 0; i < LORA_FLOOD_MAX_PENDING; i++) {
+        lora_timer_setup(&engine->flood.pending[i].timer, engine_flood_fire, engine);
+    }
+}
+
+uint32_t lora_engine_random(LoraEngine *engine)
+{
+    // xorshift32, never stuck at 0
+    uint32_t x = engine->rng ? engine->rng : 0x2545F491u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    engine->rng = x;
+    return x;
+}
+
+void lora_engine_set_duty_cycle(LoraEngine *engine,
+                                const LoraDutyCycleConfig *cfg)
+{
+    lora_airtime_init(&engine->airtime, cfg, engine_now(engine));
+}
+
+/**
+* ms until a frame of airtime_us may go out under the duty-cycle policy, 0 for now.
+* DEFER waits for budget up to max_defer_ms; a longer wait, or any under REJECT,
+* refuses the frame: it is counted and UINT32_MAX returned.
+*/
+static uint32_t engine_airtime_wait(LoraEngine *engine, uint32_t airtime_us)
+{
+    LoraAirtimeLedger *ledger = &engine->airtime;
+    uint32_t now = engine_now(engine);
+
+    if (ledger->config.policy == LORA_DUTY_CYCLE_OFF ||
+        lora_airtime_admit(ledger, now, airtime_us)) {
+        return 0;
+    }
+
+    if (ledger->config.policy == LORA_DUTY_CYCLE_DEFER && engine->driver->get_time_ms) {
+        uint32_t wait = lora_airtime_wait_ms(ledger, now, airtime_us);
+        if (wait != UINT32_MAX && wait <= ledger->config.max_defer_ms) {
+            return wait;
+        }
+    }
+
+    ledger->rejected.frames++;
+    ledger->rejected.airtime_us += airtime_us;
+    return UINT32_MAX;
+}
+
+void lora_engine_set_header_mode(LoraEngine *engine, LoraHeaderMode mode)
+{
+    engine->header_mode = mode;
+}
+
+void lora_engine_set_peer_compact(LoraEngine *engine, NodeId peer, uint8_t compact)
+{
+    if (compact) {
+        engine->compact_peers[peer >> 3] |= (uint8_t)(1u << (peer & 7));
+    } else {
+        engine->compact_peers[peer >> 3] &= (uint8_t)~(1u << (peer & 7));
+    }
+}
+
+static uint8_t engine_peer_compact(const LoraEngine *engine, NodeId peer)
+{
+    return (engine->compact_peers[peer >> 3] >> (peer & 7)) & 1;
+}
+
+// a compact frame from a peer means it can decode them too
+static void engine_learn_peer(LoraEngine *engine, const LoraMetadata *meta)
+{
+    if ((meta->flags & LORA_FLAG_COMPACT) && meta->source != LORA_NODE_BROADCAST_ID) {
+        lora_engine_set_peer_compact(engine, meta->source, 1);
+    }
+    // we heard it, so it is in range
+    lora_route_learn(&engine->routes, meta->source, meta->source, 1, engine_now(engine));
+}
+
+static void engine_choose_header(const LoraEngine *engine, LoraMessage *msg)
+{
+    uint8_t compact;
+
+    // only the compact header carries the ack request and seq
+    if (msg->metadata.flags & LORA_FLAG_ACK_REQ) {
+        msg->metadata.flags |= LORA_FLAG_COMPACT;
+        return;
+    }
+
+    switch (engine->header_mode) {
+    case LORA_HEADER_COMPACT:
+        compact = 1;
+        break;
+    case LORA_HEADER_AUTO:
+        // old nodes drop compact frames, so broadcasts stay legacy
+        compact = msg->metadata.dest != LORA_NODE_BROADCAST_ID &&
+                  engine_peer_compact(engine, msg->metadata.dest);
+        break;
+    default:
+        compact = 0;
+        break;
+    }
+
+    if (compact) {
+        msg->metadata.flags |= LORA_FLAG_COMPACT;
+    } else {
+        msg->metadata.flags &= (uint8_t)~LORA_FLAG_COMPACT;
+    }
+}
+
+// fallback for drivers without streaming transmit, kept out of line so the
+// frame buffer is only on the stack on this path
+__attribute__((noinline))
+static uint8_t engine_transmit_buffer(LoraEngine *engine,
+                                      const LoraMessage *msg,
+                                      uint16_t timeout)
+{
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t len = lora_encode(msg, buf, sizeof(buf));
+    if (len == 0) {
+        return 0;
+    }
+
+    return engine->driver->transmit(engine->driver->lora_ctx,
+                                    buf,
+                                    (uint8_t)len,
+                                    timeout);
+}
+
+static uint8_t engine_transmit_stream(LoraEngine *engine,
+                                      const LoraMessage *msg,
+                                      size_t len,
+                                      uint16_t timeout)
+{
+    LoraDriver *driver = engine->driver;
+
+    if (!driver->transmit_begin(driver->lora_ctx)) {
+        return 0;
+    }
+
+    if (lora_encode_to_sink(msg, driver->transmit_write, driver->lora_ctx) != len) {
+        driver->transmit_end(driver->lora_ctx, 0, timeout);
+        return 0;
+    }
+
+    return driver->transmit_end(driver->lora_ctx, (uint8_t)len, timeout);
+}
+
+// put msg on air if the duty cycle lets it go now. Otherwise 0, with
+// *wait_ms how long until it would fit, UINT32_MAX if it was refused; a
+// failed transmit is 0 with *wait_ms 0.
+static uint8_t engine_transmit(LoraEngine *engine,
+                               LoraMessage *msg,
+                               uint16_t timeout,
+                               uint32_t *wait_ms)
+{
+    LoraDriver *driver = engine->driver;
+    uint8_t streaming = driver->transmit_begin && driver->transmit_write && driver->transmit_end;
+
+    *wait_ms = UINT32_MAX;
+    if (!streaming && !driver->transmit) {
+        return 0;
+    }
+
+    engine_choose_header(engine, msg);
+
+    size_t len = lora_encoded_size(msg);
+    if (len == 0 || len > 255) {
+        return 0;
+    }
+
+    uint32_t airtime_us = lora_airtime_us(&driver->phy, (uint8_t)len);
+    *wait_ms = engine_airtime_wait(engine, airtime_us);
+    if (*wait_ms) {
+        return 0;
+    }
+
+    // the radio is keyed whether or not TX_DONE arrives in time, so always record
+    uint8_t status = streaming ? engine_transmit_stream(engine, msg, len, timeout)
+                               : engine_transmit_buffer(engine, msg, timeout);
+    lora_airtime_record(&engine->airtime,
+                        engine_now(engine),
+                        (uint8_t)msg->message_type,
+                        msg->metadata.dest,
+                        airtime_us);
+    return status;
+}
+
+static uint8_t engine_send_now(LoraEngine *engine,
+                               LoraMessage *msg,
+                               uint16_t timeout)
+{
+    uint32_t wait;
+    if (engine_transmit(engine, msg, timeout, &wait)) {
+        return 1;
+    }
+
+    // over budget for now, a later lora_engine_poll() sends it. Not an ack
+    // request: the queue keeps no seq, engine_reliable_transmit() waits itself
+    if (wait && wait != UINT32_MAX && !(msg->metadata.flags & LORA_FLAG_ACK_REQ)) {
+        return lora_engine_queue(engine, msg, lora_engine_priority_of(msg->message_type), timeout);
+    }
+    return 0;
+}
+
+uint8_t lora_engine_flush(LoraEngine *engine)
+{
+    if (!engine) {
+        return 0;
+    }
+
+    LoraMessage *agg = &engine->aggregate;
+    LoraAggregate *entries = &agg->payload.aggregate;
+    if (entries->entries_len == 0) {
+        return 1;
+    }
+
+    uint8_t status;
+    if (entries->entries[1] + LORA_AGGREGATE_ENTRY_HEADER == entries->entries_len) {
+        // a single message is 2 bytes shorter without the container
+        LoraMessage msg;
+        size_t pos = 0;
+        status = lora_aggregate_next(agg, &pos, &msg) &&
+                 engine_send_now(engine, &msg, engine->aggregate_timeout);
+    } else {
+        status = engine_send_now(engine, agg, engine->aggregate_timeout);
+    }
+
+    entries->entries_len = 0;
+    return status;
+}
+
+// 1 if msg is held for the aggregate, 0 if it has to go out on its own.
+// Entries get the container's metadata, so only messages with the same
+// source, dest and flags share a frame, and never an ack request: its seq
+// and its ack are for that one message.
+static uint8_t engine_hold(LoraEngine *engine,
+                           const LoraMessage *msg,
+                           uint16_t timeout)
+{
+    LoraMessage *agg = &engine->aggregate;
+    LoraAggregate *entries = &agg->payload.aggregate;
+
+    // bulk frames are full sized anyway, and stream packets are taken as
+    // views straight off the frame, never out of an aggregate
+    if ((msg->metadata.flags & LORA_FLAG_ACK_REQ) ||
+        lora_engine_priority_of(msg->message_type) == LORA_PRIORITY_BULK) {
+        return 0;
+    }
+
+    if (entries->entries_len) {
+        if (agg->metadata.source == msg->metadata.source &&
+            agg->metadata.dest == msg->metadata.dest &&
+            agg->metadata.flags == msg->metadata.flags &&
+            lora_aggregate_append(entries, msg)) {
+            return 1;
+        }
+        // keep the order: what is held goes out before msg
+        lora_engine_flush(engine);
+    }
+
+    if (!lora_aggregate_append(entries, msg)) {
+        return 0;
+    }
+
+    agg->message_type = LORA_AGGREGATE;
+    agg->metadata = msg->metadata;
+    engine->aggregate_since_ms = engine_now(engine);
+    engine->aggregate_timeout = timeout;
+    return 1;
 }
 
 uint8_t lora_engine_send(LoraEngine *engine,
                          LoraMessage *msg,
                          uint16_t timeout)
 {
-    if (!engine || !msg || !engine->driver->transmit) {
+    if (!engine || !msg) {
         return 0;
     }
 
@@ -20,16 +308,659 @@ uint8_t lora_engine_send(LoraEngine *engine,
         msg->metadata.source = engine->driver->local_id;
     }
 
-    uint8_t buf[LORA_MAX_ENCODED_SIZE];
-    size_t len = lora_encode(msg, buf, sizeof(buf));
-    if (len == 0 || len > 255) {
+    if (engine->aggregate_window_ms && msg->message_type != LORA_AGGREGATE &&
+        engine_hold(engine, msg, timeout)) {
+        return 1;
+    }
+    if (engine->aggregate.payload.aggregate.entries_len) {
+        lora_engine_flush(engine);
+    }
+
+    return engine_send_now(engine, msg, timeout);
+}
+
+uint8_t lora_engine_send_routed(LoraEngine *engine,
+                                LoraMessage *msg,
+                                uint16_t timeout)
+{
+    if (!engine || !msg) {
         return 0;
     }
 
-    return engine->driver->transmit(engine->driver->lora_ctx,
-                                   buf,
-                                   (uint8_t)len,
-                                   timeout);
+    if (msg->metadata.source == 0) {
+        msg->metadata.source = engine->driver->local_id;
+    }
+
+    const LoraRouteEntry *route = lora_route_lookup(&engine->routes, msg->metadata.dest,
+                                                    engine_now(engine));
+    if (!route || route->hops <= 1) {
+        // in range, or no better idea than trying
+        return lora_engine_send(engine, msg, timeout);
+    }
+
+    LoraMessage routed;
+    routed.message_type    = LORA_ROUTED;
+    routed.metadata.source = msg->metadata.source;
+    routed.metadata.dest   = route->next_hop;
+    routed.metadata.flags  = msg->metadata.flags & LORA_FLAG_COMPACT;
+    routed.metadata.seq    = 0;
+    if (!lora_routed_wrap(&routed.payload.routed, msg, LORA_ROUTE_MAX_HOPS)) {
+        return 0;
+    }
+    routed.payload.routed.seq = lora_flood_next_seq(&engine->flood);
+    return lora_engine_send(engine, &routed, timeout);
+}
+
+uint8_t lora_engine_flood(LoraEngine *engine,
+                          LoraMessage *msg,
+                          uint8_t ttl,
+                          uint16_t timeout)
+{
+    if (!engine || !msg) {
+        return 0;
+    }
+
+    if (msg->metadata.source == 0) {
+        msg->metadata.source = engine->driver->local_id;
+    }
+
+    LoraMessage flood;
+    flood.message_type    = LORA_ROUTED;
+    flood.metadata.source = msg->metadata.source;
+    flood.metadata.dest   = LORA_NODE_BROADCAST_ID;
+    flood.metadata.flags  = 0;
+    flood.metadata.seq    = 0;
+
+    LoraRouted *routed = &flood.payload.routed;
+    if (!lora_routed_wrap(routed, msg, ttl ? ttl : LORA_FLOOD_DEFAULT_TTL)) {
+        return 0;
+    }
+    routed->target = LORA_NODE_BROADCAST_ID;
+    routed->seq    = lora_flood_next_seq(&engine->flood);
+
+    // our own copy coming back is not news
+    lora_flood_seen(&engine->flood, routed->origin, routed->seq, engine_now(engine));
+    engine->flood.stats.originated++;
+    return lora_engine_send(engine, &flood, timeout);
+}
+
+void lora_engine_set_aggregation(LoraEngine *engine, uint32_t window_ms)
+{
+    if (window_ms == 0) {
+        lora_engine_flush(engine);
+    }
+    engine->aggregate_window_ms = window_ms;
+}
+
+static void engine_aggregate_poll(LoraEngine *engine)
+{
+    if (engine->aggregate.payload.aggregate.entries_len &&
+        engine_now(engine) - engine->aggregate_since_ms >= engine->aggregate_window_ms) {
+        lora_engine_flush(engine);
+    }
+}
+
+static uint32_t engine_airtime_ms(const LoraEngine *engine, size_t len)
+{
+    return (lora_airtime_us(&engine->driver->phy, (uint8_t)len) + 999) / 1000;
+}
+
+static void engine_reliable_fail(LoraEngine *engine, LoraReliablePending *p)
+{
+    p->in_use = 0;
+    engine->reliable.stats.failed++;
+    // whatever we routed through it will not get there either
+    lora_route_forget_hop(&engine->routes, p->dest);
+    if (engine->on_delivery) {
+        engine->on_delivery(engine, p->dest, p->seq, 0);
+    }
+}
+
+// one attempt of a pending reliable message. Its timer is armed only once
+// the frame is on air: over the duty-cycle budget it waits for room without
+// using up an attempt, refused or not transmitted it fails. Returns 0 if it
+// failed, the slot is then free.
+static uint8_t engine_reliable_transmit(LoraEngine *engine, LoraReliablePending *p)
+{
+    LoraMessage msg;
+    if (lora_unpack((const LoraPackedMessage *)p->packed, &msg) != 0) {
+        p->in_use = 0;
+        return 0;
+    }
+    msg.metadata.flags |= LORA_FLAG_ACK_REQ | LORA_FLAG_COMPACT;
+    msg.metadata.seq = p->seq;
+
+    uint32_t wait;
+    if (!engine_transmit(engine, &msg, p->timeout, &wait)) {
+        if (wait && wait != UINT32_MAX) {
+            p->deferred = 1;
+            p->retry_at_ms = engine_now(engine) + wait;
+            return 1;
+        }
+        return 0;
+    }
+
+    LoraMessage ack = {0};
+    ack.message_type = LORA_ACK;
+    ack.metadata = msg.metadata;
+    ack.metadata.flags = LORA_FLAG_COMPACT;
+
+    p->deferred = 0;
+    p->frame_len = (uint8_t)lora_encoded_size(&msg);
+    p->sent_ms = engine_now(engine);
+    engine->reliable.stats.tx_bytes += p->frame_len;
+    lora_reliable_arm(&engine->reliable, p,
+                      engine_airtime_ms(engine, p->frame_len) +
+                      engine_airtime_ms(engine, lora_encoded_size(&ack)) +
+                      LORA_RELIABLE_TURNAROUND_MS);
+    return 1;
+}
+
+uint8_t lora_engine_send_reliable(LoraEngine *engine,
+                                  LoraMessage *msg,
+                                  uint16_t timeout)
+{
+    if (!engine || !msg || msg->metadata.dest == LORA_NODE_BROADCAST_ID) {
+        return 0;
+    }
+
+    if (msg->metadata.source == 0) {
+        msg->metadata.source = engine->driver->local_id;
+    }
+
+    LoraReliable *rel = &engine->reliable;
+    LoraReliablePending *p = lora_reliable_slot(rel);
+    if (!p || !lora_pack(msg, (LoraPackedMessage *)p->packed, sizeof(p->packed))) {
+        return 0;
+    }
+
+    // held messages go first, this one must not join their frame
+    lora_engine_flush(engine);
+
+    uint32_t now = engine_now(engine);
+    p->in_use        = 1;
+    p->dest          = msg->metadata.dest;
+    p->seq           = lora_reliable_next_seq(rel, p->dest, now);
+    p->retries       = 0;
+    p->deferred      = 0;
+    p->timeout       = timeout;
+    p->first_sent_ms = now;
+
+    if (!engine_reliable_transmit(engine, p)) {
+        p->in_use = 0;
+        return 0;
+    }
+    rel->stats.sent++;
+    return 1;
+}
+
+static void engine_reliable_poll(LoraEngine *engine)
+{
+    LoraReliable *rel = &engine->reliable;
+    LoraReliablePending *p;
+
+    while ((p = lora_reliable_due(rel, engine_now(engine))) != NULL) {
+        // an attempt that waited for the duty cycle goes now, as the same attempt
+        if (!p->deferred) {
+            if (p->retries >= LORA_RELIABLE_MAX_RETRIES) {
+                engine_reliable_fail(engine, p);
+                continue;
+            }
+            p->retries++;
+            rel->stats.retries++;
+        }
+
+        if (!engine_reliable_transmit(engine, p)) {
+            engine_reliable_fail(engine, p);
+        }
+    }
+}
+
+static void engine_send_ack(LoraEngine *engine, const LoraMetadata *meta)
+{
+    // straight out, not through the queue or the aggregate: the sender's
+    // retransmission timer is already running
+    LoraMessage ack = {0};
+    ack.message_type = LORA_ACK;
+    ack.metadata.source = engine->local_id;
+    ack.metadata.dest = meta->source;
+    ack.payload.ack.seq = meta->seq;
+    engine_send_now(engine, &ack, 1000);
+}
+
+static inline uint8_t engine_wants_ack(const LoraEngine *engine, const LoraMetadata *meta)
+{
+    return (meta->flags & LORA_FLAG_ACK_REQ) && meta->dest == engine->local_id;
+}
+
+// 1 if an ack request addressed to us was handled already. The duplicate
+// is acked again, the first ack may be what got lost.
+static uint8_t engine_duplicate(LoraEngine *engine, const LoraMetadata *meta)
+{
+    if (!engine_wants_ack(engine, meta) ||
+        !lora_dedup_seen(&engine->dedup, meta->source, meta->seq, engine_now(engine))) {
+        return 0;
+    }
+    engine_send_ack(engine, meta);
+    return 1;
+}
+
+// ack and remember an ack request once its handler has run. A frame that
+// did not decode or had nobody to take it is neither, so the sender's
+// retransmission gets another go.
+static void engine_handled(LoraEngine *engine, const LoraMetadata *meta)
+{
+    if (engine_wants_ack(engine, meta)) {
+        lora_dedup_record(&engine->dedup, meta->source, meta->seq, engine_now(engine));
+        engine_send_ack(engine, meta);
+    }
+}
+
+static const uint16_t tx_queue_start[LORA_PRIORITY_COUNT] = {
+    0,
+    LORA_TX_QUEUE_CONTROL_BYTES,
+    LORA_TX_QUEUE_CONTROL_BYTES + LORA_TX_QUEUE_TELEMETRY_BYTES,
+};
+
+static const uint16_t tx_queue_size[LORA_PRIORITY_COUNT] = {
+    LORA_TX_QUEUE_CONTROL_BYTES,
+    LORA_TX_QUEUE_TELEMETRY_BYTES,
+    LORA_TX_QUEUE_BULK_BYTES,
+};
+
+#define TX_RECORD_HEADER 2 // u16 timeout
+
+LoraPriority lora_engine_priority_of(LoraMessageType type)
+{
+    switch (type) {
+        case LORA_STREAM_SEQUENCE:
+        case LORA_RAW:
+            return LORA_PRIORITY_BULK;
+
+        case LORA_DATA:
+        case LORA_DATA_REQUEST:
+        case LORA_STREAM_ANNOUNCE:
+        case LORA_STREAM_COMPLETE:
+            return LORA_PRIORITY_TELEMETRY;
+
+        default:
+            return LORA_PRIORITY_CONTROL;
+    }
+}
+
+uint8_t lora_engine_queue(LoraEngine *engine,
+                          LoraMessage *msg,
+                          LoraPriority priority,
+                          uint16_t timeout)
+{
+    if (!engine || !msg || priority >= LORA_PRIORITY_COUNT) {
+        return 0;
+    }
+
+    if (msg->metadata.source == 0) {
+        msg->metadata.source = engine->driver->local_id;
+    }
+
+    uint16_t used = engine->tx_queue_used[priority];
+    uint8_t *record = &engine->tx_queue[tx_queue_start[priority] + used];
+    size_t free_bytes = tx_queue_size[priority] - used;
+    size_t n = free_bytes > TX_RECORD_HEADER
+             ? lora_pack(msg, (LoraPackedMessage *)&record[TX_RECORD_HEADER], free_bytes - TX_RECORD_HEADER)
+             : 0;
+    if (n == 0) {
+        engine->tx_queue_dropped++;
+        return 0;
+    }
+
+    record[0] = (uint8_t)(timeout & 0xFF);
+    record[1] = (uint8_t)(timeout >> 8);
+    engine->tx_queue_used[priority] = (uint16_t)(used + TX_RECORD_HEADER + n);
+    return 1;
+}
+
+uint8_t lora_engine_tx_pending(const LoraEngine *engine)
+{
+    for (int p = 0; p < LORA_PRIORITY_COUNT; p++) {
+        if (engine->tx_queue_used[p]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// class of the message lora_engine_poll() sends next, LORA_PRIORITY_COUNT if none
+static int engine_queue_head(const LoraEngine *engine)
+{
+    int p = 0;
+    while (p < LORA_PRIORITY_COUNT && !engine->tx_queue_used[p]) {
+        p++;
+    }
+    return p;
+}
+
+// ms the next queued message has to wait for duty-cycle budget. 0 if it may
+// go now, or if it never will and sending it just counts the refusal.
+static uint32_t engine_queue_wait_ms(LoraEngine *engine)
+{
+    LoraAirtimeLedger *ledger = &engine->airtime;
+    int p = engine_queue_head(engine);
+    if (p == LORA_PRIORITY_COUNT || ledger->config.policy != LORA_DUTY_CYCLE_DEFER ||
+        !engine->driver->get_time_ms) {
+        return 0;
+    }
+
+    uint8_t len;
+    lora_packed_frame((const LoraPackedMessage *)&engine->tx_queue[tx_queue_start[p] + TX_RECORD_HEADER], &len);
+    uint32_t wait = lora_airtime_wait_ms(ledger, engine_now(engine),
+                                         lora_airtime_us(&engine->driver->phy, len));
+    return wait <= ledger->config.max_defer_ms ? wait : 0;
+}
+
+// send the oldest message of the highest non-empty class, unless it has
+// to wait for the duty cycle; engine_next_deadline() knows how long
+static void engine_send_queued(LoraEngine *engine)
+{
+    int p = engine_queue_head(engine);
+    if (p == LORA_PRIORITY_COUNT || engine_queue_wait_ms(engine)) {
+        return;
+    }
+
+    uint16_t used = engine->tx_queue_used[p];
+    uint8_t *record = &engine->tx_queue[tx_queue_start[p]];
+    const LoraPackedMessage *packed = (const LoraPackedMessage *)&record[TX_RECORD_HEADER];
+    uint16_t timeout = (uint16_t)(record[0] | record[1] << 8);
+    size_t n = TX_RECORD_HEADER + LORA_PACKED_SIZE(packed->payload_len);
+
+    LoraMessage msg;
+    uint8_t ok = lora_unpack(packed, &msg) == 0;
+
+    // the queue is short, sliding it beats ring bookkeeping
+    memmove(record, &record[n], used - n);
+    engine->tx_queue_used[p] = (uint16_t)(used - n);
+
+    if (ok) {
+        lora_engine_send(engine, &msg, timeout);
+    }
+}
+
+uint8_t lora_engine_send_packed(LoraEngine *engine,
+                                const LoraPackedMessage *packed,
+                                uint16_t timeout)
+{
+    if (!engine || !packed) {
+        return 0;
+    }
+
+    LoraDriver *driver = engine->driver;
+    uint8_t streaming = driver->transmit_begin && driver->transmit_write && driver->transmit_end;
+    if (!streaming && !driver->transmit) {
+        return 0;
+    }
+
+    uint8_t len;
+    const uint8_t *frame = lora_packed_frame(packed, &len);
+
+    uint32_t airtime_us = lora_airtime_us(&driver->phy, len);
+    if (engine_airtime_wait(engine, airtime_us)) {
+        return 0;
+    }
+
+    uint8_t status;
+    if (streaming) {
+        status = driver->transmit_begin(driver->lora_ctx) &&
+                 driver->transmit_write(driver->lora_ctx, frame, len);
+        status = driver->transmit_end(driver->lora_ctx, status ? len : 0, timeout) && status;
+    } else {
+        status = driver->transmit(driver->lora_ctx, (uint8_t *)frame, len, timeout);
+    }
+
+    lora_airtime_record(&engine->airtime,
+                        engine_now(engine),
+                        packed->message_type,
+                        packed->dest,
+                        airtime_us);
+    return status;
+}
+
+/*
+ * Receive side routes, indexed by message type: the LoraEngine member
+ * holding the handler and a function that calls it with the right payload.
+ * One lookup finds the handler, and tells lora_engine_handle_frame() from
+ * the header alone whether decoding the payload is worth it.
+ */
+typedef struct {
+    size_t slot;              // offsetof() the handler, ROUTE_BUILTIN if none is needed
+    void (*dispatch)(LoraEngine *engine, const LoraMessage *msg);
+} EngineRoute;
+
+#define ROUTE_BUILTIN 0       // offset of `driver`, never a handler
+
+// (message type, LoraEngine handler, LoraPayload member)
+#define ENGINE_HANDLERS(X)                                                    \
+    X(LORA_PING_REQUEST,        on_ping_req,            ping_req)             \
+    X(LORA_PING_RESPONSE,       on_ping_resp,           ping_resp)            \
+    X(LORA_DATA_REQUEST,        on_data_req,            data_req)             \
+    X(LORA_DATA,                on_data,                data)                 \
+    X(LORA_COMMAND_REQUEST,     on_command_req,         command_req)          \
+    X(LORA_COMMAND_RESPONSE,    on_command_resp,        command_resp)         \
+    X(LORA_STREAM_REQUEST,      on_stream_req,          stream_req)           \
+    X(LORA_STREAM_ANNOUNCE,     on_stream_announce,     stream_announce)      \
+    X(LORA_STREAM_ANNOUNCE_ACK, on_stream_announce_ack, stream_announce_ack)  \
+    X(LORA_STREAM_SEQUENCE,     on_stream_sequence,     stream_sequence)      \
+    X(LORA_STREAM_SEQUENCE_ACK, on_stream_seq_ack,      stream_seq_ack)       \
+    X(LORA_STREAM_COMPLETE,     on_stream_complete,     stream_complete)
+
+#define ENGINE_DISPATCH(type, handler, member)                                \
+    static void dispatch_##handler(LoraEngine *engine, const LoraMessage *msg) \
+    {                                                                         \
+        engine->handler(engine, &msg->payload.member, &msg->metadata);        \
+    }
+ENGINE_HANDLERS(ENGINE_DISPATCH)
+
+static void dispatch_aggregate(LoraEngine *engine, const LoraMessage *msg)
+{
+    LoraMessage entry;
+    size_t pos = 0;
+    while (lora_aggregate_next(msg, &pos, &entry)) {
+        // the container has been acked already
+        entry.metadata.flags &= (uint8_t)~LORA_FLAG_ACK_REQ;
+        lora_engine_handle_message(engine, &entry);
+    }
+}
+
+static void dispatch_ack(LoraEngine *engine, const LoraMessage *msg)
+{
+    if (lora_reliable_ack(&engine->reliable, msg->metadata.source,
+                          msg->payload.ack.seq, engine_now(engine)) &&
+        engine->on_delivery) {
+        engine->on_delivery(engine, msg->metadata.source, msg->payload.ack.seq, 1);
+    }
+}
+
+static const EngineRoute *engine_route(const LoraEngine *engine, LoraMessageType type);
+static void engine_dispatch(LoraEngine *engine, const EngineRoute *route, const LoraMessage *msg);
+
+// pass a routed frame on towards its target, through the queue since this
+// runs in a handler
+static void engine_forward(LoraEngine *engine, const LoraMessage *msg)
+{
+    const LoraRouted *in = &msg->payload.routed;
+    LoraRouteTable *routes = &engine->routes;
+
+    const LoraRouteEntry *route = lora_route_lookup(routes, in->target, engine_now(engine));
+    NodeId next_hop = route ? route->next_hop : in->target;
+
+    // a route straight back is a loop
+    if (in->ttl <= 1 || next_hop == msg->metadata.source) {
+        routes->stats.dropped++;
+        return;
+    }
+
+    LoraMessage fwd;
+    fwd.message_type    = LORA_ROUTED;
+    fwd.metadata.source = engine->local_id;
+    fwd.metadata.dest   = next_hop;
+    fwd.metadata.flags  = 0;
+    fwd.metadata.seq    = 0;
+    fwd.payload.routed  = *in;
+    fwd.payload.routed.ttl--;
+    fwd.payload.routed.hops++;
+
+    if (lora_engine_queue(engine, &fwd, lora_engine_priority_of((LoraMessageType)in->inner[0]), 1000)) {
+        routes->stats.forwarded++;
+    } else {
+        routes->stats.dropped++;
+    }
+}
+
+// the message inside a routed frame, straight to its handler: the inner
+// metadata is not a neighbour to learn
+static void engine_deliver_routed(LoraEngine *engine, const LoraMessage *msg)
+{
+    LoraMessage inner;
+    if (lora_routed_unwrap(msg, &inner)) {
+        const EngineRoute *route = engine_route(engine, inner.message_type);
+        if (route) {
+            engine_dispatch(engine, route, &inner);
+        }
+    }
+}
+
+static void engine_flood_fire(LoraTimer *timer, void *ctx)
+{
+    LoraEngine *engine = (LoraEngine *)ctx;
+    LoraFlood *flood = &engine->flood;
+
+    for (uint8_t i = 0; i < LORA_FLOOD_MAX_PENDING; i++) {
+        LoraFloodPending *p = &flood->pending[i];
+        if (&p->timer != timer) {
+            continue;
+        }
+
+        p->in_use = 0;
+        if (p->copies >= LORA_FLOOD_SUPPRESS_COPIES) {
+            flood->stats.suppressed++;
+            return;
+        }
+
+        LoraMessage fwd;
+        if (lora_unpack((const LoraPackedMessage *)p->packed, &fwd) == 0 &&
+            lora_engine_queue(engine, &fwd,
+                              lora_engine_priority_of((LoraMessageType)fwd.payload.routed.inner[0]),
+                              p->timeout)) {
+            flood->stats.rebroadcast++;
+        } else {
+            flood->stats.dropped++;
+        }
+        return;
+    }
+}
+
+// first copy of a flood: handle it, then rebroadcast it after a random
+// delay unless enough copies are heard meanwhile
+static void engine_flood_receive(LoraEngine *engine, const LoraMessage *msg)
+{
+    const LoraRouted *in = &msg->payload.routed;
+    LoraFlood *flood = &engine->flood;
+
+    if (in->origin == engine->local_id ||
+        lora_flood_seen(flood, in->origin, in->seq, engine_now(engine))) {
+        return;
+    }
+
+    engine_deliver_routed(engine, msg);
+
+    LoraFloodPending *p = in->ttl > 1 ? lora_flood_slot(flood) : NULL;
+    if (!p) {
+        flood->stats.dropped++;
+        return;
+    }
+
+    LoraMessage fwd;
+    fwd.message_type    = LORA_ROUTED;
+    fwd.metadata.source = engine->local_id;
+    fwd.metadata.dest   = LORA_NODE_BROADCAST_ID;
+    fwd.metadata.flags  = 0;
+    fwd.metadata.seq    = 0;
+    fwd.payload.routed  = *in;
+    fwd.payload.routed.ttl--;
+    fwd.payload.routed.hops++;
+
+    size_t frame_len = lora_encoded_size(&fwd);
+    if (!lora_pack(&fwd, (LoraPackedMessage *)p->packed, sizeof(p->packed))) {
+        flood->stats.dropped++;
+        return;
+    }
+
+    p->in_use  = 1;
+    p->origin  = in->origin;
+    p->seq     = in->seq;
+    p->copies  = 1;
+    p->timeout = 1000;
+    lora_engine_start_timer(engine, &p->timer,
+                            lora_flood_delay_ms(flood, engine_airtime_ms(engine, frame_len)));
+}
+
+static void dispatch_routed(LoraEngine *engine, const LoraMessage *msg)
+{
+    const LoraRouted *routed = &msg->payload.routed;
+
+    // the way back to origin is through whoever passed this on
+    if (routed->origin != engine->local_id) {
+        lora_route_learn(&engine->routes, routed->origin, msg->metadata.source,
+                         (uint8_t)(routed->hops + 1), engine_now(engine));
+    }
+
+    if (routed->target == LORA_NODE_BROADCAST_ID) {
+        engine_flood_receive(engine, msg);
+    } else if (routed->target == engine->local_id) {
+        engine_deliver_routed(engine, msg);
+    } else if (msg->metadata.dest == engine->local_id) {
+        engine_forward(engine, msg);
+    }
+}
+
+#define ENGINE_ROUTE(type, handler, member) \
+    [type] = { offsetof(LoraEngine, handler), dispatch_##handler },
+
+static const EngineRoute engine_routes[LORA_MESSAGE_TYPE_COUNT] = {
+    ENGINE_HANDLERS(ENGINE_ROUTE)
+    [LORA_AGGREGATE] = { ROUTE_BUILTIN, dispatch_aggregate },
+    [LORA_ACK]       = { ROUTE_BUILTIN, dispatch_ack },
+    [LORA_ROUTED]    = { ROUTE_BUILTIN, dispatch_routed },
+};
+
+// route of a message type with a registered handler, NULL if nobody wants it
+static const EngineRoute *engine_route(const LoraEngine *engine, LoraMessageType type)
+{
+    if ((unsigned)type >= LORA_MESSAGE_TYPE_COUNT) {
+        return NULL;
+    }
+
+    const EngineRoute *route = &engine_routes[type];
+    if (!route->dispatch) {
+        return NULL;
+    }
+    if (route->slot != ROUTE_BUILTIN) {
+        void (*handler)(void);
+        memcpy(&handler, (const uint8_t *)engine + route->slot, sizeof(handler));
+        if (!handler) {
+            return NULL;
+        }
+    }
+    return route;
+}
+
+static inline uint8_t engine_is_for_us(const LoraEngine *engine, const LoraMetadata *meta)
+{
+    return meta->dest == engine->local_id || meta->dest == LORA_NODE_BROADCAST_ID;
+}
+
+static void engine_dispatch(LoraEngine *engine, const EngineRoute *route, const LoraMessage *msg)
+{
+    LORA_PROFILE_START(t_handler);
+    route->dispatch(engine, msg);
+    LORA_PROFILE_STOP(t_handler, LORA_PROFILE_HANDLER(msg->message_type));
 }
 
 void lora_engine_handle_message(LoraEngine *engine,
@@ -37,89 +968,245 @@ void lora_engine_handle_message(LoraEngine *engine,
 {
     if (!engine || !msg) return;
 
+    LORA_PROFILE_START(t);
     const LoraMetadata *meta = &msg->metadata;
+    engine_learn_peer(engine, meta);
 
     // Routing done here, if dest matches my local_id or a broadcast, I want to handle it.
-    if(meta->dest == engine->local_id || meta->dest == LORA_NODE_BROADCAST_ID) {
+    if (engine_is_for_us(engine, meta) && !engine_duplicate(engine, meta)) {
+        const EngineRoute *route = engine_route(engine, msg->message_type);
+        if (route) {
+            engine_dispatch(engine, route, msg);
+            engine_handled(engine, meta);
+        }
+    }
 
-        switch (msg->message_type) {
-            case LORA_PING_REQUEST:
-                if (engine->on_ping_req) {
-                    engine->on_ping_req(engine, &msg->payload.ping_req, meta);
-                }
-                break;
+    LORA_PROFILE_STOP(t, LORA_PROFILE_HANDLE_MESSAGE);
+}
 
-            case LORA_PING_RESPONSE:
-                if (engine->on_ping_resp) {
-                    engine->on_ping_resp(engine, &msg->payload.ping_resp, meta);
-                }
-                break;
+uint8_t lora_engine_handle_view(LoraEngine *engine,
+                                const LoraMessageView *view)
+{
+    if (!engine || !view) return 0;
 
-            case LORA_DATA_REQUEST:
-                if (engine->on_data_req) {
-                    engine->on_data_req(engine, &msg->payload.data_req, meta);
-                }
-                break;
+    const LoraMetadata *meta = &view->metadata;
+    engine_learn_peer(engine, meta);
+    if (!engine_is_for_us(engine, meta)) {
+        // not for us, nothing to decode either
+        return 1;
+    }
 
-            case LORA_DATA:
-                if (engine->on_data) {
-                    engine->on_data(engine, &msg->payload.data, meta);
-                }
-                break;
+    switch (view->message_type) {
+        case LORA_STREAM_SEQUENCE:
+            if (engine->on_stream_sequence_view) {
+                LORA_PROFILE_START(t_handler);
+                engine->on_stream_sequence_view(engine, view);
+                LORA_PROFILE_STOP(t_handler, LORA_PROFILE_HANDLER(view->message_type));
+                return 1;
+            }
+            return 0;
 
-            case LORA_COMMAND_REQUEST:
-                if (engine->on_command_req) {
-                    engine->on_command_req(engine, &msg->payload.command_req, meta);
-                }
-                break;
+        default:
+            return 0;
+    }
+}
 
-            case LORA_COMMAND_RESPONSE:
-                if (engine->on_command_resp) {
-                    engine->on_command_resp(engine, &msg->payload.command_resp, meta);
-                }
-                break;
+uint8_t lora_engine_handle_frame(LoraEngine *engine,
+                                 const uint8_t *buf,
+                                 size_t len)
+{
+    if (!engine || !buf) return 0;
 
-            case LORA_STREAM_REQUEST:
-                if (engine->on_stream_req) {
-                    engine->on_stream_req(engine, &msg->payload.stream_req, meta);
-                }
-                break;
+    // the header alone decides whether anything is decoded
+    LoraMessage msg;
+    size_t hdr = lora_decode_header(buf, len, &msg.message_type, &msg.metadata);
+    if (hdr == 0) {
+        return 0;
+    }
+    engine_learn_peer(engine, &msg.metadata);
+    if (!engine_is_for_us(engine, &msg.metadata) || engine_duplicate(engine, &msg.metadata)) {
+        return 0;
+    }
 
-            case LORA_STREAM_ANNOUNCE:
-                if (engine->on_stream_announce) {
-                    engine->on_stream_announce(engine, &msg->payload.stream_announce, meta);
-                }
-                break;
+    if (msg.message_type == LORA_STREAM_SEQUENCE && engine->on_stream_sequence_view) {
+        LoraMessageView view;
+        if (lora_decode_view(buf, len, &view) != 0 || !lora_engine_handle_view(engine, &view)) {
+            return 0;
+        }
+        engine_handled(engine, &msg.metadata);
+        return 1;
+    }
 
-            case LORA_STREAM_ANNOUNCE_ACK:
-                if (engine->on_stream_announce_ack) {
-                    engine->on_stream_announce_ack(engine, &msg->payload.stream_announce_ack, meta);
-                }
-                break;
+    const EngineRoute *route = engine_route(engine, msg.message_type);
+    if (!route) {
+        return 0;
+    }
 
-            case LORA_STREAM_SEQUENCE:
-                if (engine->on_stream_sequence) {
-                    engine->on_stream_sequence(engine, &msg->payload.stream_sequence, meta);
-                }
-                break;
+    LORA_PROFILE_START(t);
+    uint8_t status = lora_decode_payload(&buf[hdr], len - hdr, &msg) == 0;
+    if (status) {
+        engine_dispatch(engine, route, &msg);
+        engine_handled(engine, &msg.metadata);
+    }
+    LORA_PROFILE_STOP(t, LORA_PROFILE_HANDLE_MESSAGE);
+    return status;
+}
 
-            case LORA_STREAM_SEQUENCE_ACK:
-                if (engine->on_stream_seq_ack) {
-                    engine->on_stream_seq_ack(engine, &msg->payload.stream_seq_ack, meta);
-                }
-                break;
+uint8_t lora_engine_post_event(LoraEngine *engine, LoraEventType event)
+{
+    uint8_t head = engine->event_head;
+    uint8_t next = (head + 1) & (LORA_EVENT_QUEUE_SIZE - 1);
 
-            case LORA_STREAM_COMPLETE:
-                if (engine->on_stream_complete) {
-                    engine->on_stream_complete(engine, &msg->payload.stream_complete, meta);
-                }
+    if (next == engine->event_tail) {
+        engine->event_overflows++;
+        return 0;
+    }
+
+    engine->events[head] = (uint8_t)event;
+    engine->event_head = next; // publish after the event is written
+    return 1;
+}
+
+uint8_t lora_engine_has_events(const LoraEngine *engine)
+{
+    return engine->event_head != engine->event_tail || engine->driver->receive_ready_flag;
+}
+
+static LoraEventType engine_next_event(LoraEngine *engine)
+{
+    if (engine->driver->receive_ready_flag) {
+        engine->driver->receive_ready_flag = 0;
+        return LORA_EVENT_RX_DONE;
+    }
+
+    uint8_t tail = engine->event_tail;
+    if (tail == engine->event_head) {
+        return LORA_EVENT_NONE;
+    }
+
+    LoraEventType event = (LoraEventType)engine->events[tail];
+    engine->event_tail = (tail + 1) & (LORA_EVENT_QUEUE_SIZE - 1);
+    return event;
+}
+
+static void engine_receive(LoraEngine *engine)
+{
+    uint8_t received_data[LORA_MAX_ENCODED_SIZE];
+    uint8_t received_len = engine->driver->receive(engine->driver->lora_ctx,
+                                                   received_data,
+                                                   sizeof(received_data));
+
+#if LORA_CAPTURE_ENABLED
+    int16_t rssi = engine->driver->get_rssi
+                 ? (int16_t)engine->driver->get_rssi(engine->driver->lora_ctx)
+                 : 0;
+    lora_capture_frame(engine_now(engine), rssi, received_data, received_len);
+#endif
+
+    lora_engine_handle_frame(engine, received_data, received_len);
+}
+
+// ms until the engine has timed work, UINT32_MAX if none
+static uint32_t engine_next_deadline(LoraEngine *engine)
+{
+    uint32_t next = lora_engine_tx_pending(engine) ? engine_queue_wait_ms(engine) : UINT32_MAX;
+    if (!next) {
+        return 0;
+    }
+
+    uint32_t now = engine_now(engine);
+    uint32_t reliable_next = lora_reliable_next_deadline(&engine->reliable, now);
+    if (reliable_next < next) {
+        next = reliable_next;
+    }
+    uint32_t timer_next = lora_timer_wheel_next_deadline(&engine->timers, now);
+    if (timer_next < next) {
+        next = timer_next;
+    }
+    if (engine->stream) {
+        uint32_t stream_next = lora_stream_next_deadline(engine->stream);
+        if (stream_next < next) {
+            next = stream_next;
+        }
+    }
+    if (engine->aggregate.payload.aggregate.entries_len) {
+        uint32_t held = now - engine->aggregate_since_ms;
+        uint32_t left = held >= engine->aggregate_window_ms ? 0 : engine->aggregate_window_ms - held;
+        if (left < next) {
+            next = left;
+        }
+    }
+    return next;
+}
+
+uint8_t lora_engine_poll(LoraEngine *engine)
+{
+    uint8_t handled = 0;
+    LoraEventType event;
+
+    while ((event = engine_next_event(engine)) != LORA_EVENT_NONE) {
+        switch (event) {
+            case LORA_EVENT_RX_DONE:
+                engine_receive(engine);
                 break;
 
-            case LORA_RAW:
+            case LORA_EVENT_TX_DONE:
+            case LORA_EVENT_TIMER:
             default:
-                // ignore or extend later
+                // wake up only, timers are checked below
                 break;
         }
+        handled++;
+    }
+
+    lora_timer_wheel_advance(&engine->timers, engine_now(engine));
+    engine_aggregate_poll(engine);
+    engine_reliable_poll(engine);
+    if (engine->stream) {
+        lora_stream_poll(engine->stream);
+    }
+
+    if (!lora_engine_has_events(engine)) {
+        engine_send_queued(engine);
+    }
+    return handled;
+}
+
+void lora_engine_start_timer(LoraEngine *engine, LoraTimer *timer, uint32_t delay_ms)
+{
+    lora_timer_start(&engine->timers, timer, engine_now(engine) + delay_ms);
+}
+
+void lora_engine_stop_timer(LoraEngine *engine, LoraTimer *timer)
+{
+    lora_timer_stop(&engine->timers, timer);
+}
+
+// sleep through the driver until an interrupt, limit_ms or the next engine deadline
+static void engine_idle(LoraEngine *engine, uint32_t limit_ms)
+{
+    uint32_t max_ms = engine_next_deadline(engine);
+    if (max_ms > limit_ms) {
+        max_ms = limit_ms;
+    }
+
+    if (engine->driver->idle && max_ms && !lora_engine_has_events(engine)) {
+        engine->driver->idle(engine->driver->lora_ctx, engine, max_ms);
+    }
+}
+
+void lora_engine_run_until(LoraEngine *engine, uint32_t deadline_ms)
+{
+    int32_t left;
+
+    if (!engine->driver->get_time_ms) {
+        lora_engine_poll(engine);
+        return;
+    }
+
+    while ((left = (int32_t)(deadline_ms - engine_now(engine))) > 0) {
+        lora_engine_poll(engine);
+        engine_idle(engine, (uint32_t)left);
     }
 }
 
@@ -127,22 +1214,8 @@ void lora_engine_loop(LoraEngine *engine)
 {
     while(1)
     {
-        if(engine->driver->receive_ready_flag)
-        {
-            engine->driver->receive_ready_flag = 0;
-            uint8_t received_data[LORA_MAX_ENCODED_SIZE];
-            engine->driver->receive(engine->driver->lora_ctx, received_data, sizeof(received_data));
-
-            LoraMessage msg;
-            if(!lora_decode(received_data, sizeof(received_data), &msg))
-            {
-                lora_engine_handle_message(engine, &msg);
-            }
-            else 
-            {
-                // could not decode message - handle or ignore
-            }
-        }
+        lora_engine_poll(engine);
+        engine_idle(engine, UINT32_MAX);
     }
 }
 
@@ -0,0 +1,54 @@
+#include "lora_flood.h"
+#include <string.h>
+
+static uint32_t flood_random(LoraFlood *flood)
+{
+    // xorshift32, only for delays and the first seq
+    uint32_t x = flood->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    flood->rng = x;
+    return x;
+}
+
+void lora_flood_init(LoraFlood *flood, uint32_t seed)
+{
+    memset(flood, 0, sizeof(*flood));
+    lora_dedup_init(&flood->seen, 0);
+    flood->rng = seed ? seed : 0x2545F491u;
+    // a rebooted node should not repeat seqs its neighbours still remember,
+    // so the seed must differ from boot to boot
+    flood->next_seq = (uint8_t)flood_random(flood);
+}
+
+uint8_t lora_flood_seen(LoraFlood *flood, NodeId origin, uint8_t seq, uint32_t now_ms)
+{
+    if (!lora_dedup_check(&flood->seen, origin, seq, now_ms)) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < LORA_FLOOD_MAX_PENDING; i++) {
+        LoraFloodPending *p = &flood->pending[i];
+        if (p->in_use && p->origin == origin && p->seq == seq && p->copies < UINT8_MAX) {
+            p->copies++;
+        }
+    }
+    return 1;
+}
+
+LoraFloodPending *lora_flood_slot(LoraFlood *flood)
+{
+    for (uint8_t i = 0; i < LORA_FLOOD_MAX_PENDING; i++) {
+        if (!flood->pending[i].in_use) {
+            return &flood->pending[i];
+        }
+    }
+    return NULL;
+}
+
+uint32_t lora_flood_delay_ms(LoraFlood *flood, uint32_t airtime_ms)
+{
+    uint32_t window = LORA_FLOOD_DELAY_SLOTS * (airtime_ms ? airtime_ms : 1);
+    return flood_random(flood) % window;
+}
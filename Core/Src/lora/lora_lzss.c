@@ -0,0 +1,204 @@
+#include "lora_lzss.h"
+#include <string.h>
+
+#define WINDOW_MASK (LORA_LZSS_WINDOW - 1)
+#define MATCH_BITS  (1 + LORA_LZSS_WINDOW_BITS + LORA_LZSS_LENGTH_BITS)
+#define LITERAL_BITS 9
+
+// ---------------------------------------------------------------- encoder
+
+static uint8_t enc_flush_out(LoraLzssEncoder *enc, LoraEncodeSink sink, void *ctx)
+{
+    if (enc->out_len && !sink(ctx, enc->out, enc->out_len)) {
+        return 0;
+    }
+    enc->out_len = 0;
+    return 1;
+}
+
+static uint8_t enc_put_bits(LoraLzssEncoder *enc, uint32_t value, uint8_t count,
+                            LoraEncodeSink sink, void *ctx)
+{
+    enc->bits = (enc->bits << count) | value;
+    enc->bit_count += count;
+
+    while (enc->bit_count >= 8) {
+        enc->bit_count -= 8;
+        enc->out[enc->out_len++] = (uint8_t)(enc->bits >> enc->bit_count);
+        if (enc->out_len == LORA_LZSS_OUT_BYTES && !enc_flush_out(enc, sink, ctx)) {
+            return 0;
+        }
+    }
+    enc->bits &= (1u << enc->bit_count) - 1;
+    return 1;
+}
+
+// byte at pos relative to the first lookahead byte, negative is history
+static inline uint8_t enc_byte_at(const LoraLzssEncoder *enc, int pos)
+{
+    if (pos >= 0) {
+        return enc->lookahead[pos];
+    }
+    return enc->window[(enc->head + pos) & WINDOW_MASK];
+}
+
+// longest match for the lookahead, brute force over the window
+static uint8_t enc_find_match(const LoraLzssEncoder *enc, uint16_t *distance)
+{
+    uint8_t best = 0;
+
+    for (uint16_t d = 1; d <= enc->filled; d++) {
+        if (enc_byte_at(enc, -(int)d) != enc->lookahead[0]) {
+            continue;
+        }
+
+        uint8_t n = 1;
+        while (n < enc->lookahead_len && enc_byte_at(enc, n - (int)d) == enc->lookahead[n]) {
+            n++;
+        }
+        if (n > best) {
+            best = n;
+            *distance = d;
+            if (n == enc->lookahead_len) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+// emit one literal or match from the lookahead
+static uint8_t enc_step(LoraLzssEncoder *enc, LoraEncodeSink sink, void *ctx)
+{
+    uint16_t distance = 0;
+    uint8_t n = enc_find_match(enc, &distance);
+
+    if (n >= LORA_LZSS_MIN_MATCH) {
+        uint32_t token = ((uint32_t)(distance - 1) << LORA_LZSS_LENGTH_BITS)
+                       | (uint32_t)(n - LORA_LZSS_MIN_MATCH);
+        if (!enc_put_bits(enc, token, MATCH_BITS, sink, ctx)) {
+            return 0;
+        }
+    } else {
+        n = 1;
+        if (!enc_put_bits(enc, 0x100u | enc->lookahead[0], LITERAL_BITS, sink, ctx)) {
+            return 0;
+        }
+    }
+
+    for (uint8_t i = 0; i < n; i++) {
+        enc->window[enc->head] = enc->lookahead[i];
+        enc->head = (enc->head + 1) & WINDOW_MASK;
+    }
+    if (enc->filled < LORA_LZSS_WINDOW) {
+        enc->filled = enc->filled + n > LORA_LZSS_WINDOW ? LORA_LZSS_WINDOW : enc->filled + n;
+    }
+
+    enc->lookahead_len -= n;
+    memmove(enc->lookahead, &enc->lookahead[n], enc->lookahead_len);
+    return 1;
+}
+
+void lora_lzss_encoder_init(LoraLzssEncoder *enc)
+{
+    memset(enc, 0, sizeof(*enc));
+}
+
+uint8_t lora_lzss_compress(LoraLzssEncoder *enc, const uint8_t *in, size_t len,
+                           LoraEncodeSink sink, void *ctx)
+{
+    for (size_t i = 0; i < len; i++) {
+        enc->lookahead[enc->lookahead_len++] = in[i];
+        if (enc->lookahead_len == LORA_LZSS_MAX_MATCH && !enc_step(enc, sink, ctx)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint8_t lora_lzss_finish(LoraLzssEncoder *enc, LoraEncodeSink sink, void *ctx)
+{
+    while (enc->lookahead_len) {
+        if (!enc_step(enc, sink, ctx)) {
+            return 0;
+        }
+    }
+
+    // zero padding: a match flag without enough bits behind it, never decoded
+    if (enc->bit_count && !enc_put_bits(enc, 0, 8 - enc->bit_count, sink, ctx)) {
+        return 0;
+    }
+    return enc_flush_out(enc, sink, ctx);
+}
+
+// ---------------------------------------------------------------- decoder
+
+static uint8_t dec_flush_out(LoraLzssDecoder *dec, LoraEncodeSink sink, void *ctx)
+{
+    if (dec->out_len && !sink(ctx, dec->out, dec->out_len)) {
+        return 0;
+    }
+    dec->out_len = 0;
+    return 1;
+}
+
+static uint8_t dec_put(LoraLzssDecoder *dec, uint8_t byte, LoraEncodeSink sink, void *ctx)
+{
+    dec->window[dec->head] = byte;
+    dec->head = (dec->head + 1) & WINDOW_MASK;
+    if (dec->filled < LORA_LZSS_WINDOW) {
+        dec->filled++;
+    }
+
+    dec->out[dec->out_len++] = byte;
+    if (dec->out_len == LORA_LZSS_OUT_BYTES) {
+        return dec_flush_out(dec, sink, ctx);
+    }
+    return 1;
+}
+
+void lora_lzss_decoder_init(LoraLzssDecoder *dec)
+{
+    memset(dec, 0, sizeof(*dec));
+}
+
+uint8_t lora_lzss_decompress(LoraLzssDecoder *dec, const uint8_t *in, size_t len,
+                             LoraEncodeSink sink, void *ctx)
+{
+    for (size_t i = 0; i < len; i++) {
+        dec->bits = (dec->bits << 8) | in[i];
+        dec->bit_count += 8;
+
+        // at most one match token (14 bits) plus 7 spare bits are pending
+        while (dec->bit_count >= LITERAL_BITS) {
+            uint8_t literal = (dec->bits >> (dec->bit_count - 1)) & 1;
+
+            if (literal) {
+                dec->bit_count -= LITERAL_BITS;
+                if (!dec_put(dec, (uint8_t)(dec->bits >> dec->bit_count), sink, ctx)) {
+                    return 0;
+                }
+            } else {
+                if (dec->bit_count < MATCH_BITS) {
+                    break;
+                }
+                dec->bit_count -= MATCH_BITS;
+                uint32_t token = dec->bits >> dec->bit_count;
+                uint16_t distance = (uint16_t)((token >> LORA_LZSS_LENGTH_BITS) & WINDOW_MASK) + 1;
+                uint8_t n = (uint8_t)(token & ((1u << LORA_LZSS_LENGTH_BITS) - 1)) + LORA_LZSS_MIN_MATCH;
+                if (distance > dec->filled) {
+                    return 0; // points before the start of the stream
+                }
+
+                for (uint8_t k = 0; k < n; k++) {
+                    if (!dec_put(dec, dec->window[(dec->head - distance) & WINDOW_MASK], sink, ctx)) {
+                        return 0;
+                    }
+                }
+            }
+            dec->bits &= (1u << dec->bit_count) - 1;
+        }
+    }
+
+    return dec_flush_out(dec, sink, ctx);
+}
@@ -0,0 +1,98 @@
+#include "lora_profile.h"
+
+#if LORA_PROFILE_ENABLED
+
+#include <stdio.h>
+#include <string.h>
+
+static LoraProfileStats zones[LORA_PROFILE_ZONE_COUNT];
+
+static const char *const zone_names[LORA_PROFILE_HANDLER_BASE] = {
+    [LORA_PROFILE_SPI_READ]        = "spi_read",
+    [LORA_PROFILE_SPI_WRITE]       = "spi_write",
+    [LORA_PROFILE_SPI_BURST_WRITE] = "spi_burst_write",
+    [LORA_PROFILE_RECEIVE]         = "lora_receive",
+    [LORA_PROFILE_DECODE]          = "lora_decode",
+    [LORA_PROFILE_HANDLE_MESSAGE]  = "handle_message",
+};
+
+void lora_profile_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    lora_profile_reset();
+}
+
+void lora_profile_reset(void)
+{
+    memset(zones, 0, sizeof(zones));
+    for (int i = 0; i < LORA_PROFILE_ZONE_COUNT; i++) {
+        zones[i].min_cycles = UINT32_MAX;
+    }
+}
+
+void lora_profile_record(LoraProfileZone zone, uint32_t cycles)
+{
+    if ((unsigned)zone >= LORA_PROFILE_ZONE_COUNT) {
+        return;
+    }
+
+    LoraProfileStats *s = &zones[zone];
+    s->count++;
+    s->total_cycles += cycles;
+    if (cycles < s->min_cycles) s->min_cycles = cycles;
+    if (cycles > s->max_cycles) s->max_cycles = cycles;
+
+    // log4 bucket: number of significant bits / 2
+    uint32_t bucket = cycles ? (uint32_t)(31 - __builtin_clz(cycles)) / 2 : 0;
+    if (bucket >= LORA_PROFILE_HIST_BUCKETS) {
+        bucket = LORA_PROFILE_HIST_BUCKETS - 1;
+    }
+    if (s->histogram[bucket] != UINT16_MAX) {
+        s->histogram[bucket]++;
+    }
+}
+
+const LoraProfileStats *lora_profile_get(LoraProfileZone zone)
+{
+    if ((unsigned)zone >= LORA_PROFILE_ZONE_COUNT) {
+        return NULL;
+    }
+    return &zones[zone];
+}
+
+void lora_profile_report(void (*print)(const char *line))
+{
+    char line[160];
+
+    for (int z = 0; z < LORA_PROFILE_ZONE_COUNT; z++) {
+        const LoraProfileStats *s = &zones[z];
+        if (s->count == 0) {
+            continue;
+        }
+
+        int n;
+        if (z < LORA_PROFILE_HANDLER_BASE) {
+            n = snprintf(line, sizeof(line), "%-16s", zone_names[z]);
+        } else {
+            n = snprintf(line, sizeof(line), "handler[%2d]     ", z - LORA_PROFILE_HANDLER_BASE);
+        }
+
+        n += snprintf(line + n, sizeof(line) - n,
+                      " n=%lu min=%lu max=%lu mean=%lu hist4=",
+                      (unsigned long)s->count,
+                      (unsigned long)s->min_cycles,
+                      (unsigned long)s->max_cycles,
+                      (unsigned long)(s->total_cycles / s->count));
+
+        for (int b = 0; b < LORA_PROFILE_HIST_BUCKETS && n < (int)sizeof(line); b++) {
+            n += snprintf(line + n, sizeof(line) - n, b ? ",%u" : "%u", s->histogram[b]);
+        }
+
+        print(line);
+    }
+}
+
+#endif
@@ -0,0 +1,177 @@
+#include "lora_reliable.h"
+#include <string.h>
+
+static uint32_t reliable_random(LoraReliable *rel)
+{
+    // xorshift32, only for jitter and first seqs
+    uint32_t x = rel->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rel->rng = x;
+    return x;
+}
+
+void lora_reliable_init(LoraReliable *rel, uint32_t seed)
+{
+    memset(rel, 0, sizeof(*rel));
+    rel->rng = seed ? seed : 0x2545F491u;
+}
+
+static LoraReliablePeer *reliable_find_peer(LoraReliable *rel, NodeId id)
+{
+    for (uint8_t i = 0; i < rel->peer_count; i++) {
+        if (rel->peers[i].id == id) {
+            return &rel->peers[i];
+        }
+    }
+    return NULL;
+}
+
+static LoraReliablePeer *reliable_peer(LoraReliable *rel, NodeId id, uint32_t now_ms)
+{
+    LoraReliablePeer *peer = reliable_find_peer(rel, id);
+
+    if (!peer) {
+        if (rel->peer_count < LORA_RELIABLE_MAX_PEERS) {
+            peer = &rel->peers[rel->peer_count++];
+        } else {
+            peer = &rel->peers[0];
+            for (uint8_t i = 1; i < LORA_RELIABLE_MAX_PEERS; i++) {
+                if ((int32_t)(rel->peers[i].last_used_ms - peer->last_used_ms) < 0) {
+                    peer = &rel->peers[i];
+                }
+            }
+        }
+
+        memset(peer, 0, sizeof(*peer));
+        peer->id = id;
+        // a random start keeps a rebooted sender clear of the receiver's
+        // duplicate cache, given a seed that differs from boot to boot
+        peer->next_seq = (uint8_t)reliable_random(rel);
+    }
+
+    peer->last_used_ms = now_ms;
+    return peer;
+}
+
+LoraReliablePending *lora_reliable_slot(LoraReliable *rel)
+{
+    for (uint8_t i = 0; i < LORA_RELIABLE_MAX_PENDING; i++) {
+        if (!rel->pending[i].in_use) {
+            return &rel->pending[i];
+        }
+    }
+    return NULL;
+}
+
+uint8_t lora_reliable_next_seq(LoraReliable *rel, NodeId dest, uint32_t now_ms)
+{
+    return reliable_peer(rel, dest, now_ms)->next_seq++;
+}
+
+void lora_reliable_arm(LoraReliable *rel, LoraReliablePending *p, uint32_t min_rtt_ms)
+{
+    const LoraReliablePeer *peer = reliable_find_peer(rel, p->dest);
+    uint32_t rto;
+
+    if (peer && peer->srtt_ms) {
+        rto = peer->srtt_ms + 4u * peer->rttvar_ms;
+        if (rto < min_rtt_ms) {
+            rto = min_rtt_ms;
+        }
+    } else {
+        rto = 2 * min_rtt_ms;
+    }
+
+    for (uint8_t i = 0; i < p->retries && rto < LORA_RELIABLE_MAX_RTO_MS; i++) {
+        rto *= 2;
+    }
+    if (rto > LORA_RELIABLE_MAX_RTO_MS) {
+        rto = LORA_RELIABLE_MAX_RTO_MS;
+    }
+
+    // up to half again, so senders that collided spread out
+    rto += reliable_random(rel) % (rto / 2 + 1);
+    p->retry_at_ms = p->sent_ms + rto;
+}
+
+static void reliable_sample_rtt(LoraReliablePeer *peer, uint32_t rtt_ms)
+{
+    if (rtt_ms > UINT16_MAX) {
+        rtt_ms = UINT16_MAX;
+    }
+
+    if (!peer->srtt_ms) {
+        peer->srtt_ms   = (uint16_t)(rtt_ms ? rtt_ms : 1);
+        peer->rttvar_ms = (uint16_t)(rtt_ms / 2);
+        return;
+    }
+
+    uint32_t err = rtt_ms > peer->srtt_ms ? rtt_ms - peer->srtt_ms : peer->srtt_ms - rtt_ms;
+    peer->rttvar_ms = (uint16_t)((3u * peer->rttvar_ms + err) / 4);
+    peer->srtt_ms   = (uint16_t)((7u * peer->srtt_ms + rtt_ms) / 8);
+    if (!peer->srtt_ms) {
+        peer->srtt_ms = 1;
+    }
+}
+
+uint8_t lora_reliable_ack(LoraReliable *rel, NodeId source, uint8_t seq, uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < LORA_RELIABLE_MAX_PENDING; i++) {
+        LoraReliablePending *p = &rel->pending[i];
+        if (!p->in_use || p->dest != source || p->seq != seq) {
+            continue;
+        }
+
+        // Karn: an ack after a retransmission can not tell which attempt it answers
+        LoraReliablePeer *peer = reliable_find_peer(rel, source);
+        if (peer && p->retries == 0) {
+            reliable_sample_rtt(peer, now_ms - p->sent_ms);
+        }
+
+        uint32_t latency = now_ms - p->first_sent_ms;
+        rel->stats.delivered++;
+        rel->stats.delivered_bytes += p->frame_len;
+        rel->stats.latency_total_ms += latency;
+        if (latency > rel->stats.latency_max_ms) {
+            rel->stats.latency_max_ms = latency;
+        }
+
+        p->in_use = 0;
+        return 1;
+    }
+    return 0;
+}
+
+LoraReliablePending *lora_reliable_due(LoraReliable *rel, uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < LORA_RELIABLE_MAX_PENDING; i++) {
+        LoraReliablePending *p = &rel->pending[i];
+        if (p->in_use && (int32_t)(now_ms - p->retry_at_ms) >= 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+uint32_t lora_reliable_next_deadline(const LoraReliable *rel, uint32_t now_ms)
+{
+    uint32_t next = UINT32_MAX;
+
+    for (uint8_t i = 0; i < LORA_RELIABLE_MAX_PENDING; i++) {
+        const LoraReliablePending *p = &rel->pending[i];
+        if (!p->in_use) {
+            continue;
+        }
+
+        int32_t left = (int32_t)(p->retry_at_ms - now_ms);
+        if (left <= 0) {
+            return 0;
+        }
+        if ((uint32_t)left < next) {
+            next = (uint32_t)left;
+        }
+    }
+    return next;
+}
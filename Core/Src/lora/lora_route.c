@@ -0,0 +1,82 @@
+#include "lora_route.h"
+#include <stddef.h>
+#include <string.h>
+
+void lora_route_init(LoraRouteTable *table, uint32_t expiry_ms)
+{
+    memset(table, 0, sizeof(*table));
+    table->expiry_ms = expiry_ms ? expiry_ms : LORA_ROUTE_DEFAULT_EXPIRY_MS;
+}
+
+static inline uint8_t route_live(const LoraRouteTable *table,
+                                 const LoraRouteEntry *entry,
+                                 uint32_t now_ms)
+{
+    return entry->hops && now_ms - entry->updated_ms < table->expiry_ms;
+}
+
+void lora_route_learn(LoraRouteTable *table,
+                      NodeId dest,
+                      NodeId next_hop,
+                      uint8_t hops,
+                      uint32_t now_ms)
+{
+    if (dest == LORA_NODE_BROADCAST_ID || dest == 0 || !hops || hops > LORA_ROUTE_MAX_HOPS) {
+        return;
+    }
+
+    LoraRouteEntry *entry = NULL;
+    LoraRouteEntry *free_entry = NULL;
+    LoraRouteEntry *stalest = NULL;
+
+    for (uint8_t i = 0; i < LORA_ROUTE_MAX_ENTRIES; i++) {
+        LoraRouteEntry *e = &table->entries[i];
+        if (!e->hops) {
+            if (!free_entry) {
+                free_entry = e;
+            }
+        } else if (e->dest == dest) {
+            entry = e;
+            break;
+        } else if (!stalest || (int32_t)(e->updated_ms - stalest->updated_ms) < 0) {
+            stalest = e;
+        }
+    }
+
+    if (entry) {
+        // a longer route through another neighbour only once ours went quiet
+        if (entry->next_hop != next_hop && hops > entry->hops &&
+            route_live(table, entry, now_ms)) {
+            return;
+        }
+    } else {
+        entry = free_entry ? free_entry : stalest;
+    }
+
+    entry->dest       = dest;
+    entry->next_hop   = next_hop;
+    entry->hops       = hops;
+    entry->updated_ms = now_ms;
+}
+
+const LoraRouteEntry *lora_route_lookup(const LoraRouteTable *table,
+                                        NodeId dest,
+                                        uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < LORA_ROUTE_MAX_ENTRIES; i++) {
+        const LoraRouteEntry *e = &table->entries[i];
+        if (e->hops && e->dest == dest) {
+            return route_live(table, e, now_ms) ? e : NULL;
+        }
+    }
+    return NULL;
+}
+
+void lora_route_forget_hop(LoraRouteTable *table, NodeId next_hop)
+{
+    for (uint8_t i = 0; i < LORA_ROUTE_MAX_ENTRIES; i++) {
+        if (table->entries[i].next_hop == next_hop) {
+            table->entries[i].hops = 0;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#include "lora_spi_trace.h"
+
+#if LORA_SPI_TRACE_ENABLED
+
+#include <stdio.h>
+
+static LoraSpiTraceRecord ring[LORA_SPI_TRACE_DEPTH];
+static uint32_t ring_head;      // total records ever written
+static uint8_t  current_op = LORA_SPI_OP_NONE;
+
+void lora_spi_trace_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    lora_spi_trace_reset();
+}
+
+void lora_spi_trace_reset(void)
+{
+    ring_head = 0;
+    current_op = LORA_SPI_OP_NONE;
+}
+
+void lora_spi_trace_record(uint8_t reg, uint8_t flags, uint16_t len,
+                           uint8_t value, uint32_t start_cycles)
+{
+    LoraSpiTraceRecord *r = &ring[ring_head % LORA_SPI_TRACE_DEPTH];
+
+    r->start_cycles = start_cycles;
+    r->bus_cycles   = lora_spi_trace_cycles() - start_cycles;
+    r->reg          = reg & 0x7F;
+    r->flags        = flags;
+    r->len          = len > 0xFF ? 0xFF : (uint8_t)len;
+    r->op           = current_op;
+    r->value        = value;
+
+    ring_head++;
+}
+
+uint8_t lora_spi_trace_begin_op(uint8_t op)
+{
+    uint8_t prev = current_op;
+    if (prev == LORA_SPI_OP_NONE) {
+        current_op = op;
+    }
+    return prev;
+}
+
+void lora_spi_trace_end_op(uint8_t prev_op)
+{
+    current_op = prev_op;
+}
+
+void lora_spi_trace_dump(void (*print)(const char *line))
+{
+    char line[64];
+    uint32_t count = ring_head < LORA_SPI_TRACE_DEPTH ? ring_head : LORA_SPI_TRACE_DEPTH;
+    uint32_t first = ring_head - count;
+
+    snprintf(line, sizeof(line), "SPITRACE %d %lu %lu",
+             LORA_SPI_TRACE_VERSION,
+             (unsigned long)SystemCoreClock,
+             (unsigned long)count);
+    print(line);
+
+    // T start bus reg flags len op value, all hex
+    for (uint32_t i = first; i < ring_head; i++) {
+        const LoraSpiTraceRecord *r = &ring[i % LORA_SPI_TRACE_DEPTH];
+        snprintf(line, sizeof(line), "T %08lx %lx %02x %x %02x %x %02x",
+                 (unsigned long)r->start_cycles,
+                 (unsigned long)r->bus_cycles,
+                 r->reg, r->flags, r->len, r->op, r->value);
+        print(line);
+    }
+
+    print("SPITRACE END");
+}
+
+#endif
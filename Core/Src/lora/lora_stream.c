@@ -0,0 +1,725 @@
+#include "lora_stream.h"
+#include "lora_codec.h"
+#include "lora_crc.h"
+#include <string.h>
+
+// receiver gives a silent sender up after this long
+#define STREAM_RX_TIMEOUT_MS 60000
+
+static uint32_t stream_now(const LoraStream *stream)
+{
+    const LoraDriver *driver = stream->engine->driver;
+    return driver->get_time_ms ? driver->get_time_ms() : 0;
+}
+
+static uint32_t stream_airtime_ms(const LoraStream *stream, size_t len)
+{
+    return (lora_airtime_us(&stream->engine->driver->phy, (uint8_t)len) + 999) / 1000;
+}
+
+// time on air of the largest frame of a message type
+#define FRAME_MS(stream, NAME) stream_airtime_ms(stream, LORA_MAX_ENCODED_SIZE_OF(NAME))
+
+static inline uint32_t packet_mask(uint8_t packets)
+{
+    return packets >= 32 ? UINT32_MAX : (1u << packets) - 1;
+}
+
+static uint8_t highest_bit(uint32_t bits)
+{
+    uint8_t i = 0;
+    while (bits >>= 1) {
+        i++;
+    }
+    return i;
+}
+
+// //////////////////////////////////////////////////////////////
+// sender
+
+// through the queue: packets in the bulk class, announces as telemetry, so
+// control traffic goes first. 0 if the class is full.
+static uint8_t tx_send(LoraStream *stream, LoraMessage *msg)
+{
+    LoraStreamSender *tx = &stream->tx;
+
+    msg->metadata.dest = tx->dest;
+    if (!lora_engine_queue(stream->engine, msg, lora_engine_priority_of(msg->message_type), 1000)) {
+        return 0;
+    }
+    tx->stats.airtime_us += lora_airtime_us(&stream->engine->driver->phy,
+                                            (uint8_t)lora_encoded_size(msg));
+    return 1;
+}
+
+// packets of the current sequence, 0 past the end
+static uint8_t tx_sequence_packets(const LoraStreamSender *tx)
+{
+    uint32_t start = (uint32_t)tx->sequence * LORA_STREAM_SEQUENCE_BYTES;
+    if (start >= tx->len) {
+        return 0;
+    }
+
+    uint32_t left = tx->len - start;
+    if (left >= LORA_STREAM_SEQUENCE_BYTES) {
+        return LORA_STREAM_MAX_PACKETS_PER_SEQ;
+    }
+    return (uint8_t)((left + LORA_STREAM_MAX_CHUNK_SIZE - 1) / LORA_STREAM_MAX_CHUNK_SIZE);
+}
+
+static void tx_finish(LoraStream *stream, uint8_t ok)
+{
+    LoraStreamSender *tx = &stream->tx;
+
+    tx->state = LORA_STREAM_TX_IDLE;
+    tx->crc32 = lora_crc32_final(tx->crc32);
+    tx->stats.finished_ms = stream_now(stream);
+    if (stream->on_sent) {
+        stream->on_sent(stream, ok);
+    }
+}
+
+static void tx_complete(LoraStream *stream)
+{
+    LoraStreamSender *tx = &stream->tx;
+
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_COMPLETE;
+    msg.metadata.dest = tx->dest;
+    msg.payload.stream_complete.stream_id = tx->stream_id;
+    msg.payload.stream_complete.crc32 = lora_crc32_final(tx->crc32);
+
+    // the receiver has no other way to say it got this
+    uint8_t ok = 1;
+    if (lora_engine_send_reliable(stream->engine, &msg, 1000)) {
+        tx->stats.airtime_us += lora_airtime_us(&stream->engine->driver->phy,
+                                                (uint8_t)lora_encoded_size(&msg));
+    } else {
+        ok = tx_send(stream, &msg);
+    }
+    tx_finish(stream, ok);
+}
+
+// announce the current sequence, or finish if there is none left
+static void tx_begin_sequence(LoraStream *stream)
+{
+    LoraStreamSender *tx = &stream->tx;
+
+    tx->packets = tx_sequence_packets(tx);
+    if (tx->packets == 0) {
+        tx_complete(stream);
+        return;
+    }
+
+    tx->state = LORA_STREAM_TX_ANNOUNCE;
+    tx->to_send = 0;
+    tx->sent = 0;
+    tx->retries = 0;
+    tx->deadline_ms = stream_now(stream);
+}
+
+static void tx_announce(LoraStream *stream)
+{
+    LoraStreamSender *tx = &stream->tx;
+
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_ANNOUNCE;
+    msg.payload.stream_announce.stream_type = tx->type;
+    msg.payload.stream_announce.stream_id = tx->stream_id;
+    msg.payload.stream_announce.sequence_number = tx->sequence;
+    msg.payload.stream_announce.packets_in_sequence = tx->packets;
+    msg.payload.stream_announce.flags = tx->flags;
+
+    // announce out, the longer of the two answers back, doubled per retry.
+    // One the queue had no room for uses up a retry too, after as long as
+    // it takes to send one
+    uint32_t wait = FRAME_MS(stream, STREAM_ANNOUNCE);
+    if (tx_send(stream, &msg)) {
+        tx->stats.announces++;
+        wait += FRAME_MS(stream, STREAM_SEQUENCE_ACK) + LORA_STREAM_TURNAROUND_MS;
+    }
+    tx->state = LORA_STREAM_TX_ANNOUNCE;
+    tx->deadline_ms = stream_now(stream) + (wait << (tx->retries < 4 ? tx->retries : 4));
+    tx->retries++;
+}
+
+// slot holding chunk (stream wide number), read from the source if needed.
+// NULL if the source failed.
+static const uint8_t *tx_chunk(LoraStreamSender *tx, uint32_t chunk, uint8_t *len)
+{
+    uint8_t slot = (uint8_t)(chunk % LORA_STREAM_READ_AHEAD);
+
+    if (tx->ahead_chunk[slot] != chunk) {
+        uint32_t offset = chunk * LORA_STREAM_MAX_CHUNK_SIZE;
+        uint32_t left = tx->len - offset;
+        uint8_t n = left < LORA_STREAM_MAX_CHUNK_SIZE ? (uint8_t)left : LORA_STREAM_MAX_CHUNK_SIZE;
+
+        tx->ahead_chunk[slot] = UINT32_MAX;
+        if (tx->source.read(tx->source.ctx, offset, tx->ahead[slot], n) != n) {
+            return NULL;
+        }
+        tx->ahead_chunk[slot] = chunk;
+        tx->ahead_len[slot] = n;
+    }
+
+    *len = tx->ahead_len[slot];
+    return tx->ahead[slot];
+}
+
+static inline uint8_t lowest_bit(uint32_t bits)
+{
+    uint8_t i = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        i++;
+    }
+    return i;
+}
+
+// read one chunk that is about to be sent, at most one per poll so the
+// engine gets back to the radio quickly
+static void tx_read_ahead(LoraStreamSender *tx)
+{
+    uint32_t first;
+
+    switch (tx->state) {
+        case LORA_STREAM_TX_BURST:
+            first = (uint32_t)tx->sequence * LORA_STREAM_MAX_PACKETS_PER_SEQ + lowest_bit(tx->to_send);
+            break;
+        case LORA_STREAM_TX_ANNOUNCE:
+            first = (uint32_t)tx->sequence * LORA_STREAM_MAX_PACKETS_PER_SEQ;
+            break;
+        case LORA_STREAM_TX_WAIT_ACK:
+            // most likely all arrived, the next sequence is next
+            first = (uint32_t)(tx->sequence + 1) * LORA_STREAM_MAX_PACKETS_PER_SEQ;
+            break;
+        default:
+            return;
+    }
+
+    uint32_t chunks = (tx->len + LORA_STREAM_MAX_CHUNK_SIZE - 1) / LORA_STREAM_MAX_CHUNK_SIZE;
+    for (uint32_t chunk = first; chunk < first + LORA_STREAM_READ_AHEAD && chunk < chunks; chunk++) {
+        if (tx->ahead_chunk[chunk % LORA_STREAM_READ_AHEAD] != chunk) {
+            uint8_t n;
+            tx_chunk(tx, chunk, &n);
+            return;
+        }
+    }
+}
+
+static void tx_packet(LoraStream *stream)
+{
+    LoraStreamSender *tx = &stream->tx;
+    uint8_t index = lowest_bit(tx->to_send);
+
+    uint8_t n;
+    const uint8_t *chunk = tx_chunk(tx, (uint32_t)tx->sequence * LORA_STREAM_MAX_PACKETS_PER_SEQ + index, &n);
+    if (!chunk) {
+        tx_finish(stream, 0);
+        return;
+    }
+
+    // not {0}, that would clear the whole chunk first
+    LoraMessage msg;
+    msg.message_type = LORA_STREAM_SEQUENCE;
+    memset(&msg.metadata, 0, sizeof(msg.metadata));
+    LoraStreamSequence *seq = &msg.payload.stream_sequence;
+    seq->stream_type = tx->type;
+    seq->stream_id = tx->stream_id;
+    seq->sequence_number = tx->sequence;
+    seq->packet_index = index;
+    seq->packets_in_sequence = tx->packets;
+    seq->chunk_len = n;
+    memcpy(seq->chunk, chunk, n);
+    if (!tx_send(stream, &msg)) {
+        // still to send, next poll
+        return;
+    }
+
+    if (tx->sent & (1u << index)) {
+        tx->stats.packets_resent++;
+    } else {
+        // first sends go out in stream order
+        tx->crc32 = lora_crc32_update(tx->crc32, chunk, n);
+        tx->stats.packets_sent++;
+    }
+    tx->sent |= 1u << index;
+    tx->to_send &= ~(1u << index);
+
+    if (!tx->to_send) {
+        // the receiver acks on the last packet, or after its idle timeout
+        tx->state = LORA_STREAM_TX_WAIT_ACK;
+        tx->deadline_ms = stream_now(stream) +
+                          LORA_STREAM_ACK_IDLE_PACKETS * FRAME_MS(stream, STREAM_SEQUENCE) +
+                          FRAME_MS(stream, STREAM_SEQUENCE_ACK) +
+                          2 * LORA_STREAM_TURNAROUND_MS;
+    }
+}
+
+uint8_t lora_stream_send_from(LoraStream *stream,
+                              NodeId dest,
+                              LoraStreamType type,
+                              const LoraStreamSource *source,
+                              uint8_t flags)
+{
+    LoraStreamSender *tx = &stream->tx;
+    if (tx->state != LORA_STREAM_TX_IDLE || !source || !source->read ||
+        source->length > (uint32_t)UINT16_MAX * LORA_STREAM_SEQUENCE_BYTES) {
+        return 0;
+    }
+
+    memset(tx, 0, sizeof(*tx));
+    tx->dest = dest;
+    tx->type = type;
+    tx->stream_id = stream->next_stream_id++;
+    tx->flags = flags;
+    tx->source = *source;
+    tx->len = source->length;
+    tx->crc32 = lora_crc32_init();
+    memset(tx->ahead_chunk, 0xFF, sizeof(tx->ahead_chunk));
+    tx->stats.started_ms = stream_now(stream);
+
+    tx_begin_sequence(stream);
+    return 1;
+}
+
+static uint32_t memory_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    memcpy(buf, (const uint8_t *)ctx + offset, len);
+    return len;
+}
+
+uint8_t lora_stream_send(LoraStream *stream,
+                         NodeId dest,
+                         LoraStreamType type,
+                         const uint8_t *data,
+                         uint32_t len,
+                         uint8_t flags)
+{
+    if (!data && len) {
+        return 0;
+    }
+
+    LoraStreamSource source = { memory_read, (void *)data, len };
+    return lora_stream_send_from(stream, dest, type, &source, flags);
+}
+
+uint8_t lora_stream_request(LoraStream *stream, NodeId peer, LoraStreamType type)
+{
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_REQUEST;
+    msg.metadata.dest = peer;
+    msg.payload.stream_req.stream_type = type;
+    return lora_engine_send(stream->engine, &msg, 1000);
+}
+
+static uint8_t tx_matches(const LoraStream *stream, const LoraMetadata *meta,
+                          uint8_t stream_id, uint16_t sequence)
+{
+    const LoraStreamSender *tx = &stream->tx;
+    return tx->state != LORA_STREAM_TX_IDLE && meta->source == tx->dest &&
+           stream_id == tx->stream_id && sequence == tx->sequence;
+}
+
+static void on_announce_ack(LoraEngine *engine,
+                            const LoraStreamAnnounceAck *msg,
+                            const LoraMetadata *meta)
+{
+    LoraStream *stream = engine->stream;
+    LoraStreamSender *tx = &stream->tx;
+
+    if (tx_matches(stream, meta, msg->stream_id, msg->sequence_number) &&
+        tx->state == LORA_STREAM_TX_ANNOUNCE) {
+        // nothing of this sequence arrived yet, all of it goes
+        tx->state = LORA_STREAM_TX_BURST;
+        tx->to_send = packet_mask(tx->packets);
+        tx->retries = 0;
+    }
+}
+
+static void on_sequence_ack(LoraEngine *engine,
+                            const LoraStreamSequenceAck *msg,
+                            const LoraMetadata *meta)
+{
+    LoraStream *stream = engine->stream;
+    LoraStreamSender *tx = &stream->tx;
+
+    if (!tx_matches(stream, meta, msg->stream_id, msg->sequence_number)) {
+        return;
+    }
+    if (msg->status != LORA_STREAM_STATUS_OK) {
+        tx_finish(stream, 0);
+        return;
+    }
+
+    tx->retries = 0;
+    uint32_t missing = msg->missing_bitmap & packet_mask(tx->packets);
+    if (missing) {
+        // selective repeat: only what the receiver lacks
+        tx->state = LORA_STREAM_TX_BURST;
+        tx->to_send = missing;
+        return;
+    }
+
+    uint32_t left = tx->len - (uint32_t)tx->sequence * LORA_STREAM_SEQUENCE_BYTES;
+    tx->stats.bytes_delivered += left < LORA_STREAM_SEQUENCE_BYTES ? left : LORA_STREAM_SEQUENCE_BYTES;
+    tx->sequence++;
+    tx_begin_sequence(stream);
+}
+
+static void on_stream_req(LoraEngine *engine,
+                          const LoraStreamRequest *msg,
+                          const LoraMetadata *meta)
+{
+    LoraStream *stream = engine->stream;
+    if (stream->on_request) {
+        stream->on_request(stream, meta->source, msg->stream_type);
+    }
+}
+
+static void tx_poll(LoraStream *stream)
+{
+    LoraStreamSender *tx = &stream->tx;
+
+    switch (tx->state) {
+        case LORA_STREAM_TX_BURST:
+            // the next packet once the queue is empty, whatever else is
+            // waiting goes before it
+            if (!lora_engine_tx_pending(stream->engine)) {
+                tx_packet(stream);
+            }
+            tx_read_ahead(tx);
+            break;
+
+        case LORA_STREAM_TX_ANNOUNCE:
+        case LORA_STREAM_TX_WAIT_ACK:
+            if ((int32_t)(stream_now(stream) - tx->deadline_ms) < 0) {
+                tx_read_ahead(tx);
+                break;
+            }
+            // no answer: announce the sequence again, the receiver says where it is
+            if (tx->retries >= LORA_STREAM_MAX_RETRIES) {
+                tx_finish(stream, 0);
+            } else {
+                tx_announce(stream);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// //////////////////////////////////////////////////////////////
+// receiver
+
+// from handlers, so through the queue. 0 if it is full.
+static uint8_t rx_reply(LoraStream *stream, NodeId dest, LoraMessage *msg)
+{
+    msg->metadata.dest = dest;
+    return lora_engine_queue(stream->engine, msg, LORA_PRIORITY_CONTROL, 1000);
+}
+
+// an answer about the current sequence found the queue full: rx_poll()
+// acks it on the next go, which serves for an announce ack as well
+static void rx_retry_ack(LoraStream *stream)
+{
+    LoraStreamReceiver *rx = &stream->rx;
+    rx->ack_at_ms = stream_now(stream) + 1;
+    if (!rx->ack_at_ms) {
+        rx->ack_at_ms = 1;
+    }
+}
+
+static void rx_announce_ack(LoraStream *stream)
+{
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_ANNOUNCE_ACK;
+    msg.payload.stream_announce_ack.stream_id = stream->rx.stream_id;
+    msg.payload.stream_announce_ack.sequence_number = stream->rx.sequence;
+    if (!rx_reply(stream, stream->rx.source, &msg)) {
+        rx_retry_ack(stream);
+    }
+}
+
+static uint8_t rx_sequence_ack(LoraStream *stream, NodeId dest, uint8_t stream_id,
+                               uint16_t sequence, LoraStreamStatus status, uint32_t missing)
+{
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_SEQUENCE_ACK;
+    msg.payload.stream_seq_ack.stream_id = stream_id;
+    msg.payload.stream_seq_ack.sequence_number = sequence;
+    msg.payload.stream_seq_ack.status = status;
+    msg.payload.stream_seq_ack.missing_bitmap = missing;
+    return rx_reply(stream, dest, &msg);
+}
+
+static void rx_ack_current(LoraStream *stream)
+{
+    LoraStreamReceiver *rx = &stream->rx;
+    uint32_t missing = packet_mask(rx->packets) & ~rx->received;
+
+    // the sender resends exactly these, in order
+    rx->burst_last = missing ? highest_bit(missing) : rx->packets - 1;
+    rx->ack_at_ms = 0;
+    if (!rx_sequence_ack(stream, rx->source, rx->stream_id, rx->sequence,
+                         LORA_STREAM_STATUS_OK, missing)) {
+        rx_retry_ack(stream);
+    }
+}
+
+// 1 if the announced sequence fits the reassembly buffer, or there is none
+static uint8_t rx_fits(const LoraStream *stream, const LoraStreamAnnounce *msg)
+{
+    uint32_t last = (uint32_t)msg->sequence_number * LORA_STREAM_SEQUENCE_BYTES +
+                    (uint32_t)(msg->packets_in_sequence - 1) * LORA_STREAM_MAX_CHUNK_SIZE;
+    return !stream->rx_buffer || last < stream->rx_capacity;
+}
+
+// a sequence is complete: chain the CRCs of its chunks, taken as they came
+// in whatever order, onto the stream's
+static void rx_sequence_done(LoraStream *stream)
+{
+    LoraStreamReceiver *rx = &stream->rx;
+    uint32_t offset = (uint32_t)rx->sequence * LORA_STREAM_SEQUENCE_BYTES;
+
+    for (uint8_t i = 0; i < rx->packets && offset < rx->length; i++) {
+        uint32_t left = rx->length - offset;
+        uint32_t len = left < LORA_STREAM_MAX_CHUNK_SIZE ? left : LORA_STREAM_MAX_CHUNK_SIZE;
+        rx->crc32 = lora_crc32_append(rx->crc32, rx->packet_crc[i], len);
+        offset += len;
+    }
+}
+
+static void rx_start_sequence(LoraStream *stream, const LoraStreamAnnounce *msg)
+{
+    LoraStreamReceiver *rx = &stream->rx;
+
+    rx->sequence = msg->sequence_number;
+    rx->packets = msg->packets_in_sequence;
+    rx->received = 0;
+    rx->burst_last = msg->packets_in_sequence - 1;
+    rx->ack_at_ms = 0;
+    rx_announce_ack(stream);
+}
+
+static void on_announce(LoraEngine *engine,
+                        const LoraStreamAnnounce *msg,
+                        const LoraMetadata *meta)
+{
+    LoraStream *stream = engine->stream;
+    LoraStreamReceiver *rx = &stream->rx;
+    uint32_t now = stream_now(stream);
+
+    if (msg->packets_in_sequence == 0 ||
+        msg->packets_in_sequence > LORA_STREAM_MAX_PACKETS_PER_SEQ) {
+        return;
+    }
+
+    uint8_t same = rx->state == LORA_STREAM_RX_RECEIVING &&
+                   rx->source == meta->source && rx->stream_id == msg->stream_id;
+    // a sender that rebooted mid transfer starts over at sequence 0, maybe
+    // with the id it had; what we hold is not part of its new stream
+    uint8_t restart = same && msg->sequence_number == 0 && rx->sequence != 0;
+
+    if (!same || restart) {
+        // one stream at a time, but a stream's own sender may start over
+        uint8_t busy = rx->state == LORA_STREAM_RX_RECEIVING && rx->source != meta->source;
+        if (busy || msg->sequence_number != 0 || !rx_fits(stream, msg)) {
+            rx_sequence_ack(stream, meta->source, msg->stream_id, msg->sequence_number,
+                            LORA_STREAM_STATUS_ERROR, 0);
+            return;
+        }
+
+        memset(rx, 0, sizeof(*rx));
+        rx->state = LORA_STREAM_RX_RECEIVING;
+        rx->source = meta->source;
+        rx->stream_id = msg->stream_id;
+        rx->type = msg->stream_type;
+        rx->flags = msg->flags;
+        rx->crc32 = lora_crc32_init();
+        rx->last_rx_ms = now;
+        rx_start_sequence(stream, msg);
+        return;
+    }
+
+    rx->last_rx_ms = now;
+    uint8_t complete = rx->received == packet_mask(rx->packets);
+
+    if (msg->sequence_number == rx->sequence) {
+        // a repeated announce asks where we are
+        if (rx->received) {
+            rx_ack_current(stream);
+        } else {
+            rx_announce_ack(stream);
+        }
+    } else if (msg->sequence_number == (uint16_t)(rx->sequence + 1) && complete &&
+               rx_fits(stream, msg)) {
+        rx_start_sequence(stream, msg);
+    } else {
+        // an old sequence is done. A gap can not be filled, nor a sequence
+        // past the buffer: that ends the stream here as it will for the sender
+        LoraStreamStatus status = (int16_t)(msg->sequence_number - rx->sequence) < 0
+                                ? LORA_STREAM_STATUS_OK : LORA_STREAM_STATUS_ERROR;
+        if (status != LORA_STREAM_STATUS_OK) {
+            rx->state = LORA_STREAM_RX_IDLE;
+        }
+        rx_sequence_ack(stream, rx->source, rx->stream_id, msg->sequence_number, status, 0);
+    }
+}
+
+static void on_sequence_view(LoraEngine *engine, const LoraMessageView *view)
+{
+    LoraStream *stream = engine->stream;
+    LoraStreamReceiver *rx = &stream->rx;
+
+    uint8_t index = lora_view_u8(view, LORA_VIEW_OFF_SEQ_PACKET_INDEX);
+    if (rx->state != LORA_STREAM_RX_RECEIVING ||
+        view->metadata.source != rx->source ||
+        lora_view_u8(view, LORA_VIEW_OFF_SEQ_STREAM_ID) != rx->stream_id ||
+        lora_view_u16(view, LORA_VIEW_OFF_SEQ_SEQUENCE) != rx->sequence ||
+        index >= rx->packets) {
+        return;
+    }
+
+    uint32_t now = stream_now(stream);
+    rx->last_rx_ms = now;
+
+    if (!(rx->received & (1u << index))) {
+        uint8_t len;
+        const uint8_t *chunk = lora_view_stream_chunk(view, &len);
+        uint32_t offset = (uint32_t)rx->sequence * LORA_STREAM_SEQUENCE_BYTES +
+                          (uint32_t)index * LORA_STREAM_MAX_CHUNK_SIZE;
+
+        if (stream->rx_buffer) {
+            if (offset + len > stream->rx_capacity) {
+                rx->state = LORA_STREAM_RX_IDLE;
+                rx_sequence_ack(stream, rx->source, rx->stream_id, rx->sequence,
+                                LORA_STREAM_STATUS_ERROR, 0);
+                return;
+            }
+            memcpy(&stream->rx_buffer[offset], chunk, len);
+        } else if (stream->on_chunk) {
+            stream->on_chunk(stream, offset, chunk, len);
+        }
+
+        rx->packet_crc[index] = lora_crc32_update(0, chunk, len);
+        rx->received |= 1u << index;
+        if (offset + len > rx->length) {
+            rx->length = offset + len;
+        }
+        if (rx->received == packet_mask(rx->packets)) {
+            rx_sequence_done(stream);
+        }
+    }
+
+    if (rx->received == packet_mask(rx->packets) || index >= rx->burst_last) {
+        rx_ack_current(stream);
+    } else {
+        rx->ack_at_ms = now + LORA_STREAM_ACK_IDLE_PACKETS * FRAME_MS(stream, STREAM_SEQUENCE) +
+                        LORA_STREAM_TURNAROUND_MS;
+        if (!rx->ack_at_ms) {
+            rx->ack_at_ms = 1;
+        }
+    }
+}
+
+static void on_complete(LoraEngine *engine,
+                        const LoraStreamComplete *msg,
+                        const LoraMetadata *meta)
+{
+    LoraStream *stream = engine->stream;
+    LoraStreamReceiver *rx = &stream->rx;
+
+    if (rx->state != LORA_STREAM_RX_RECEIVING || meta->source != rx->source ||
+        msg->stream_id != rx->stream_id) {
+        return;
+    }
+
+    rx->state = LORA_STREAM_RX_IDLE;
+    uint8_t ok = msg->crc32 == 0 || lora_crc32_final(rx->crc32) == msg->crc32;
+    if (stream->on_done) {
+        stream->on_done(stream, rx->length, msg->crc32, ok);
+    }
+}
+
+static void rx_poll(LoraStream *stream)
+{
+    LoraStreamReceiver *rx = &stream->rx;
+    if (rx->state != LORA_STREAM_RX_RECEIVING) {
+        return;
+    }
+
+    uint32_t now = stream_now(stream);
+    if (now - rx->last_rx_ms >= STREAM_RX_TIMEOUT_MS) {
+        rx->state = LORA_STREAM_RX_IDLE;
+        return;
+    }
+    if (rx->ack_at_ms && (int32_t)(now - rx->ack_at_ms) >= 0) {
+        rx_ack_current(stream);
+    }
+}
+
+// //////////////////////////////////////////////////////////////
+
+void lora_stream_init(LoraStream *stream, LoraEngine *engine)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->engine = engine;
+    // after a reboot, not the id a receiver may still be busy with
+    stream->next_stream_id = (uint8_t)lora_engine_random(engine);
+
+    engine->stream = stream;
+    engine->on_stream_req = on_stream_req;
+    engine->on_stream_announce = on_announce;
+    engine->on_stream_announce_ack = on_announce_ack;
+    engine->on_stream_sequence_view = on_sequence_view;
+    engine->on_stream_seq_ack = on_sequence_ack;
+    engine->on_stream_complete = on_complete;
+}
+
+uint8_t lora_stream_rx_reserve(LoraStream *stream, LoraArena *arena, uint32_t capacity)
+{
+    uint8_t *buffer = lora_arena_alloc(arena, capacity);
+    if (!buffer) {
+        return 0;
+    }
+
+    stream->rx_buffer = buffer;
+    stream->rx_capacity = capacity;
+    return 1;
+}
+
+void lora_stream_poll(LoraStream *stream)
+{
+    rx_poll(stream);
+    tx_poll(stream);
+}
+
+uint32_t lora_stream_next_deadline(const LoraStream *stream)
+{
+    const LoraStreamSender *tx = &stream->tx;
+    const LoraStreamReceiver *rx = &stream->rx;
+    uint32_t now = stream_now(stream);
+    uint32_t next = UINT32_MAX;
+
+    if (tx->state == LORA_STREAM_TX_BURST) {
+        // a packet to queue, unless the queue is busy: that has its own deadline
+        if (!lora_engine_tx_pending(stream->engine)) {
+            return 0;
+        }
+    } else if (tx->state != LORA_STREAM_TX_IDLE) {
+        int32_t left = (int32_t)(tx->deadline_ms - now);
+        next = left > 0 ? (uint32_t)left : 0;
+    }
+
+    if (rx->state == LORA_STREAM_RX_RECEIVING) {
+        uint32_t at = rx->ack_at_ms ? rx->ack_at_ms : rx->last_rx_ms + STREAM_RX_TIMEOUT_MS;
+        int32_t left = (int32_t)(at - now);
+        uint32_t rx_next = left > 0 ? (uint32_t)left : 0;
+        if (rx_next < next) {
+            next = rx_next;
+        }
+    }
+    return next;
+}
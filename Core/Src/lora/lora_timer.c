@@ -0,0 +1,183 @@
+#include "lora_timer.h"
+#include <string.h>
+
+#define TIMER_SLOT_MASK (LORA_TIMER_SLOTS - 1)
+
+// level values of timers not in a slot
+#define TIMER_LEVEL_EXPIRED LORA_TIMER_LEVELS
+#define TIMER_LEVEL_TODO    (LORA_TIMER_LEVELS + 1)
+
+static inline uint32_t timer_digit(uint32_t ms, uint8_t level)
+{
+    return (ms >> (level * LORA_TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+}
+
+static inline uint32_t rotl32(uint32_t x, uint32_t r)
+{
+    return (x << r) | (x >> ((32 - r) & 31));
+}
+
+static inline uint32_t rotr32(uint32_t x, uint32_t r)
+{
+    return (x >> r) | (x << ((32 - r) & 31));
+}
+
+static void timer_link(LoraTimer **head, LoraTimer *timer)
+{
+    timer->next = *head;
+    if (*head) {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void timer_unlink(LoraTimer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void timer_insert(LoraTimerWheel *wheel, LoraTimer *timer)
+{
+    int32_t left = (int32_t)(timer->expires_ms - wheel->now_ms);
+
+    if (left <= 0) {
+        timer->level = TIMER_LEVEL_EXPIRED;
+        timer_link(&wheel->expired, timer);
+        return;
+    }
+
+    uint8_t level = (uint8_t)((31 - __builtin_clz((uint32_t)left)) / LORA_TIMER_SLOT_BITS);
+    uint32_t slot;
+    if (level < LORA_TIMER_LEVELS) {
+        slot = timer_digit(timer->expires_ms, level);
+    } else {
+        // beyond the wheel: the top slot that comes round last
+        level = LORA_TIMER_LEVELS - 1;
+        slot = (timer_digit(wheel->now_ms, level) + TIMER_SLOT_MASK) & TIMER_SLOT_MASK;
+    }
+
+    timer->level = level;
+    timer->slot = (uint8_t)slot;
+    timer_link(&wheel->slots[level][slot], timer);
+    wheel->occupied[level] |= 1u << slot;
+}
+
+void lora_timer_wheel_init(LoraTimerWheel *wheel, uint32_t now_ms)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now_ms = now_ms;
+}
+
+void lora_timer_setup(LoraTimer *timer, LoraTimerCallback callback, void *ctx)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = callback;
+    timer->ctx = ctx;
+}
+
+void lora_timer_start(LoraTimerWheel *wheel, LoraTimer *timer, uint32_t expires_ms)
+{
+    lora_timer_stop(wheel, timer);
+    timer->expires_ms = expires_ms;
+    timer_insert(wheel, timer);
+}
+
+void lora_timer_stop(LoraTimerWheel *wheel, LoraTimer *timer)
+{
+    if (!timer->pprev) {
+        return;
+    }
+
+    timer_unlink(timer);
+    if (timer->level < LORA_TIMER_LEVELS && !wheel->slots[timer->level][timer->slot]) {
+        wheel->occupied[timer->level] &= ~(1u << timer->slot);
+    }
+}
+
+void lora_timer_wheel_advance(LoraTimerWheel *wheel, uint32_t now_ms)
+{
+    LoraTimer *todo = NULL;
+    LoraTimer *timer;
+
+    while ((timer = wheel->expired) != NULL) {
+        timer_unlink(timer);
+        timer->level = TIMER_LEVEL_TODO;
+        timer_link(&todo, timer);
+    }
+
+    if ((int32_t)(now_ms - wheel->now_ms) > 0) {
+        // every slot whose turn came between the last advance and now
+        for (uint8_t level = 0; level < LORA_TIMER_LEVELS; level++) {
+            uint8_t shift = level * LORA_TIMER_SLOT_BITS;
+            // slot boundaries crossed, modulo the 32 - shift bits left
+            uint32_t steps = ((now_ms >> shift) - (wheel->now_ms >> shift)) & (UINT32_MAX >> shift);
+            if (!steps) {
+                break;
+            }
+
+            uint32_t due = steps >= LORA_TIMER_SLOTS
+                         ? UINT32_MAX
+                         : rotl32((1u << steps) - 1, (timer_digit(wheel->now_ms, level) + 1) & TIMER_SLOT_MASK);
+            due &= wheel->occupied[level];
+            wheel->occupied[level] &= ~due;
+
+            while (due) {
+                uint8_t slot = (uint8_t)__builtin_ctz(due);
+                due &= due - 1;
+                while ((timer = wheel->slots[level][slot]) != NULL) {
+                    timer_unlink(timer);
+                    timer->level = TIMER_LEVEL_TODO;
+                    timer_link(&todo, timer);
+                }
+            }
+        }
+        wheel->now_ms = now_ms;
+    }
+
+    // callbacks may stop timers still on todo, so take them one at a time
+    while ((timer = todo) != NULL) {
+        timer_unlink(timer);
+        if ((int32_t)(timer->expires_ms - now_ms) <= 0) {
+            timer->callback(timer, timer->ctx);
+        } else {
+            timer_insert(wheel, timer);
+        }
+    }
+}
+
+uint32_t lora_timer_wheel_next_deadline(const LoraTimerWheel *wheel, uint32_t now_ms)
+{
+    if (wheel->expired) {
+        return 0;
+    }
+
+    uint32_t next = UINT32_MAX;   // from wheel->now_ms
+    for (uint8_t level = 0; level < LORA_TIMER_LEVELS; level++) {
+        uint32_t bits = wheel->occupied[level];
+        if (!bits) {
+            continue;
+        }
+
+        // first occupied slot after the current one, a whole turn at most
+        uint8_t shift = level * LORA_TIMER_SLOT_BITS;
+        uint32_t first = (timer_digit(wheel->now_ms, level) + 1) & TIMER_SLOT_MASK;
+        uint32_t steps = (uint32_t)__builtin_ctz(rotr32(bits, first)) + 1;
+        uint32_t at = ((wheel->now_ms >> shift) + steps) << shift;
+        if (at - wheel->now_ms < next) {
+            next = at - wheel->now_ms;
+        }
+    }
+
+    if (next == UINT32_MAX) {
+        return UINT32_MAX;
+    }
+
+    int32_t left = (int32_t)(wheel->now_ms + next - now_ms);
+    return left > 0 ? (uint32_t)left : 0;
+}
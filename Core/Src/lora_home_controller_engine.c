@@ -2,6 +2,9 @@
 #include "LoRa.h"
 #include "lora_engine.h"
 #include "lora_message_types.h"
+#include "lora_profile.h"
+#include "lora_spi_trace.h"
+#include "lora_capture.h"
 #include "stm32g4xx_hal.h"
 #include <string.h>
 
@@ -13,6 +16,36 @@ static uint8_t lora_home_driver_transmit(void * _lora_ctx,
     return LoRa_single_transmit((LoRa *)_lora_ctx, data, length, timeout);
 }
 
+// streaming transmit, same sequence as LoRa_single_transmit() with the frame
+// written into the FIFO piece by piece
+static uint8_t lora_home_driver_transmit_begin(void * _lora_ctx)
+{
+    LoRa *lora = (LoRa *)_lora_ctx;
+    LoRa_gotoMode(lora, TRANSMIT_MODE);
+    HAL_Delay(10);
+    LoRa_transmit_begin(lora);
+    return 1;
+}
+
+static uint8_t lora_home_driver_transmit_write(void * _lora_ctx,
+                                               const uint8_t* data,
+                                               size_t length)
+{
+    LoRa_transmit_write((LoRa *)_lora_ctx, data, (uint8_t)length);
+    return 1;
+}
+
+static uint8_t lora_home_driver_transmit_end(void * _lora_ctx,
+                                             uint8_t length,
+                                             uint16_t timeout)
+{
+    LoRa *lora = (LoRa *)_lora_ctx;
+    uint8_t status = LoRa_transmit_end(lora, length, timeout);
+    HAL_Delay(10);
+    LoRa_startReceiving(lora);
+    return status;
+}
+
 static uint8_t lora_home_driver_receive(void * _lora_ctx, 
                                         uint8_t* data, 
                                         uint8_t length)
@@ -20,6 +53,44 @@ static uint8_t lora_home_driver_receive(void * _lora_ctx,
     return LoRa_receive((LoRa *)_lora_ctx, data, length);
 }
 
+static int lora_home_driver_rssi(void * _lora_ctx)
+{
+    return LoRa_getRSSI((LoRa *)_lora_ctx);
+}
+
+static uint32_t lora_home_driver_time_ms(void)
+{
+    return HAL_GetTick();
+}
+
+// radio noise, different on every boot, mixed with the chip's unique id so
+// two boards that read the same noise still start apart
+static uint32_t lora_home_driver_entropy(void * _lora_ctx)
+{
+    uint32_t uid = HAL_GetUIDw0() ^ HAL_GetUIDw1() * 0x9E3779B9u ^ HAL_GetUIDw2() * 0x85EBCA6Bu;
+    return LoRa_random((LoRa *)_lora_ctx) ^ uid;
+}
+
+// Sleep mode until an event is posted or max_ms has passed, which is the
+// engine's next timer. The 1 ms SysTick that keeps HAL_GetTick() going wakes
+// the core but only to run its handler, the engine is not polled for it.
+// WFI wakes on a pending interrupt even while masked, which closes the gap
+// between the check and the sleep.
+static void lora_home_driver_idle(void * _lora_ctx, LoraEngine *engine, uint32_t max_ms)
+{
+    (void)_lora_ctx;
+    uint32_t start = HAL_GetTick();
+
+    __disable_irq();
+    while (!lora_engine_has_events(engine) && HAL_GetTick() - start < max_ms) {
+        __WFI();
+        // let the interrupt that woke us run, then check again masked
+        __enable_irq();
+        __disable_irq();
+    }
+    __enable_irq();
+}
+
 /**
 * when I receive a ping request, what do I want to do about it?
 * Reply with a ping response
@@ -34,37 +105,49 @@ static void my_simple_ping_req_handler(LoraEngine *engine,
     response.message_type = LORA_PING_RESPONSE;
     response.metadata.dest = meta->source;
     response.metadata.source = engine->local_id;
+    response.metadata.flags = 0;
     response.payload.ping_req._reserved = 0;
 
-    if(!lora_engine_send(engine, &response,  1000))
+    // queued, sent by lora_engine_poll() once this handler has returned
+    if(!lora_engine_queue(engine, &response, LORA_PRIORITY_CONTROL, 1000))
     {
-        // Error sending LoraMessage PingResponse
+        // Error queueing LoraMessage PingResponse
     }
 }
 
-/**
-* If we get a response, send another request, why not.
-*/
-static void my_simple_ping_resp_handler(LoraEngine *engine,
-                                    const LoraPingResp *msg,
-                                    const LoraMetadata *meta)
-{
-    HAL_Delay(1000);
+static LoraTimer ping_timer;
+static NodeId    ping_peer;
 
-    // initiate new request when we receive a response (to a request we've presumably already sent)
+static void my_simple_ping_timer(LoraTimer *timer, void *ctx)
+{
+    (void)timer;
+    LoraEngine *engine = (LoraEngine *)ctx;
     LoraMessage request;
 
     request.message_type = LORA_PING_REQUEST;
-    request.metadata.dest = meta->source;
+    request.metadata.dest = ping_peer;
     request.metadata.source = engine->local_id;
+    request.metadata.flags = 0;
     request.payload.ping_req._reserved = 0;
 
     if(!lora_engine_send(engine, &request,  1000))
     {
-        // Error sending LoraMessage PingResponse
+        // Error sending LoraMessage PingRequest
     }
 }
 
+/**
+* If we get a response, send another request a second later, why not.
+*/
+static void my_simple_ping_resp_handler(LoraEngine *engine,
+                                    const LoraPingResp *msg,
+                                    const LoraMetadata *meta)
+{
+    // initiate new request when we receive a response (to a request we've presumably already sent)
+    ping_peer = meta->source;
+    lora_engine_start_timer(engine, &ping_timer, 1000);
+}
+
 /*
 *   Creates our custom LoraDriver instance
 */
@@ -83,6 +166,10 @@ uint8_t new_lora_home_driver(LoraDriver *driver,
 {
     memset(driver, 0, sizeof(*driver));
 
+    // no-ops unless built with LORA_PROFILE_ENABLED / LORA_SPI_TRACE_ENABLED
+    lora_profile_init();
+    lora_spi_trace_init();
+
     driver->local_id = id;
     *lora_ptr = newLoRaLongRange();
 
@@ -105,7 +192,25 @@ uint8_t new_lora_home_driver(LoraDriver *driver,
     driver->lora_ctx = (void *)lora_ptr;
     driver->receive_ready_flag = 0;
     driver->transmit = lora_home_driver_transmit;
+    driver->transmit_begin = lora_home_driver_transmit_begin;
+    driver->transmit_write = lora_home_driver_transmit_write;
+    driver->transmit_end = lora_home_driver_transmit_end;
     driver->receive = lora_home_driver_receive;
+    driver->get_rssi = lora_home_driver_rssi;
+    driver->get_time_ms = lora_home_driver_time_ms;
+    driver->idle = lora_home_driver_idle;
+    driver->get_entropy = lora_home_driver_entropy;
+
+    // mirror the radio settings LoRa_init() just programmed
+    static const uint32_t bandwidth_hz[] = {
+        7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000
+    };
+    driver->phy.spreading_factor = lora_ptr->spredingFactor;
+    driver->phy.bandwidth_hz     = bandwidth_hz[lora_ptr->bandWidth];
+    driver->phy.coding_rate      = lora_ptr->crcRate;
+    driver->phy.preamble         = lora_ptr->preamble;
+    driver->phy.crc_on           = 1;
+    driver->phy.implicit_header  = 0;
 
     return 1;
 }
@@ -146,9 +251,11 @@ uint8_t new_lora_home_engine(LoraEngine *engine,
     lora_engine_init(engine, driver);
 
     engine->local_id = id;
+    lora_capture_reset(id);
 
     engine->on_ping_req  = my_simple_ping_req_handler;
     engine->on_ping_resp = my_simple_ping_resp_handler;
+    lora_timer_setup(&ping_timer, my_simple_ping_timer, engine);
 
     return 1;
 }
\ No newline at end of file
@@ -4,6 +4,15 @@
 
 #include "lora_message_types.h"
 #include "lora_codec.h"
+#include "lora_lzss.h"
+#include "lora_crc.h"
+#include "lora_dedup.h"
+#include "lora_timer.h"
+#include "lora_route.h"
+#include "lora_engine.h"
+#include "lora_stream.h"
+#include "lora_arena.h"
+#include "lora_climate_batch.h"
 
 #define TEST_STREAM_SIZE 1028
 
@@ -192,6 +201,2152 @@ static int test_stream()
 }
 
 
+static int test_view()
+{
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_SEQUENCE;
+    msg.metadata.source = 8;
+    msg.metadata.dest   = 9;
+
+    LoraStreamSequence *ss = &msg.payload.stream_sequence;
+    ss->stream_type = LORA_STREAM_RAW;
+    ss->stream_id = 3;
+    ss->sequence_number = 0x1234;
+    ss->packet_index = 5;
+    ss->packets_in_sequence = 6;
+    ss->chunk_len = 100;
+    for (int i = 0; i < ss->chunk_len; ++i) {
+        ss->chunk[i] = (uint8_t)(i * 7);
+    }
+
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+
+    LoraMessageView view;
+    if (encoded == 0 || lora_decode_view(buf, encoded, &view) != 0) {
+        printf("VIEW decode FAILED\n");
+        return -1;
+    }
+
+    uint8_t chunk_len;
+    const uint8_t *chunk = lora_view_stream_chunk(&view, &chunk_len);
+
+    if (view.message_type != LORA_STREAM_SEQUENCE ||
+        view.metadata.source != 8 ||
+        view.metadata.dest != 9 ||
+        lora_view_u8(&view, LORA_VIEW_OFF_SEQ_STREAM_ID) != 3 ||
+        lora_view_u16(&view, LORA_VIEW_OFF_SEQ_SEQUENCE) != 0x1234 ||
+        lora_view_u8(&view, LORA_VIEW_OFF_SEQ_PACKET_INDEX) != 5 ||
+        chunk_len != 100 ||
+        chunk < buf || chunk >= buf + encoded ||
+        memcmp(chunk, ss->chunk, chunk_len) != 0) {
+
+        printf("VIEW test MISMATCH\n");
+        return -1;
+    }
+
+    // a truncated chunk must be rejected, like lora_decode does
+    if (lora_decode_view(buf, encoded - 1, &view) == 0) {
+        printf("VIEW truncated frame ACCEPTED\n");
+        return -1;
+    }
+
+    printf("VIEW test PASSED\n");
+    return 0;
+}
+
+
+static int test_sizes()
+{
+    // wire layout from the schema, these are on-air compatibility checks
+    if (LORA_MAX_ENCODED_SIZE != 139 ||
+        LORA_MAX_ENCODED_SIZE_OF(PING_REQUEST) != 4 ||
+        LORA_MAX_ENCODED_SIZE_OF(STREAM_SEQUENCE_ACK) != 4 + 8 ||
+        LORA_MAX_ENCODED_SIZE_OF(ACK) != 4 + 1 ||
+        LORA_VIEW_OFF_CLIMATE_HUMIDITY != 3 ||
+        LORA_VIEW_OFF_SEQ_CHUNK != 7 ||
+        LORA_VIEW_OFF_SEQ_ACK_MISSING != 4) {
+
+        printf("SIZE constants MISMATCH\n");
+        return -1;
+    }
+
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_SEQUENCE;
+    msg.payload.stream_sequence.chunk_len = 42;
+
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t size = lora_encoded_size(&msg);
+    if (size != 3 + 7 + 42 || lora_encode(&msg, buf, sizeof(buf)) != size) {
+        printf("SIZE exact size MISMATCH\n");
+        return -1;
+    }
+
+    // one byte short of the exact size must fail
+    if (lora_encode(&msg, buf, size - 1) != 0) {
+        printf("SIZE short buffer ACCEPTED\n");
+        return -1;
+    }
+
+    msg.payload.stream_sequence.chunk_len = LORA_STREAM_MAX_CHUNK_SIZE + 1;
+    if (lora_encoded_size(&msg) != 0) {
+        printf("SIZE oversized chunk ACCEPTED\n");
+        return -1;
+    }
+
+    printf("SIZE test PASSED\n");
+    return 0;
+}
+
+
+typedef struct {
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t  len;
+    int     writes;
+} TestSink;
+
+static uint8_t test_sink_write(void *ctx, const uint8_t *data, size_t len)
+{
+    TestSink *sink = ctx;
+    if (sink->len + len > sizeof(sink->buf)) {
+        return 0;
+    }
+    memcpy(&sink->buf[sink->len], data, len);
+    sink->len += len;
+    sink->writes++;
+    return 1;
+}
+
+static int test_sink()
+{
+    LoraMessage msgs[3] = {0};
+    msgs[0].message_type = LORA_STREAM_SEQUENCE;
+    msgs[0].payload.stream_sequence.sequence_number = 0x0102;
+    msgs[0].payload.stream_sequence.chunk_len = 50;
+    memset(msgs[0].payload.stream_sequence.chunk, 0xAB, 50);
+    msgs[1].message_type = LORA_DATA;
+    msgs[1].payload.data.data_type = LORA_DATA_TYPE_CLIMATE;
+    msgs[1].payload.data.payload.climate_data.temperature_tenths = -42;
+    msgs[2].message_type = LORA_PING_REQUEST;
+
+    // header + fixed fields in one write, the chunk in a second
+    const int max_writes[3] = { 2, 1, 1 };
+
+    for (int i = 0; i < 3; ++i) {
+        uint8_t buf[LORA_MAX_ENCODED_SIZE];
+        size_t encoded = lora_encode(&msgs[i], buf, sizeof(buf));
+
+        TestSink sink = {0};
+        size_t streamed = lora_encode_to_sink(&msgs[i], test_sink_write, &sink);
+
+        if (encoded == 0 || streamed != encoded || sink.len != encoded ||
+            memcmp(sink.buf, buf, encoded) != 0 || sink.writes > max_writes[i]) {
+
+            printf("SINK test MISMATCH for type %d\n", msgs[i].message_type);
+            return -1;
+        }
+    }
+
+    printf("SINK test PASSED\n");
+    return 0;
+}
+
+
+static int test_packed()
+{
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_SEQUENCE_ACK;
+    msg.metadata.source = 4;
+    msg.metadata.dest   = 5;
+    msg.payload.stream_seq_ack.stream_id = 1;
+    msg.payload.stream_seq_ack.sequence_number = 300;
+    msg.payload.stream_seq_ack.missing_bitmap = 0x80000001u;
+
+    uint8_t storage[LORA_PACKED_MAX_SIZE];
+    LoraPackedMessage *packed = (LoraPackedMessage *)storage;
+
+    size_t size = lora_pack(&msg, packed, sizeof(storage));
+    if (size != LORA_PACKED_SIZE(8) || size >= sizeof(LoraMessage)) {
+        printf("PACKED size MISMATCH (%zu)\n", size);
+        return -1;
+    }
+
+    // too little storage must fail rather than truncate
+    if (lora_pack(&msg, packed, size - 1) != 0) {
+        printf("PACKED short storage ACCEPTED\n");
+        return -1;
+    }
+    lora_pack(&msg, packed, sizeof(storage));
+
+    LoraMessage unpacked = {0};
+    if (lora_unpack(packed, &unpacked) != 0 ||
+        unpacked.message_type != LORA_STREAM_SEQUENCE_ACK ||
+        unpacked.metadata.source != 4 ||
+        unpacked.metadata.dest != 5 ||
+        unpacked.payload.stream_seq_ack.sequence_number != 300 ||
+        unpacked.payload.stream_seq_ack.missing_bitmap != 0x80000001u) {
+
+        printf("PACKED round trip MISMATCH\n");
+        return -1;
+    }
+
+    // the packed frame is the encoded frame
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+    uint8_t frame_len;
+    const uint8_t *frame = lora_packed_frame(packed, &frame_len);
+    if (frame_len != encoded || memcmp(frame, buf, encoded) != 0) {
+        printf("PACKED frame MISMATCH\n");
+        return -1;
+    }
+
+    printf("PACKED test PASSED (LoraMessage %zu bytes, packed %zu bytes)\n",
+           sizeof(LoraMessage), size);
+    return 0;
+}
+
+
+static int test_compact_header()
+{
+    // source, dest, flags, expected header length, the seq byte follows ACK_REQ
+    const struct { NodeId source, dest; uint8_t flags; size_t header; } cases[] = {
+        { 3,   7,                      LORA_FLAG_COMPACT,                     2 },
+        { 3,   LORA_NODE_BROADCAST_ID, LORA_FLAG_COMPACT | LORA_FLAG_ACK_REQ, 3 },
+        { 40,  LORA_NODE_BROADCAST_ID, LORA_FLAG_COMPACT,                     2 },
+        { 40,  7,                      LORA_FLAG_COMPACT | LORA_FLAG_ACK_REQ, 4 },
+        { 3,   7,                      0,                                     3 },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        LoraMessage msg = {0};
+        msg.message_type = LORA_STREAM_ANNOUNCE_ACK;
+        msg.metadata.source = cases[i].source;
+        msg.metadata.dest   = cases[i].dest;
+        msg.metadata.flags  = cases[i].flags;
+        msg.metadata.seq    = 200;
+        msg.payload.stream_announce_ack.stream_id = 9;
+        msg.payload.stream_announce_ack.sequence_number = 513;
+
+        uint8_t buf[LORA_MAX_ENCODED_SIZE];
+        size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+        LoraMessage decoded = {0};
+        LoraMessageView view;
+
+        if (encoded != cases[i].header + 3 ||
+            lora_encoded_size(&msg) != encoded ||
+            lora_decode(buf, encoded, &decoded) != 0 ||
+            lora_decode_view(buf, encoded, &view) != 0 ||
+            decoded.message_type != LORA_STREAM_ANNOUNCE_ACK ||
+            decoded.metadata.source != cases[i].source ||
+            decoded.metadata.dest != cases[i].dest ||
+            decoded.metadata.flags != cases[i].flags ||
+            decoded.metadata.seq != ((cases[i].flags & LORA_FLAG_ACK_REQ) ? 200 : 0) ||
+            decoded.payload.stream_announce_ack.sequence_number != 513 ||
+            view.payload_len != 3 ||
+            lora_view_u16(&view, LORA_VIEW_OFF_ANNOUNCE_ACK_SEQUENCE) != 513) {
+
+            printf("COMPACT header case %zu MISMATCH\n", i);
+            return -1;
+        }
+
+        // a header cut short must be rejected
+        if (lora_decode(buf, cases[i].header - 1, &decoded) == 0) {
+            printf("COMPACT truncated header ACCEPTED\n");
+            return -1;
+        }
+    }
+
+    printf("COMPACT header test PASSED\n");
+    return 0;
+}
+
+
+typedef struct {
+    uint8_t buf[2048];
+    size_t  len;
+} TestBuffer;
+
+static uint8_t test_buffer_write(void *ctx, const uint8_t *data, size_t len)
+{
+    TestBuffer *b = ctx;
+    if (b->len + len > sizeof(b->buf)) {
+        return 0;
+    }
+    memcpy(&b->buf[b->len], data, len);
+    b->len += len;
+    return 1;
+}
+
+static int test_lzss()
+{
+    // log-like text, what RAW streams mostly carry
+    static uint8_t input[1500];
+    size_t input_len = 0;
+    for (int i = 0; input_len + 40 < sizeof(input); ++i) {
+        input_len += (size_t)snprintf((char *)&input[input_len], sizeof(input) - input_len,
+                                      "t=%05d temp=%d hum=%d ok\n", i * 60, 200 + i % 7, 550 - i % 5);
+    }
+
+    static LoraLzssEncoder enc;
+    static TestBuffer packed;
+    packed.len = 0;
+    lora_lzss_encoder_init(&enc);
+
+    // feed in odd sized pieces, like chunks arriving from a sensor
+    for (size_t pos = 0; pos < input_len; pos += 37) {
+        size_t n = input_len - pos < 37 ? input_len - pos : 37;
+        if (!lora_lzss_compress(&enc, &input[pos], n, test_buffer_write, &packed)) {
+            printf("LZSS compress FAILED\n");
+            return -1;
+        }
+    }
+    if (!lora_lzss_finish(&enc, test_buffer_write, &packed)) {
+        printf("LZSS finish FAILED\n");
+        return -1;
+    }
+
+    // decompress chunk by chunk, as the receiver gets them
+    static LoraLzssDecoder dec;
+    static TestBuffer unpacked;
+    unpacked.len = 0;
+    lora_lzss_decoder_init(&dec);
+    for (size_t pos = 0; pos < packed.len; pos += LORA_STREAM_MAX_CHUNK_SIZE) {
+        size_t n = packed.len - pos < LORA_STREAM_MAX_CHUNK_SIZE ? packed.len - pos : LORA_STREAM_MAX_CHUNK_SIZE;
+        if (!lora_lzss_decompress(&dec, &packed.buf[pos], n, test_buffer_write, &unpacked)) {
+            printf("LZSS decompress FAILED\n");
+            return -1;
+        }
+    }
+
+    if (unpacked.len != input_len || memcmp(unpacked.buf, input, input_len) != 0) {
+        printf("LZSS round trip MISMATCH\n");
+        return -1;
+    }
+    if (packed.len * 2 > input_len) {
+        printf("LZSS ratio too low: %zu -> %zu\n", input_len, packed.len);
+        return -1;
+    }
+
+    // the announce flag survives, and is 0 when an old sender leaves it out
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_ANNOUNCE;
+    msg.payload.stream_announce.flags = LORA_STREAM_FLAG_LZSS;
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+    LoraMessage decoded = {0};
+    if (lora_decode(buf, encoded, &decoded) != 0 ||
+        decoded.payload.stream_announce.flags != LORA_STREAM_FLAG_LZSS ||
+        lora_decode(buf, encoded - 1, &decoded) != 0 ||
+        decoded.payload.stream_announce.flags != 0) {
+
+        printf("LZSS announce flag MISMATCH\n");
+        return -1;
+    }
+
+    printf("LZSS test PASSED (%zu -> %zu bytes)\n", input_len, packed.len);
+    return 0;
+}
+
+
+static int test_climate_series()
+{
+    LoraMessage msg = {0};
+    msg.message_type = LORA_DATA;
+    msg.metadata.source = 5;
+    msg.metadata.dest   = 6;
+    msg.payload.data.data_type = LORA_DATA_TYPE_CLIMATE_SERIES;
+
+    ClimateSeries *series = &msg.payload.data.payload.climate_series;
+    series->interval_s = 300;
+    series->sample_count = LORA_CLIMATE_SERIES_MAX_SAMPLES;
+    for (int i = 0; i < LORA_CLIMATE_SERIES_MAX_SAMPLES; ++i) {
+        series->samples[i].temperature_tenths = (int16_t)(-35 + i * 3 - (i % 4) * 5);
+        series->samples[i].humidity_tenths    = (int16_t)(870 - i * 2);
+    }
+    // one large jump, both ways
+    series->samples[10].temperature_tenths = INT16_MAX;
+    series->samples[11].temperature_tenths = INT16_MIN;
+
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+    size_t plain = LORA_HEADER_SIZE + 1 + 3 + LORA_CLIMATE_SERIES_MAX_SAMPLES * 4;
+    if (encoded == 0 || encoded != lora_encoded_size(&msg) || encoded >= plain) {
+        printf("SERIES encode FAILED (%zu bytes)\n", encoded);
+        return -1;
+    }
+
+    LoraMessage decoded = {0};
+    LoraMessageView view;
+    if (lora_decode(buf, encoded, &decoded) != 0 ||
+        lora_decode_view(buf, encoded, &view) != 0) {
+        printf("SERIES decode FAILED\n");
+        return -1;
+    }
+    const ClimateSeries *out = &decoded.payload.data.payload.climate_series;
+    if (out->interval_s != 300 || out->sample_count != series->sample_count ||
+        memcmp(out->samples, series->samples, sizeof(series->samples)) != 0) {
+        printf("SERIES test MISMATCH\n");
+        return -1;
+    }
+
+    // every truncation must be rejected, by both decoders
+    for (size_t len = LORA_HEADER_SIZE; len < encoded; ++len) {
+        if (lora_decode(buf, len, &decoded) == 0 || lora_decode_view(buf, len, &view) == 0) {
+            printf("SERIES truncated frame ACCEPTED at %zu\n", len);
+            return -1;
+        }
+    }
+
+    // too noisy to fit the frame
+    for (int i = 0; i < LORA_CLIMATE_SERIES_MAX_SAMPLES; ++i) {
+        series->samples[i].temperature_tenths = (int16_t)(i % 2 ? 20000 : -20000);
+        series->samples[i].humidity_tenths    = (int16_t)(i % 2 ? -20000 : 20000);
+    }
+    if (lora_encoded_size(&msg) != 0 || lora_encode(&msg, buf, sizeof(buf)) != 0) {
+        printf("SERIES oversized series ACCEPTED\n");
+        return -1;
+    }
+
+    printf("SERIES test PASSED (%zu bytes for %d readings)\n", encoded, LORA_CLIMATE_SERIES_MAX_SAMPLES);
+    return 0;
+}
+
+
+static uint8_t  test_batch_radio_ok;
+static uint32_t test_batch_frames;
+
+static uint8_t test_batch_transmit(void *ctx, uint8_t *data, uint8_t len, uint16_t timeout)
+{
+    (void)ctx; (void)data; (void)len; (void)timeout;
+    test_batch_frames += test_batch_radio_ok;
+    return test_batch_radio_ok;
+}
+
+static int test_climate_batch()
+{
+    static LoraEngine engine;
+    static LoraClimateBatch batch;
+    LoraDriver driver = {0};
+    driver.local_id = 5;
+    driver.transmit = test_batch_transmit;
+    lora_engine_init(&engine, &driver);
+
+    // max_samples readings make a batch
+    ClimateData reading = { 215, 480 };
+    lora_climate_batch_init(&batch, 60, 3, 0);
+    for (int i = 0; i < 3; i++) {
+        if (lora_climate_batch_due(&batch, 0) || !lora_climate_batch_add(&batch, &reading, 0)) {
+            printf("BATCH max_samples FAILED at %d\n", i);
+            return -1;
+        }
+    }
+    if (!lora_climate_batch_due(&batch, 0) || lora_climate_batch_add(&batch, &reading, 0)) {
+        printf("BATCH max_samples FAILED: not due at 3\n");
+        return -1;
+    }
+
+    // large deltas: due once one more reading might not fit the frame,
+    // well before LORA_CLIMATE_SERIES_MAX_SAMPLES, and what it holds encodes
+    lora_climate_batch_init(&batch, 60, 0, 0);
+    uint8_t added = 0;
+    while (!lora_climate_batch_due(&batch, 0)) {
+        reading.temperature_tenths = (int16_t)(added % 2 ? INT16_MAX : INT16_MIN);
+        reading.humidity_tenths    = (int16_t)(added % 2 ? INT16_MIN : INT16_MAX);
+        if (!lora_climate_batch_add(&batch, &reading, 0)) {
+            printf("BATCH byte limit FAILED: refused before due\n");
+            return -1;
+        }
+        added++;
+    }
+    if (added >= LORA_CLIMATE_SERIES_MAX_SAMPLES ||
+        lora_climate_batch_add(&batch, &reading, 0) ||
+        lora_climate_series_sample_bytes(&batch.series) > LORA_CLIMATE_SERIES_MAX_SAMPLE_BYTES) {
+        printf("BATCH byte limit FAILED: %u readings, %zu bytes\n",
+               (unsigned)added, lora_climate_series_sample_bytes(&batch.series));
+        return -1;
+    }
+
+    // a failed send keeps the readings for the next try
+    test_batch_radio_ok = 0;
+    test_batch_frames = 0;
+    if (lora_climate_batch_flush(&batch, &engine, 1, 1000) || batch.series.sample_count != added) {
+        printf("BATCH failed flush FAILED: %u readings left\n", (unsigned)batch.series.sample_count);
+        return -1;
+    }
+    test_batch_radio_ok = 1;
+    if (!lora_climate_batch_flush(&batch, &engine, 1, 1000) || batch.series.sample_count != 0 ||
+        test_batch_frames != 1 || lora_climate_batch_due(&batch, 0) ||
+        !lora_climate_batch_flush(&batch, &engine, 1, 1000) || test_batch_frames != 1) {
+        printf("BATCH flush FAILED: %u frames\n", (unsigned)test_batch_frames);
+        return -1;
+    }
+
+    // max_age_ms from the first reading, across the u32 wrap
+    uint32_t first = UINT32_MAX - 400;
+    reading.temperature_tenths = 215;
+    reading.humidity_tenths = 480;
+    lora_climate_batch_init(&batch, 60, 0, 1000);
+    lora_climate_batch_add(&batch, &reading, first);
+    lora_climate_batch_add(&batch, &reading, first + 500);
+    if (lora_climate_batch_due(&batch, first + 999) || !lora_climate_batch_due(&batch, first + 1000)) {
+        printf("BATCH max_age FAILED\n");
+        return -1;
+    }
+
+    printf("BATCH test PASSED (%u readings of large deltas)\n", (unsigned)added);
+    return 0;
+}
+
+
+static int test_aggregate()
+{
+    LoraMessage parts[3] = {0};
+    parts[0].message_type = LORA_PING_RESPONSE;
+    parts[1].message_type = LORA_COMMAND_RESPONSE;
+    parts[1].payload.command_resp.command_type = LORA_COMMAND_SET_VALUE;
+    parts[1].payload.command_resp.command_status = LORA_COMMAND_SUCCESS;
+    parts[2].message_type = LORA_DATA;
+    parts[2].payload.data.data_type = LORA_DATA_TYPE_CLIMATE;
+    parts[2].payload.data.payload.climate_data.temperature_tenths = -42;
+    parts[2].payload.data.payload.climate_data.humidity_tenths = 611;
+
+    LoraMessage msg = {0};
+    msg.message_type = LORA_AGGREGATE;
+    msg.metadata.source = 7;
+    msg.metadata.dest   = 1;
+
+    size_t separate = 0;
+    for (int i = 0; i < 3; ++i) {
+        separate += lora_encoded_size(&parts[i]);
+        if (lora_aggregate_append(&msg.payload.aggregate, &parts[i]) == 0) {
+            printf("AGGREGATE append FAILED\n");
+            return -1;
+        }
+    }
+
+    // no nesting, and a full stream sequence never fits
+    LoraMessage big = {0};
+    big.message_type = LORA_STREAM_SEQUENCE;
+    big.payload.stream_sequence.chunk_len = LORA_STREAM_MAX_CHUNK_SIZE;
+    if (lora_aggregate_append(&msg.payload.aggregate, &msg) != 0 ||
+        lora_aggregate_append(&msg.payload.aggregate, &big) != 0) {
+        printf("AGGREGATE bad append ACCEPTED\n");
+        return -1;
+    }
+
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+    LoraMessage decoded = {0};
+    if (encoded == 0 || encoded > separate || lora_decode(buf, encoded, &decoded) != 0) {
+        printf("AGGREGATE encode/decode FAILED\n");
+        return -1;
+    }
+
+    // an entry header costs what a frame header does, the saving is the
+    // preamble and radio header of every frame but one
+    static const LoraPhyParams phy = { 7, 125000, 1, 8, 1, 0 };
+    uint32_t separate_us = 0;
+    for (int i = 0; i < 3; ++i) {
+        separate_us += lora_airtime_us(&phy, (uint8_t)lora_encoded_size(&parts[i]));
+    }
+    uint32_t aggregate_us = lora_airtime_us(&phy, (uint8_t)encoded);
+    if (aggregate_us * 3 > separate_us * 2) {
+        printf("AGGREGATE airtime FAILED: %u us instead of %u us\n",
+               (unsigned)aggregate_us, (unsigned)separate_us);
+        return -1;
+    }
+
+    LoraMessage entry;
+    size_t pos = 0;
+    int count = 0;
+    while (lora_aggregate_next(&decoded, &pos, &entry)) {
+        if (entry.message_type != parts[count].message_type ||
+            entry.metadata.source != 7 || entry.metadata.dest != 1) {
+            printf("AGGREGATE entry %d MISMATCH\n", count);
+            return -1;
+        }
+        count++;
+    }
+    if (count != 3 ||
+        entry.payload.data.payload.climate_data.temperature_tenths != -42 ||
+        entry.payload.data.payload.climate_data.humidity_tenths != 611) {
+        printf("AGGREGATE entries MISMATCH\n");
+        return -1;
+    }
+
+    // an entry cut short by the frame ends the walk before it
+    if (lora_decode(buf, encoded - 1, &decoded) != 0) {
+        printf("AGGREGATE truncated decode FAILED\n");
+        return -1;
+    }
+    pos = 0;
+    count = 0;
+    while (lora_aggregate_next(&decoded, &pos, &entry)) {
+        count++;
+    }
+    if (count != 2) {
+        printf("AGGREGATE truncated entry ACCEPTED\n");
+        return -1;
+    }
+
+    printf("AGGREGATE test PASSED (1 frame of %zu bytes, %u us, instead of 3 frames, %zu bytes, %u us)\n",
+           encoded, (unsigned)aggregate_us, separate, (unsigned)separate_us);
+    return 0;
+}
+
+
+static int test_raw()
+{
+    LoraMessage msg = {0};
+    msg.message_type = LORA_RAW;
+    msg.metadata.source = 3;
+    msg.metadata.dest   = 4;
+    msg.payload.raw.data_len = 10;
+    for (int i = 0; i < 10; ++i) {
+        msg.payload.raw.data[i] = (uint8_t)(0xA0 + i);
+    }
+
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+    if (encoded != LORA_HEADER_SIZE + 10) {
+        printf("RAW encode FAILED (%zu bytes)\n", encoded);
+        return -1;
+    }
+
+    LoraMessage decoded = {0};
+    LoraMessageView view;
+    if (lora_decode(buf, encoded, &decoded) != 0 ||
+        decoded.payload.raw.data_len != 10 ||
+        memcmp(decoded.payload.raw.data, msg.payload.raw.data, 10) != 0 ||
+        lora_decode_view(buf, encoded, &view) != 0 ||
+        view.payload_len != 10 || lora_view_raw(&view)[9] != 0xA9) {
+        printf("RAW test MISMATCH\n");
+        return -1;
+    }
+
+    // empty is fine, more than a chunk is not
+    msg.payload.raw.data_len = 0;
+    if (lora_encode(&msg, buf, sizeof(buf)) != LORA_HEADER_SIZE ||
+        lora_decode(buf, LORA_HEADER_SIZE, &decoded) != 0 ||
+        decoded.payload.raw.data_len != 0) {
+        printf("RAW empty FAILED\n");
+        return -1;
+    }
+    msg.payload.raw.data_len = LORA_STREAM_MAX_CHUNK_SIZE + 1;
+    if (lora_encode(&msg, buf, sizeof(buf)) != 0) {
+        printf("RAW oversized ACCEPTED\n");
+        return -1;
+    }
+
+    printf("RAW test PASSED\n");
+    return 0;
+}
+
+
+static int test_crc()
+{
+    const uint8_t check[] = "123456789";
+    if (lora_crc32(check, 9) != 0xCBF43926u) {
+        printf("CRC check value MISMATCH: %08x\n", lora_crc32(check, 9));
+        return -1;
+    }
+
+    // chunk by chunk, in odd sizes, gives the same CRC as one pass
+    static uint8_t image[1000];
+    for (size_t i = 0; i < sizeof(image); ++i) {
+        image[i] = (uint8_t)(i * 7 + (i >> 3));
+    }
+    uint32_t crc = lora_crc32_init();
+    for (size_t pos = 0; pos < sizeof(image); pos += 123) {
+        size_t n = sizeof(image) - pos < 123 ? sizeof(image) - pos : 123;
+        crc = lora_crc32_update(crc, &image[pos], n);
+    }
+    if (lora_crc32_final(crc) != lora_crc32(image, sizeof(image))) {
+        printf("CRC incremental MISMATCH\n");
+        return -1;
+    }
+
+    // carried in LORA_STREAM_COMPLETE, absent from older senders
+    LoraMessage msg = {0};
+    msg.message_type = LORA_STREAM_COMPLETE;
+    msg.payload.stream_complete.stream_id = 9;
+    msg.payload.stream_complete.crc32 = lora_crc32_final(crc);
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+    LoraMessage decoded = {0};
+    LoraMessageView view;
+    if (lora_decode(buf, encoded, &decoded) != 0 ||
+        decoded.payload.stream_complete.crc32 != msg.payload.stream_complete.crc32 ||
+        lora_decode_view(buf, encoded, &view) != 0 ||
+        lora_view_complete_crc32(&view) != msg.payload.stream_complete.crc32) {
+        printf("CRC stream complete MISMATCH\n");
+        return -1;
+    }
+    if (lora_decode(buf, LORA_HEADER_SIZE + 1, &decoded) != 0 ||
+        decoded.payload.stream_complete.crc32 != 0 ||
+        lora_decode(buf, encoded - 1, &decoded) == 0 ||
+        lora_decode_view(buf, encoded - 1, &view) == 0) {
+        printf("CRC optional field FAILED\n");
+        return -1;
+    }
+
+    printf("CRC test PASSED\n");
+    return 0;
+}
+
+
+static int test_dedup()
+{
+    static LoraDedup dedup;
+    lora_dedup_init(&dedup, 1000);
+
+    if (sizeof(dedup) >= 1024) {
+        printf("DEDUP cache too large: %zu bytes\n", sizeof(dedup));
+        return -1;
+    }
+
+    // first sight passes, the retransmission is caught, other keys pass
+    if (lora_dedup_check(&dedup, 5, 100, 0) != 0 ||
+        lora_dedup_check(&dedup, 5, 100, 300) != 1 ||
+        lora_dedup_check(&dedup, 6, 100, 300) != 0 ||
+        lora_dedup_check(&dedup, 5, 101, 300) != 0) {
+        printf("DEDUP check FAILED\n");
+        return -1;
+    }
+
+    // forgotten after expiry_ms
+    if (lora_dedup_check(&dedup, 5, 100, 1000) != 0 ||
+        lora_dedup_check(&dedup, 5, 100, 1001) != 1) {
+        printf("DEDUP expiry FAILED\n");
+        return -1;
+    }
+
+    // a full set gives up its oldest entry, in the same set as (5, 100)
+    if (lora_dedup_check(&dedup, 5, 100 + LORA_DEDUP_SETS, 1100) != 0 ||
+        lora_dedup_check(&dedup, 5, 100 + 2 * LORA_DEDUP_SETS, 1100) != 0 ||
+        lora_dedup_check(&dedup, 5, 100 + LORA_DEDUP_SETS, 1300) != 1 ||
+        lora_dedup_check(&dedup, 5, 100, 1300) != 0) {
+        printf("DEDUP replacement FAILED\n");
+        return -1;
+    }
+
+    printf("DEDUP test PASSED (%zu bytes)\n", sizeof(dedup));
+    return 0;
+}
+
+
+static int test_routed()
+{
+    LoraMessage cmd = {0};
+    cmd.message_type = LORA_COMMAND_REQUEST;
+    cmd.metadata.source = 1;
+    cmd.metadata.dest   = 9;
+    cmd.payload.command_req.command_type = LORA_COMMAND_SET_VALUE;
+    cmd.payload.command_req.command_value.value = 3;
+
+    // hop 1 -> 4 of a trip from 1 to 9
+    LoraMessage msg = {0};
+    msg.message_type = LORA_ROUTED;
+    msg.metadata.source = 1;
+    msg.metadata.dest   = 4;
+    if (lora_routed_wrap(&msg.payload.routed, &cmd, LORA_ROUTE_MAX_HOPS) == 0 ||
+        lora_routed_wrap(&msg.payload.routed, &msg, LORA_ROUTE_MAX_HOPS) != 0) {
+        printf("ROUTED wrap FAILED\n");
+        return -1;
+    }
+    msg.payload.routed.seq = 77;
+
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t encoded = lora_encode(&msg, buf, sizeof(buf));
+    LoraMessage decoded = {0};
+    LoraMessage inner = {0};
+    if (encoded == 0 || lora_decode(buf, encoded, &decoded) != 0 ||
+        !lora_routed_unwrap(&decoded, &inner)) {
+        printf("ROUTED encode/decode FAILED\n");
+        return -1;
+    }
+    if (decoded.payload.routed.ttl != LORA_ROUTE_MAX_HOPS || decoded.payload.routed.hops != 0 ||
+        decoded.payload.routed.seq != 77 ||
+        inner.message_type != LORA_COMMAND_REQUEST ||
+        inner.metadata.source != 1 || inner.metadata.dest != 9 ||
+        inner.payload.command_req.command_value.value != 3) {
+        printf("ROUTED inner MISMATCH\n");
+        return -1;
+    }
+
+    // neighbours first, then the way to 9 through 4, kept against a longer
+    // one through 5 until it goes quiet
+    static LoraRouteTable table;
+    lora_route_init(&table, 1000);
+    lora_route_learn(&table, 4, 4, 1, 0);
+    lora_route_learn(&table, 9, 4, 2, 0);
+    lora_route_learn(&table, 9, 5, 3, 500);
+    const LoraRouteEntry *route = lora_route_lookup(&table, 9, 500);
+    if (!route || route->next_hop != 4 || route->hops != 2) {
+        printf("ROUTE table FAILED\n");
+        return -1;
+    }
+    lora_route_learn(&table, 9, 5, 3, 1200);
+    route = lora_route_lookup(&table, 9, 1200);
+    if (!route || route->next_hop != 5 || lora_route_lookup(&table, 4, 1200) != NULL) {
+        printf("ROUTE expiry FAILED\n");
+        return -1;
+    }
+    lora_route_forget_hop(&table, 5);
+    if (lora_route_lookup(&table, 9, 1200) != NULL) {
+        printf("ROUTE forget FAILED\n");
+        return -1;
+    }
+
+    printf("ROUTED test PASSED (%zu bytes, table %zu bytes)\n", encoded, sizeof(table));
+    return 0;
+}
+
+static LoraTimerWheel test_wheel;
+static uint32_t       test_fired_ms[4];
+
+static void test_timer_fired(LoraTimer *timer, void *ctx)
+{
+    (void)timer;
+    test_fired_ms[(uintptr_t)ctx] = test_wheel.now_ms;
+}
+
+static int test_timer_wheel()
+{
+    // from just below the 32 bit wrap, delays in each level and past the wheel
+    static const uint32_t delay_ms[4] = { 7, 1000, 40000, 3000000 };
+    const uint32_t start = UINT32_MAX - 500;
+    LoraTimer timers[4];
+    LoraTimer stopped;
+
+    lora_timer_wheel_init(&test_wheel, start);
+    for (uintptr_t i = 0; i < 4; i++) {
+        lora_timer_setup(&timers[i], test_timer_fired, (void *)i);
+        lora_timer_start(&test_wheel, &timers[i], start + delay_ms[i]);
+        test_fired_ms[i] = 0;
+    }
+    lora_timer_setup(&stopped, test_timer_fired, (void *)0);
+    lora_timer_start(&test_wheel, &stopped, start + 3);
+    lora_timer_stop(&test_wheel, &stopped);
+
+    if (lora_timer_wheel_next_deadline(&test_wheel, start) != delay_ms[0]) {
+        printf("TIMER next deadline FAILED\n");
+        return -1;
+    }
+
+    // sleep to each deadline, as lora_engine_loop() does; every timer fires
+    // on its millisecond and the stopped one never does
+    uint32_t now = start;
+    uint32_t wakeups = 0;
+    while (lora_timer_running(&timers[3])) {
+        uint32_t left = lora_timer_wheel_next_deadline(&test_wheel, now);
+        if (left == UINT32_MAX || wakeups++ > 100) {
+            printf("TIMER wheel lost a timer\n");
+            return -1;
+        }
+        now += left;
+        lora_timer_wheel_advance(&test_wheel, now);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (test_fired_ms[i] != start + delay_ms[i] || lora_timer_running(&timers[i])) {
+            printf("TIMER %d fired at %u, expected %u\n",
+                   i, (unsigned)(test_fired_ms[i] - start), (unsigned)delay_ms[i]);
+            return -1;
+        }
+    }
+
+    // a jump far past a timer still fires it, once
+    test_fired_ms[0] = 0;
+    lora_timer_start(&test_wheel, &timers[0], now + 5000);
+    lora_timer_wheel_advance(&test_wheel, now + 3600000);
+    if (test_fired_ms[0] != now + 3600000 || lora_timer_wheel_next_deadline(&test_wheel, now) != UINT32_MAX) {
+        printf("TIMER jump FAILED\n");
+        return -1;
+    }
+
+    printf("TIMER wheel test PASSED (%u wakeups, %zu bytes)\n", (unsigned)wakeups, sizeof(test_wheel));
+    return 0;
+}
+
+static uint32_t test_clock_ms;
+static uint32_t test_entropy_bits;
+
+static uint32_t test_clock(void)
+{
+    return test_clock_ms;
+}
+
+static uint32_t test_entropy(void *ctx)
+{
+    (void)ctx;
+    return test_entropy_bits;
+}
+
+static int test_engine_seed()
+{
+    // the same node booting again and again at the same tick, only the
+    // radio noise differs: its first seq to a peer, and of its floods,
+    // must not repeat
+    static LoraEngine engine;
+    LoraDriver driver = {0};
+    driver.local_id    = 3;
+    driver.get_time_ms = test_clock;
+    driver.get_entropy = test_entropy;
+    test_clock_ms = 1234;
+
+    int previous = -1;
+    int previous_flood = -1;
+    for (uint32_t boot = 0; boot < 8; boot++) {
+        test_entropy_bits = boot * 0x6D2B79F5u;
+        lora_engine_init(&engine, &driver);
+        uint8_t first = lora_reliable_next_seq(&engine.reliable, 7, test_clock_ms);
+        uint8_t first_flood = lora_flood_next_seq(&engine.flood);
+        if (first == previous || first_flood == previous_flood) {
+            printf("ENGINE seed FAILED: boot %u repeated first seq %u / flood %u\n",
+                   (unsigned)boot, (unsigned)first, (unsigned)first_flood);
+            return -1;
+        }
+        previous = first;
+        previous_flood = first_flood;
+    }
+
+    printf("ENGINE seed test PASSED\n");
+    return 0;
+}
+
+static uint32_t test_idle_calls;
+static uint32_t test_idle_ms[4];
+static uint32_t test_timer_fired_at;
+static uint32_t test_received;
+
+// sleeps the whole max_ms
+static void test_idle(void *ctx, LoraEngine *engine, uint32_t max_ms)
+{
+    (void)ctx; (void)engine;
+    if (test_idle_calls < 4) {
+        test_idle_ms[test_idle_calls] = max_ms;
+    }
+    test_idle_calls++;
+    test_clock_ms += max_ms;
+}
+
+static void test_event_timer(LoraTimer *timer, void *ctx)
+{
+    (void)timer; (void)ctx;
+    test_timer_fired_at = test_clock_ms;
+}
+
+static uint8_t test_event_receive(void *ctx, uint8_t *data, uint8_t length)
+{
+    (void)ctx; (void)data; (void)length;
+    test_received++;
+    return 0;
+}
+
+static int test_engine_events()
+{
+    static LoraEngine engine;
+    static LoraTimer timer;
+    static LoraDriver driver;
+    memset(&driver, 0, sizeof(driver));
+    driver.local_id    = 2;
+    driver.get_time_ms = test_clock;
+    driver.receive     = test_event_receive;
+    driver.idle        = test_idle;
+    test_clock_ms = 5000;
+    lora_engine_init(&engine, &driver);
+
+    // the ring holds one less than its size, the rest is dropped and counted
+    for (int i = 0; i < LORA_EVENT_QUEUE_SIZE - 1; i++) {
+        if (!lora_engine_post_event(&engine, LORA_EVENT_TX_DONE)) {
+            printf("ENGINE event post FAILED at %d\n", i);
+            return -1;
+        }
+    }
+    if (lora_engine_post_event(&engine, LORA_EVENT_TIMER) || engine.event_overflows != 1 ||
+        !lora_engine_has_events(&engine) ||
+        lora_engine_poll(&engine) != LORA_EVENT_QUEUE_SIZE - 1 || lora_engine_has_events(&engine)) {
+        printf("ENGINE event overflow FAILED\n");
+        return -1;
+    }
+
+    // round and round the ring, and the old receive_ready_flag is an RX_DONE
+    test_received = 0;
+    for (int i = 0; i < 3 * LORA_EVENT_QUEUE_SIZE; i++) {
+        lora_engine_post_event(&engine, LORA_EVENT_RX_DONE);
+        if (lora_engine_poll(&engine) != 1) {
+            printf("ENGINE event wrap FAILED at %d\n", i);
+            return -1;
+        }
+    }
+    driver.receive_ready_flag = 1;
+    if (!lora_engine_has_events(&engine) || lora_engine_poll(&engine) != 1 ||
+        driver.receive_ready_flag || test_received != 3 * LORA_EVENT_QUEUE_SIZE + 1) {
+        printf("ENGINE receive flag FAILED: %u received\n", (unsigned)test_received);
+        return -1;
+    }
+
+    // run_until sleeps to the timer, maybe waking once more where the wheel
+    // cascades, runs it, then sleeps to the deadline
+    lora_timer_setup(&timer, test_event_timer, NULL);
+    lora_engine_start_timer(&engine, &timer, 200);
+    test_idle_calls = 0;
+    test_timer_fired_at = 0;
+    lora_engine_run_until(&engine, 5500);
+    if (test_timer_fired_at != 5200 || test_clock_ms != 5500 ||
+        test_idle_calls < 2 || test_idle_calls > 3 || test_idle_ms[test_idle_calls - 1] != 300) {
+        printf("ENGINE run_until FAILED: timer at %u, clock %u, %u sleeps\n",
+               (unsigned)test_timer_fired_at, (unsigned)test_clock_ms, (unsigned)test_idle_calls);
+        return -1;
+    }
+
+    // nothing to sleep through with an event waiting, nor past the deadline
+    lora_engine_post_event(&engine, LORA_EVENT_TX_DONE);
+    driver.receive_ready_flag = 1;
+    test_idle_calls = 0;
+    lora_engine_run_until(&engine, 5500);
+    lora_engine_run_until(&engine, 5400);
+    if (test_idle_calls != 0 || !lora_engine_has_events(&engine)) {
+        printf("ENGINE idle past deadline FAILED\n");
+        return -1;
+    }
+    lora_engine_run_until(&engine, 5501);
+    if (test_idle_calls != 1 || test_clock_ms != 5501 || lora_engine_has_events(&engine)) {
+        printf("ENGINE idle with events FAILED\n");
+        return -1;
+    }
+
+    printf("ENGINE events test PASSED\n");
+    return 0;
+}
+
+// Nodes on a simulated channel for the engine tests. Node i is id i + 1
+// and hears the nodes marked in test_range; a frame on air advances the
+// clock by its time on air, test_run() by a ms per round of polls.
+
+#define TEST_NODES 4
+#define TEST_INBOX 4
+
+typedef struct {
+    LoraEngine engine;
+    LoraDriver driver;
+    uint8_t    inbox[TEST_INBOX][LORA_MAX_ENCODED_SIZE];
+    uint8_t    inbox_len[TEST_INBOX];
+    uint8_t    inbox_head;
+    uint8_t    inbox_count;
+    uint32_t   sent;           // frames put on air
+    uint32_t   sent_ms;        // when the last one went
+    uint8_t    sent_type;      // and its LoraMessageType
+    int        drop;           // frames of ours lost on the way, -1 all
+    int        corrupt;        // stream packets of ours to damage on the way
+} TestNode;
+
+static TestNode test_nodes[TEST_NODES];
+static uint8_t  test_range[TEST_NODES][TEST_NODES];
+static uint32_t test_loss_pct;
+static uint32_t test_loss_rng;
+
+static uint8_t test_node_transmit(void *ctx, uint8_t *data, uint8_t len, uint16_t timeout)
+{
+    (void)timeout;
+    TestNode *node = (TestNode *)ctx;
+    int from = (int)(node - test_nodes);
+
+    test_clock_ms += (lora_airtime_us(&node->driver.phy, len) + 999) / 1000;
+    node->sent++;
+    node->sent_ms = test_clock_ms;
+    LoraMessageType type;
+    LoraMetadata meta;
+    node->sent_type = lora_decode_header(data, len, &type, &meta) ? (uint8_t)type : UINT8_MAX;
+
+    if (node->drop) {
+        if (node->drop > 0) {
+            node->drop--;
+        }
+        return 1;
+    }
+    if (node->corrupt && node->sent_type == LORA_STREAM_SEQUENCE) {
+        // one flipped bit the radio's own CRC missed, in the chunk's last byte
+        data[len - 1] ^= 0x10;
+        node->corrupt--;
+    }
+
+    for (int to = 0; to < TEST_NODES; to++) {
+        TestNode *peer = &test_nodes[to];
+        test_loss_rng = test_loss_rng * 1103515245u + 12345u;
+        if (!test_range[from][to] || (test_loss_rng >> 16) % 100 < test_loss_pct ||
+            peer->inbox_count == TEST_INBOX) {
+            continue;
+        }
+        uint8_t slot = (uint8_t)((peer->inbox_head + peer->inbox_count++) % TEST_INBOX);
+        memcpy(peer->inbox[slot], data, len);
+        peer->inbox_len[slot] = len;
+        lora_engine_post_event(&peer->engine, LORA_EVENT_RX_DONE);
+    }
+    return 1;
+}
+
+static uint8_t test_node_receive(void *ctx, uint8_t *data, uint8_t length)
+{
+    TestNode *node = (TestNode *)ctx;
+    if (!node->inbox_count) {
+        return 0;
+    }
+
+    uint8_t len = node->inbox_len[node->inbox_head];
+    if (len > length) {
+        len = length;
+    }
+    memcpy(data, node->inbox[node->inbox_head], len);
+    node->inbox_head = (uint8_t)((node->inbox_head + 1) % TEST_INBOX);
+    node->inbox_count--;
+    return len;
+}
+
+// count nodes in range of each other, SF7 at 125 kHz
+static void test_net_init(int count)
+{
+    static const LoraPhyParams phy = { 7, 125000, 1, 8, 1, 0 };
+
+    memset(test_nodes, 0, sizeof(test_nodes));
+    memset(test_range, 0, sizeof(test_range));
+    test_clock_ms = 1000;
+    test_loss_pct = 0;
+    test_loss_rng = 1;
+
+    for (int i = 0; i < count; i++) {
+        TestNode *node = &test_nodes[i];
+        for (int j = 0; j < count; j++) {
+            test_range[i][j] = i != j;
+        }
+        node->driver.local_id    = (NodeId)(i + 1);
+        node->driver.transmit    = test_node_transmit;
+        node->driver.receive     = test_node_receive;
+        node->driver.lora_ctx    = node;
+        node->driver.get_time_ms = test_clock;
+        node->driver.phy         = phy;
+        lora_engine_init(&node->engine, &node->driver);
+        node->engine.local_id = node->driver.local_id;
+    }
+}
+
+static void test_run(uint32_t ms)
+{
+    for (uint32_t i = 0; i < ms; i++) {
+        for (int n = 0; n < TEST_NODES; n++) {
+            if (test_nodes[n].driver.transmit) {
+                lora_engine_poll(&test_nodes[n].engine);
+            }
+        }
+        test_clock_ms++;
+    }
+}
+
+static int      test_delivered[TEST_NODES];   // on_delivery outcome, -1 none yet
+static uint32_t test_commands[TEST_NODES];    // command requests handled
+
+static void test_on_delivery(LoraEngine *engine, NodeId dest, uint8_t seq, uint8_t delivered)
+{
+    (void)dest; (void)seq;
+    test_delivered[engine->local_id - 1] = delivered;
+}
+
+static void test_on_command(LoraEngine *engine, const LoraCommandReq *msg, const LoraMetadata *meta)
+{
+    (void)msg; (void)meta;
+    test_commands[engine->local_id - 1]++;
+}
+
+static int test_reliable()
+{
+    static LoraReliable rel;
+    lora_reliable_init(&rel, 1);
+
+    // seqs run on per dest
+    uint8_t seq5 = lora_reliable_next_seq(&rel, 5, 0);
+    uint8_t seq6 = lora_reliable_next_seq(&rel, 6, 0);
+    if (lora_reliable_next_seq(&rel, 5, 0) != (uint8_t)(seq5 + 1) ||
+        lora_reliable_next_seq(&rel, 6, 0) != (uint8_t)(seq6 + 1)) {
+        printf("RELIABLE seq FAILED\n");
+        return -1;
+    }
+
+    // no RTT sample yet: twice the minimum, doubled per retry, up to half
+    // again of jitter, capped
+    LoraReliablePending *p = lora_reliable_slot(&rel);
+    p->in_use  = 1;
+    p->dest    = 5;
+    p->seq     = lora_reliable_next_seq(&rel, 5, 1000);
+    p->sent_ms = 1000;
+    p->first_sent_ms = 1000;
+    uint32_t jitters = 0;
+    uint32_t last = 0;
+    for (uint8_t retries = 0; retries <= LORA_RELIABLE_MAX_RETRIES; retries++) {
+        uint32_t rto = 200u << retries;
+        p->retries = retries;
+        lora_reliable_arm(&rel, p, 100);
+        uint32_t wait = p->retry_at_ms - p->sent_ms;
+        if (wait < rto || wait > rto + rto / 2) {
+            printf("RELIABLE backoff FAILED: retry %u waits %u ms\n", (unsigned)retries, (unsigned)wait);
+            return -1;
+        }
+        jitters += wait - rto != last;
+        last = wait - rto;
+    }
+    p->retries = 9;
+    lora_reliable_arm(&rel, p, 10000);
+    if (p->retry_at_ms - p->sent_ms < LORA_RELIABLE_MAX_RTO_MS ||
+        p->retry_at_ms - p->sent_ms > LORA_RELIABLE_MAX_RTO_MS * 3 / 2 || jitters < 3) {
+        printf("RELIABLE cap/jitter FAILED\n");
+        return -1;
+    }
+    if (lora_reliable_due(&rel, p->retry_at_ms - 1) != NULL ||
+        lora_reliable_due(&rel, p->retry_at_ms) != p ||
+        lora_reliable_next_deadline(&rel, p->retry_at_ms - 10) != 10) {
+        printf("RELIABLE due FAILED\n");
+        return -1;
+    }
+
+    // acks match dest and seq; Karn: an ack after a retry is no RTT sample
+    if (lora_reliable_ack(&rel, 6, p->seq, 1300) ||
+        lora_reliable_ack(&rel, 5, (uint8_t)(p->seq + 1), 1300) ||
+        !lora_reliable_ack(&rel, 5, p->seq, 1300) ||
+        lora_reliable_ack(&rel, 5, p->seq, 1300) ||
+        rel.peers[0].srtt_ms != 0 || rel.stats.delivered != 1) {
+        printf("RELIABLE ack/Karn FAILED\n");
+        return -1;
+    }
+
+    // a first attempt answered is; the RTO follows it, floored at the minimum
+    p = lora_reliable_slot(&rel);
+    p->in_use  = 1;
+    p->dest    = 5;
+    p->seq     = lora_reliable_next_seq(&rel, 5, 2000);
+    p->retries = 0;
+    p->sent_ms = 2000;
+    p->first_sent_ms = 2000;
+    lora_reliable_ack(&rel, 5, p->seq, 2300);
+    if (rel.peers[0].srtt_ms != 300 || rel.peers[0].rttvar_ms != 150) {
+        printf("RELIABLE RTT sample FAILED: srtt %u rttvar %u\n",
+               (unsigned)rel.peers[0].srtt_ms, (unsigned)rel.peers[0].rttvar_ms);
+        return -1;
+    }
+    p->in_use = 1;
+    lora_reliable_arm(&rel, p, 100);
+    uint32_t wait = p->retry_at_ms - p->sent_ms;
+    lora_reliable_arm(&rel, p, 2000);
+    uint32_t floored = p->retry_at_ms - p->sent_ms;
+    if (wait < 900 || wait > 1350 || floored < 2000 || floored > 3000) {
+        printf("RELIABLE RTO FAILED: %u / %u ms\n", (unsigned)wait, (unsigned)floored);
+        return -1;
+    }
+
+    // two nodes: the first attempt is lost, then the first ack. B acks the
+    // retransmission again but handles the command once
+    LoraMessage cmd = {0};
+    cmd.message_type = LORA_COMMAND_REQUEST;
+    cmd.metadata.dest = 2;
+    cmd.payload.command_req.command_type = LORA_COMMAND_SET_VALUE;
+
+    test_net_init(2);
+    for (int i = 0; i < 2; i++) {
+        test_nodes[i].engine.on_delivery = test_on_delivery;
+        test_nodes[i].engine.on_command_req = test_on_command;
+        test_delivered[i] = -1;
+        test_commands[i] = 0;
+    }
+    LoraEngine *a = &test_nodes[0].engine;
+    test_nodes[0].drop = 1;
+    test_nodes[1].drop = 1;
+    if (!lora_engine_send_reliable(a, &cmd, 1000)) {
+        printf("RELIABLE send FAILED\n");
+        return -1;
+    }
+    test_run(10000);
+    if (test_delivered[0] != 1 || test_commands[1] != 1 || test_nodes[1].sent != 2 ||
+        a->reliable.stats.retries != 2 || a->reliable.stats.delivered != 1 ||
+        lora_engine_tx_pending(a) || lora_reliable_next_deadline(&a->reliable, test_clock_ms) != UINT32_MAX) {
+        printf("RELIABLE retransmission FAILED: delivered %d, handled %u, acks %u, retries %u\n",
+               test_delivered[0], (unsigned)test_commands[1], (unsigned)test_nodes[1].sent,
+               (unsigned)a->reliable.stats.retries);
+        return -1;
+    }
+
+    // B gone: every retry goes unanswered, then on_delivery says so
+    test_delivered[0] = -1;
+    test_nodes[0].drop = -1;
+    test_nodes[0].sent = 0;
+    lora_engine_send_reliable(a, &cmd, 1000);
+    test_run(120000);
+    if (test_delivered[0] != 0 || a->reliable.stats.failed != 1 ||
+        test_nodes[0].sent != 1 + LORA_RELIABLE_MAX_RETRIES) {
+        printf("RELIABLE give up FAILED: delivered %d, %u attempts\n",
+               test_delivered[0], (unsigned)test_nodes[0].sent);
+        return -1;
+    }
+
+    // under the duty cycle: the second command has to wait for budget. It
+    // waits in its slot, not in the queue that would lose its seq, and goes
+    // out as the same attempt once the window has room
+    test_net_init(2);
+    for (int i = 0; i < 2; i++) {
+        test_nodes[i].engine.on_delivery = test_on_delivery;
+        test_nodes[i].engine.on_command_req = test_on_command;
+        test_commands[i] = 0;
+    }
+    a = &test_nodes[0].engine;
+    cmd.metadata.flags = LORA_FLAG_ACK_REQ | LORA_FLAG_COMPACT;
+    uint32_t frame_ms = (lora_airtime_us(&test_nodes[0].driver.phy, (uint8_t)lora_encoded_size(&cmd)) + 999) / 1000;
+    cmd.metadata.flags = 0;
+    LoraDutyCycleConfig duty = { 60000, 1, LORA_DUTY_CYCLE_DEFER, 120000 };
+    duty.budget_permille = (uint16_t)((frame_ms * 1000 + 59999) / 60000);
+    lora_engine_set_duty_cycle(a, &duty);
+    uint32_t start = test_clock_ms;
+    if (!lora_engine_send_reliable(a, &cmd, 1000) || !lora_engine_send_reliable(a, &cmd, 1000) ||
+        test_nodes[0].sent != 1 || lora_engine_tx_pending(a)) {
+        printf("RELIABLE deferred send FAILED: %u sent\n", (unsigned)test_nodes[0].sent);
+        return -1;
+    }
+    test_run(5000);
+    if (a->reliable.stats.delivered != 1 || test_nodes[0].sent != 1) {
+        printf("RELIABLE deferred early FAILED\n");
+        return -1;
+    }
+    test_run(60000);
+    if (a->reliable.stats.delivered != 2 || a->reliable.stats.retries != 0 ||
+        a->reliable.stats.failed != 0 || test_commands[1] != 2 || test_nodes[0].sent != 2 ||
+        test_nodes[0].sent_ms - start < duty.window_ms / 2) {
+        printf("RELIABLE deferred FAILED: delivered %u, retries %u, handled %u, %u frames\n",
+               (unsigned)a->reliable.stats.delivered, (unsigned)a->reliable.stats.retries,
+               (unsigned)test_commands[1], (unsigned)test_nodes[0].sent);
+        return -1;
+    }
+
+    // refused outright, nothing waits and nothing is armed
+    duty.policy = LORA_DUTY_CYCLE_REJECT;
+    lora_engine_set_duty_cycle(a, &duty);
+    lora_engine_send_reliable(a, &cmd, 1000);
+    if (lora_engine_send_reliable(a, &cmd, 1000) ||
+        lora_reliable_next_deadline(&a->reliable, test_clock_ms) == 0 ||
+        a->reliable.stats.sent != 3) {
+        printf("RELIABLE refused FAILED\n");
+        return -1;
+    }
+
+    printf("RELIABLE test PASSED\n");
+    return 0;
+}
+
+static int test_engine_frames()
+{
+    static LoraEngine engine;
+    LoraDriver driver = {0};
+    driver.local_id = 2;
+    lora_engine_init(&engine, &driver);
+    engine.local_id = 2;
+    engine.on_command_req = test_on_command;
+    test_commands[1] = 0;
+
+    LoraMessage msg = {0};
+    msg.message_type = LORA_COMMAND_REQUEST;
+    msg.metadata.source = 1;
+    msg.metadata.dest = 2;
+    msg.payload.command_req.command_type = LORA_COMMAND_SET_VALUE;
+    msg.payload.command_req.command_value.value = 1;
+    uint8_t buf[LORA_MAX_ENCODED_SIZE];
+    size_t len = lora_encode(&msg, buf, sizeof(buf));
+    if (!lora_engine_handle_frame(&engine, buf, len) || test_commands[1] != 1) {
+        printf("ENGINE frame dispatch FAILED\n");
+        return -1;
+    }
+
+    // cut anywhere short of the payload: a header alone, part of the
+    // payload or less than a header, none reaches the handler
+    for (size_t cut = 0; cut < len; cut++) {
+        if (lora_engine_handle_frame(&engine, buf, cut)) {
+            printf("ENGINE frame of %zu bytes ACCEPTED\n", cut);
+            return -1;
+        }
+    }
+
+    // another dest, or a type nobody handles, is dropped after the header
+    msg.metadata.dest = 3;
+    len = lora_encode(&msg, buf, sizeof(buf));
+    uint8_t dropped = lora_engine_handle_frame(&engine, buf, len);
+    msg.metadata.dest = 2;
+    msg.message_type = LORA_PING_REQUEST;
+    len = lora_encode(&msg, buf, sizeof(buf));
+    dropped |= lora_engine_handle_frame(&engine, buf, len);
+    buf[0] = LORA_MESSAGE_TYPE_COUNT;
+    dropped |= lora_engine_handle_frame(&engine, buf, len);
+    if (dropped || test_commands[1] != 1) {
+        printf("ENGINE frame filter FAILED\n");
+        return -1;
+    }
+
+    // an ack request is acked once handled, not before: a cut one or one
+    // nobody takes gets no ack and is not taken for a duplicate later
+    test_net_init(2);
+    LoraEngine *a = &test_nodes[0].engine;
+    LoraEngine *b = &test_nodes[1].engine;
+    a->on_delivery = test_on_delivery;
+    test_delivered[0] = -1;
+    test_commands[1] = 0;
+    msg.message_type = LORA_COMMAND_REQUEST;
+    msg.metadata.flags = LORA_FLAG_ACK_REQ | LORA_FLAG_COMPACT;
+    msg.metadata.seq = 7;
+    len = lora_encode(&msg, buf, sizeof(buf));
+    if (lora_engine_handle_frame(b, buf, len - 1) || lora_engine_handle_frame(b, buf, len) ||
+        test_nodes[1].sent != 0) {
+        printf("ENGINE ack before handling FAILED\n");
+        return -1;
+    }
+    msg.metadata.flags = 0;
+    msg.metadata.seq = 0;
+    if (!lora_engine_send_reliable(a, &msg, 1000)) {
+        printf("ENGINE reliable send FAILED\n");
+        return -1;
+    }
+    test_run(100);
+    b->on_command_req = test_on_command;
+    test_run(2000);
+    if (test_delivered[0] != 1 || test_commands[1] != 1 || a->reliable.stats.retries == 0 ||
+        test_nodes[1].sent != 1) {
+        printf("ENGINE ack after handling FAILED: delivered %d, handled %u\n",
+               test_delivered[0], (unsigned)test_commands[1]);
+        return -1;
+    }
+
+    printf("ENGINE frame test PASSED\n");
+    return 0;
+}
+
+static int test_tx_queue()
+{
+    static const LoraMessageType order[] = {
+        LORA_PING_REQUEST, LORA_COMMAND_REQUEST, LORA_DATA, LORA_RAW, LORA_RAW,
+    };
+    static const LoraMessageType queued[] = {
+        LORA_RAW, LORA_DATA, LORA_PING_REQUEST, LORA_RAW, LORA_COMMAND_REQUEST,
+    };
+
+    test_net_init(2);
+    LoraEngine *a = &test_nodes[0].engine;
+
+    // queued in any order, sent highest class first, in order within one,
+    // one message per poll
+    LoraMessage msg = {0};
+    msg.metadata.dest = 2;
+    for (size_t i = 0; i < sizeof(queued) / sizeof(queued[0]); i++) {
+        memset(&msg.payload, 0, sizeof(msg.payload));
+        msg.message_type = queued[i];
+        if (queued[i] == LORA_RAW) {
+            msg.payload.raw.data_len = 10;
+        } else if (queued[i] == LORA_DATA) {
+            msg.payload.data.data_type = LORA_DATA_TYPE_CLIMATE;
+        }
+        if (!lora_engine_queue(a, &msg, lora_engine_priority_of(queued[i]), 1000)) {
+            printf("QUEUE add FAILED\n");
+            return -1;
+        }
+    }
+    if (test_nodes[0].sent != 0 || !lora_engine_tx_pending(a)) {
+        printf("QUEUE sent before poll FAILED\n");
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        lora_engine_poll(a);
+        if (test_nodes[0].sent != i + 1 || test_nodes[0].sent_type != order[i]) {
+            printf("QUEUE order FAILED: frame %zu is type %u\n", i, (unsigned)test_nodes[0].sent_type);
+            return -1;
+        }
+    }
+    lora_engine_poll(a);
+    if (test_nodes[0].sent != 5 || lora_engine_tx_pending(a)) {
+        printf("QUEUE drain FAILED\n");
+        return -1;
+    }
+
+    // a full class refuses and counts, the others and what it holds are fine
+    msg.message_type = LORA_RAW;
+    msg.payload.raw.data_len = LORA_STREAM_MAX_CHUNK_SIZE;
+    uint32_t held = 0;
+    while (lora_engine_queue(a, &msg, LORA_PRIORITY_BULK, 1000)) {
+        held++;
+    }
+    msg.message_type = LORA_PING_REQUEST;
+    if (held != 2 || a->tx_queue_dropped != 1 ||
+        !lora_engine_queue(a, &msg, LORA_PRIORITY_CONTROL, 1000)) {
+        printf("QUEUE full class FAILED: %u held, %u dropped\n",
+               (unsigned)held, (unsigned)a->tx_queue_dropped);
+        return -1;
+    }
+    test_run(10);
+    if (test_nodes[0].sent != 8 || test_nodes[0].sent_type != LORA_RAW || lora_engine_tx_pending(a)) {
+        printf("QUEUE full drain FAILED: %u sent\n", (unsigned)test_nodes[0].sent);
+        return -1;
+    }
+
+    printf("QUEUE test PASSED\n");
+    return 0;
+}
+
+static uint32_t test_data_count[TEST_NODES];
+
+static void test_on_data(LoraEngine *engine, const LoraData *msg, const LoraMetadata *meta)
+{
+    (void)msg; (void)meta;
+    test_data_count[engine->local_id - 1]++;
+}
+
+static int test_engine_aggregate()
+{
+    LoraMessage data = {0};
+    data.message_type = LORA_DATA;
+    data.payload.data.data_type = LORA_DATA_TYPE_CLIMATE;
+
+    test_net_init(3);
+    LoraEngine *a = &test_nodes[0].engine;
+    for (int i = 0; i < 3; i++) {
+        test_nodes[i].engine.on_data = test_on_data;
+        test_data_count[i] = 0;
+    }
+    lora_engine_set_aggregation(a, 200);
+
+    // held for the window, then one frame
+    for (int i = 0; i < 3; i++) {
+        data.metadata.dest = 2;
+        if (!lora_engine_send(a, &data, 1000)) {
+            printf("ENGINE aggregate hold FAILED\n");
+            return -1;
+        }
+    }
+    test_run(150);
+    if (test_nodes[0].sent != 0 || !a->aggregate.payload.aggregate.entries_len) {
+        printf("ENGINE aggregate window FAILED: %u frames early\n", (unsigned)test_nodes[0].sent);
+        return -1;
+    }
+    test_run(100);
+    if (test_nodes[0].sent != 1 || test_nodes[0].sent_type != LORA_AGGREGATE || test_data_count[1] != 3) {
+        printf("ENGINE aggregate flush FAILED: %u frames, %u handled\n",
+               (unsigned)test_nodes[0].sent, (unsigned)test_data_count[1]);
+        return -1;
+    }
+
+    // another dest sends what is held first, on its own and in order
+    data.metadata.dest = 2;
+    lora_engine_send(a, &data, 1000);
+    data.metadata.dest = 3;
+    lora_engine_send(a, &data, 1000);
+    test_run(1);
+    if (test_nodes[0].sent != 2 || test_nodes[0].sent_type != LORA_DATA ||
+        test_data_count[1] != 4 || test_data_count[2] != 0) {
+        printf("ENGINE aggregate dest mismatch FAILED\n");
+        return -1;
+    }
+
+    // so do other flags
+    data.metadata.flags = LORA_FLAG_COMPACT;
+    lora_engine_send(a, &data, 1000);
+    test_run(1);
+    if (test_nodes[0].sent != 3 || test_data_count[2] != 1) {
+        printf("ENGINE aggregate flags mismatch FAILED\n");
+        return -1;
+    }
+
+    // and an ack request is never held: it goes at once, after what is
+    // held, keeps its seq, and is acked
+    data.metadata.flags = LORA_FLAG_ACK_REQ;
+    data.metadata.seq = 77;
+    lora_engine_send(a, &data, 1000);
+    test_run(5);
+    if (test_nodes[0].sent != 5 || test_nodes[2].sent != 1 || test_nodes[2].sent_type != LORA_ACK ||
+        test_data_count[2] != 3 || a->aggregate.payload.aggregate.entries_len) {
+        printf("ENGINE aggregate ack request FAILED: %u frames, %u acks\n",
+               (unsigned)test_nodes[0].sent, (unsigned)test_nodes[2].sent);
+        return -1;
+    }
+
+    printf("ENGINE aggregate test PASSED\n");
+    return 0;
+}
+
+#define TEST_STREAM_LEN 10000   // three sequences, the last one short
+
+static LoraStream test_streams[2];
+static uint8_t    test_stream_data[2][TEST_STREAM_LEN];
+static uint8_t    test_stream_out[TEST_STREAM_LEN];
+static uint32_t   test_stream_reads;
+static int        test_stream_sent;       // on_sent outcome, -1 none yet
+static int        test_stream_done;
+static int        test_stream_done_ok;
+static uint32_t   test_stream_done_len;
+static uint32_t   test_stream_done_crc;
+static uint32_t   test_stream_rx_crc;
+static uint8_t    test_stream_done_flags;
+
+static uint32_t test_stream_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    test_stream_reads++;
+    memcpy(buf, (const uint8_t *)ctx + offset, len);
+    return len;
+}
+
+static void test_stream_chunk(LoraStream *stream, uint32_t offset, const uint8_t *data, uint8_t len)
+{
+    (void)stream;
+    memcpy(&test_stream_out[offset], data, len);
+}
+
+static void test_stream_on_done(LoraStream *stream, uint32_t length, uint32_t crc32, uint8_t ok)
+{
+    test_stream_done = 1;
+    test_stream_done_ok = ok;
+    test_stream_done_len = length;
+    test_stream_done_crc = crc32;
+    test_stream_rx_crc = lora_stream_rx_crc32(stream);
+    test_stream_done_flags = lora_stream_rx_flags(stream);
+}
+
+static void test_stream_on_sent(LoraStream *stream, uint8_t ok)
+{
+    (void)stream;
+    test_stream_sent = ok;
+}
+
+// node 1 sends to node 2, which hands chunks to test_stream_out
+static void test_stream_attach(int node)
+{
+    lora_stream_init(&test_streams[node], &test_nodes[node].engine);
+    test_streams[node].on_chunk = test_stream_chunk;
+    test_streams[node].on_done  = test_stream_on_done;
+    test_streams[node].on_sent  = test_stream_on_sent;
+}
+
+static uint8_t test_stream_start(int data)
+{
+    LoraStreamSource source = { test_stream_read, test_stream_data[data], TEST_STREAM_LEN };
+
+    memset(test_stream_out, 0, sizeof(test_stream_out));
+    test_stream_reads = 0;
+    test_stream_sent = -1;
+    test_stream_done = 0;
+    return lora_stream_send_from(&test_streams[0], 2, LORA_STREAM_RAW, &source, 0);
+}
+
+static void test_stream_wait(void)
+{
+    for (uint32_t ms = 0; ms < 600000 && test_stream_sent < 0; ms++) {
+        test_run(1);
+    }
+    test_run(1000);
+}
+
+static int test_arena()
+{
+    static uint32_t mem[16];    // 64 bytes, word aligned
+    LoraArena arena;
+    lora_arena_init(&arena, mem, sizeof(mem));
+    uint8_t *base = (uint8_t *)mem;
+
+    // blocks start on 4 byte boundaries whatever came before
+    uint8_t *a = lora_arena_alloc(&arena, 5);
+    uint8_t *b = lora_arena_alloc(&arena, 1);
+    size_t mark = lora_arena_mark(&arena);
+    uint8_t *c = lora_arena_alloc(&arena, 3);
+    if (a != base || b != base + 8 || c != base + 12 || lora_arena_mark(&arena) != 15) {
+        printf("ARENA alignment FAILED\n");
+        return -1;
+    }
+
+    // exactly full, then nothing more, and a failed alloc takes nothing
+    if (lora_arena_alloc(&arena, 48) != base + 16 || lora_arena_alloc(&arena, 1) ||
+        lora_arena_alloc(&arena, SIZE_MAX) ||
+        lora_arena_mark(&arena) != 64) {
+        printf("ARENA exhaustion FAILED\n");
+        return -1;
+    }
+
+    // back to the mark gives the same blocks again, a mark past the end is
+    // ignored
+    lora_arena_release(&arena, mark);
+    lora_arena_release(&arena, 1000);
+    if (lora_arena_mark(&arena) != mark || lora_arena_alloc(&arena, 3) != c) {
+        printf("ARENA release FAILED\n");
+        return -1;
+    }
+
+    // a reassembly buffer comes out of it, or not at all
+    static LoraEngine engine;
+    static LoraStream stream;
+    LoraDriver driver = {0};
+    lora_engine_init(&engine, &driver);
+    lora_stream_init(&stream, &engine);
+    lora_arena_release(&arena, 0);
+    if (lora_stream_rx_reserve(&stream, &arena, 65) || stream.rx_buffer ||
+        lora_arena_mark(&arena) != 0 ||
+        !lora_stream_rx_reserve(&stream, &arena, 64) || stream.rx_buffer != base ||
+        stream.rx_capacity != 64) {
+        printf("ARENA stream reserve FAILED\n");
+        return -1;
+    }
+
+    printf("ARENA test PASSED\n");
+    return 0;
+}
+
+// bits/s the receiver got, out of the PHY rate
+static uint32_t test_stream_goodput(const LoraStreamStats *stats)
+{
+    uint32_t ms = stats->finished_ms - stats->started_ms;
+    return ms ? (uint32_t)((uint64_t)stats->bytes_delivered * 8000 / ms) : 0;
+}
+
+static int test_stream_transfer()
+{
+    static uint8_t   arena_mem[TEST_STREAM_LEN + 64];
+    static LoraArena arena;
+    const uint32_t   chunks = (TEST_STREAM_LEN + LORA_STREAM_MAX_CHUNK_SIZE - 1) / LORA_STREAM_MAX_CHUNK_SIZE;
+
+    for (uint32_t i = 0; i < TEST_STREAM_LEN; i++) {
+        test_stream_data[0][i] = (uint8_t)(i * 31 + (i >> 7));
+        test_stream_data[1][i] = (uint8_t)(i * 7 + 3);
+    }
+    uint32_t crc = lora_crc32(test_stream_data[0], TEST_STREAM_LEN);
+
+    // clean channel, chunks to on_chunk: each read once from the source,
+    // and a control message gets ahead of the burst
+    test_net_init(2);
+    test_stream_attach(0);
+    test_stream_attach(1);
+    test_stream_start(0);
+    while (test_streams[0].tx.state != LORA_STREAM_TX_BURST || test_streams[0].tx.sent == 0) {
+        test_run(1);
+    }
+    LoraMessage ping = {0};
+    ping.message_type = LORA_PING_REQUEST;
+    ping.metadata.dest = 2;
+    lora_engine_queue(&test_nodes[0].engine, &ping, LORA_PRIORITY_CONTROL, 1000);
+    uint32_t sent = test_nodes[0].sent;
+    while (test_nodes[0].sent == sent) {
+        test_run(1);
+    }
+    if (test_nodes[0].sent_type != LORA_PING_REQUEST) {
+        printf("STREAM priority FAILED: type %u went before the ping\n", (unsigned)test_nodes[0].sent_type);
+        return -1;
+    }
+    test_stream_wait();
+    const LoraStreamStats *stats = &test_streams[0].tx.stats;
+    if (test_stream_sent != 1 || !test_stream_done || test_stream_done_len != TEST_STREAM_LEN ||
+        test_stream_done_crc != crc || !test_stream_done_ok || test_stream_rx_crc != crc ||
+        memcmp(test_stream_out, test_stream_data[0], TEST_STREAM_LEN) ||
+        stats->packets_sent != chunks || stats->packets_resent || test_stream_reads != chunks) {
+        printf("STREAM transfer FAILED: sent %d done %d, %u reads\n",
+               test_stream_sent, test_stream_done, (unsigned)test_stream_reads);
+        return -1;
+    }
+    uint32_t phy_bps = lora_airtime_phy_bps(&test_nodes[0].driver.phy);
+    uint32_t clean_bps = test_stream_goodput(stats);
+    if (clean_bps >= phy_bps || clean_bps < phy_bps / 2) {
+        printf("STREAM goodput FAILED: %u of %u bps\n", (unsigned)clean_bps, (unsigned)phy_bps);
+        return -1;
+    }
+
+    // aggregation on at both ends: packets, the short last one too, still
+    // go on their own and reach the view handler
+    test_net_init(2);
+    test_nodes[0].engine.aggregate_window_ms = 50;
+    test_nodes[1].engine.aggregate_window_ms = 50;
+    test_stream_attach(0);
+    test_stream_attach(1);
+    test_stream_start(0);
+    test_stream_wait();
+    if (test_stream_sent != 1 || !test_stream_done || !test_stream_done_ok ||
+        test_stream_done_len != TEST_STREAM_LEN ||
+        memcmp(test_stream_out, test_stream_data[0], TEST_STREAM_LEN)) {
+        printf("STREAM aggregated FAILED: sent %d done %d, %u bytes\n",
+               test_stream_sent, test_stream_done, (unsigned)test_stream_done_len);
+        return -1;
+    }
+    LoraMessage short_packet = {0};
+    short_packet.message_type = LORA_STREAM_SEQUENCE;
+    short_packet.metadata.dest = 2;
+    short_packet.payload.stream_sequence.packets_in_sequence = 1;
+    short_packet.payload.stream_sequence.chunk_len = 8;
+    sent = test_nodes[0].sent;
+    if (!lora_engine_send(&test_nodes[0].engine, &short_packet, 1000) ||
+        test_nodes[0].sent != sent + 1 || test_nodes[0].sent_type != LORA_STREAM_SEQUENCE) {
+        printf("STREAM aggregated packet held FAILED\n");
+        return -1;
+    }
+
+    // 20% loss, reassembled in place: selective repeat resends only what
+    // went missing, and the CRC over the buffer matches the sender's
+    test_net_init(2);
+    test_loss_pct = 20;
+    test_stream_attach(0);
+    test_stream_attach(1);
+    lora_arena_init(&arena, arena_mem, sizeof(arena_mem));
+    if (!lora_stream_rx_reserve(&test_streams[1], &arena, TEST_STREAM_LEN)) {
+        printf("STREAM reserve FAILED\n");
+        return -1;
+    }
+    test_stream_start(0);
+    test_stream_wait();
+    if (test_stream_sent != 1 || !test_stream_done || test_stream_done_crc != crc ||
+        test_stream_rx_crc != crc || !test_stream_done_ok ||
+        memcmp(test_streams[1].rx_buffer, test_stream_data[0], TEST_STREAM_LEN) ||
+        stats->packets_sent != chunks || !stats->packets_resent || stats->packets_resent >= chunks) {
+        printf("STREAM lossy FAILED: sent %d done %d, resent %u of %u\n",
+               test_stream_sent, test_stream_done,
+               (unsigned)stats->packets_resent, (unsigned)stats->packets_sent);
+        return -1;
+    }
+    uint32_t resent = stats->packets_resent;
+    uint32_t lossy_bps = test_stream_goodput(stats);
+    if (lossy_bps >= clean_bps) {
+        printf("STREAM lossy goodput FAILED: %u bps, %u clean\n", (unsigned)lossy_bps, (unsigned)clean_bps);
+        return -1;
+    }
+
+    // a stream larger than the buffer is refused, not written past it, and
+    // the receiver is free again at once
+    test_net_init(2);
+    test_stream_attach(0);
+    test_stream_attach(1);
+    lora_arena_init(&arena, arena_mem, sizeof(arena_mem));
+    lora_stream_rx_reserve(&test_streams[1], &arena, TEST_STREAM_LEN / 2);
+    memset(&arena_mem[TEST_STREAM_LEN / 2], 0xA5, sizeof(arena_mem) - TEST_STREAM_LEN / 2);
+    test_stream_start(0);
+    test_stream_wait();
+    if (test_stream_sent != 0 || test_stream_done ||
+        test_streams[1].rx.state != LORA_STREAM_RX_IDLE ||
+        arena_mem[TEST_STREAM_LEN / 2] != 0xA5 || arena_mem[sizeof(arena_mem) - 1] != 0xA5) {
+        printf("STREAM overflow FAILED: sent %d done %d\n", test_stream_sent, test_stream_done);
+        return -1;
+    }
+
+    // the sender reboots mid transfer and starts another stream under the
+    // same id: the receiver starts over instead of taking it for the old one
+    test_net_init(2);
+    test_stream_attach(0);
+    test_stream_attach(1);
+    test_stream_start(0);
+    while (test_streams[1].rx.sequence < 1) {
+        test_run(1);
+    }
+    uint8_t stream_id = test_streams[0].tx.stream_id;
+    lora_engine_init(&test_nodes[0].engine, &test_nodes[0].driver);
+    test_nodes[0].engine.local_id = 1;
+    test_stream_attach(0);
+    test_streams[0].next_stream_id = stream_id;
+    test_stream_start(1);
+    test_stream_wait();
+    if (test_stream_sent != 1 || !test_stream_done ||
+        test_stream_done_crc != lora_crc32(test_stream_data[1], TEST_STREAM_LEN) ||
+        memcmp(test_stream_out, test_stream_data[1], TEST_STREAM_LEN)) {
+        printf("STREAM restart FAILED: sent %d done %d\n", test_stream_sent, test_stream_done);
+        return -1;
+    }
+
+    // a chunk damaged on the way fails the transfer at the receiver, through
+    // on_chunk and in a buffer alike
+    for (int buffered = 0; buffered < 2; buffered++) {
+        test_net_init(2);
+        test_loss_pct = 5;
+        test_nodes[0].corrupt = 1;
+        test_stream_attach(0);
+        test_stream_attach(1);
+        if (buffered) {
+            lora_arena_init(&arena, arena_mem, sizeof(arena_mem));
+            lora_stream_rx_reserve(&test_streams[1], &arena, TEST_STREAM_LEN);
+        }
+        test_stream_start(0);
+        test_stream_wait();
+        if (!test_stream_done || test_stream_done_ok || test_stream_done_crc != crc ||
+            test_stream_rx_crc == crc) {
+            printf("STREAM corrupt chunk FAILED: done %d ok %d, buffer %d\n",
+                   test_stream_done, test_stream_done_ok, buffered);
+            return -1;
+        }
+    }
+
+    printf("STREAM transfer test PASSED (%u chunks, %u resent at 20%% loss)\n",
+           (unsigned)chunks, (unsigned)resent);
+    printf("STREAM goodput %u bps clean, %u bps at 20%% loss, PHY %u bps\n",
+           (unsigned)clean_bps, (unsigned)lossy_bps, (unsigned)phy_bps);
+    return 0;
+}
+
+// test_stream_read, up to a failure at fail_at
+static uint32_t test_stream_fail_at;
+
+static uint32_t test_stream_read_failing(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    if (offset >= test_stream_fail_at) {
+        return 0;
+    }
+    return test_stream_read(ctx, offset, buf, len);
+}
+
+static int test_stream_source()
+{
+    const uint32_t chunks = (TEST_STREAM_LEN + LORA_STREAM_MAX_CHUNK_SIZE - 1) / LORA_STREAM_MAX_CHUNK_SIZE;
+
+    // reading starts while the announce is out, one chunk per poll, so
+    // the burst finds its first chunks waiting
+    test_net_init(2);
+    test_stream_attach(0);
+    test_stream_attach(1);
+    test_stream_start(0);
+    while (test_streams[0].tx.state != LORA_STREAM_TX_BURST) {
+        test_run(1);
+    }
+    uint32_t before = test_stream_reads;
+    test_run(1);
+    if (!before || !test_streams[0].tx.sent || test_stream_reads > LORA_STREAM_READ_AHEAD) {
+        printf("STREAM read ahead FAILED: %u reads before the burst, %u after\n",
+               (unsigned)before, (unsigned)test_stream_reads);
+        return -1;
+    }
+
+    // a lost packet is read again when resent, and so are the next
+    // sequence's chunks read ahead that it pushed out; nothing else is
+    test_net_init(2);
+    test_loss_pct = 10;
+    test_stream_attach(0);
+    test_stream_attach(1);
+    test_stream_start(0);
+    test_stream_wait();
+    const LoraStreamStats *stats = &test_streams[0].tx.stats;
+    if (test_stream_sent != 1 || !test_stream_done_ok || !stats->packets_resent ||
+        test_stream_reads <= chunks ||
+        test_stream_reads > chunks + stats->packets_resent + LORA_STREAM_READ_AHEAD * stats->announces ||
+        memcmp(test_stream_out, test_stream_data[0], TEST_STREAM_LEN)) {
+        printf("STREAM source rereads FAILED: %u reads, %u resent\n",
+               (unsigned)test_stream_reads, (unsigned)stats->packets_resent);
+        return -1;
+    }
+
+    // a source that fails mid stream ends the transfer, nothing is sent
+    // for the chunk it could not give
+    test_net_init(2);
+    test_stream_attach(0);
+    test_stream_attach(1);
+    test_stream_start(0);
+    test_stream_fail_at = TEST_STREAM_LEN / 2;
+    test_streams[0].tx.source.read = test_stream_read_failing;
+    test_stream_wait();
+    if (test_stream_sent != 0 || test_stream_done ||
+        stats->packets_sent > test_stream_fail_at / LORA_STREAM_MAX_CHUNK_SIZE + 1) {
+        printf("STREAM source failure FAILED: sent %d, %u packets\n",
+               test_stream_sent, (unsigned)stats->packets_sent);
+        return -1;
+    }
+
+    printf("STREAM source test PASSED\n");
+    return 0;
+}
+
+static int test_stream_lzss()
+{
+    static uint8_t   arena_mem[2048];
+    static LoraArena arena;
+    static uint8_t   text[1500];
+    static LoraLzssEncoder enc;
+    static LoraLzssDecoder dec;
+    static TestBuffer packed;
+    static TestBuffer unpacked;
+
+    size_t text_len = 0;
+    for (int i = 0; text_len + 40 < sizeof(text); ++i) {
+        text_len += (size_t)snprintf((char *)&text[text_len], sizeof(text) - text_len,
+                                     "t=%05d temp=%d hum=%d ok\n", i * 60, 200 + i % 7, 550 - i % 5);
+    }
+
+    // the application compresses, the stream carries the flag along
+    packed.len = 0;
+    lora_lzss_encoder_init(&enc);
+    lora_lzss_compress(&enc, text, text_len, test_buffer_write, &packed);
+    lora_lzss_finish(&enc, test_buffer_write, &packed);
+
+    test_net_init(2);
+    test_loss_pct = 10;
+    test_stream_attach(0);
+    test_stream_attach(1);
+    lora_arena_init(&arena, arena_mem, sizeof(arena_mem));
+    lora_stream_rx_reserve(&test_streams[1], &arena, sizeof(arena_mem));
+    test_stream_sent = -1;
+    test_stream_done = 0;
+    test_stream_done_flags = 0;
+    lora_stream_send(&test_streams[0], 2, LORA_STREAM_RAW, packed.buf, (uint32_t)packed.len,
+                     LORA_STREAM_FLAG_LZSS);
+    test_stream_wait();
+    if (test_stream_sent != 1 || !test_stream_done || test_stream_done_len != packed.len ||
+        !(test_stream_done_flags & LORA_STREAM_FLAG_LZSS)) {
+        printf("STREAM lzss FAILED: sent %d done %d, flags %u\n",
+               test_stream_sent, test_stream_done, (unsigned)test_stream_done_flags);
+        return -1;
+    }
+
+    // and the receiver expands what arrived
+    unpacked.len = 0;
+    lora_lzss_decoder_init(&dec);
+    if (!lora_lzss_decompress(&dec, test_streams[1].rx_buffer, test_stream_done_len,
+                              test_buffer_write, &unpacked) ||
+        unpacked.len != text_len || memcmp(unpacked.buf, text, text_len)) {
+        printf("STREAM lzss round trip FAILED\n");
+        return -1;
+    }
+
+    printf("STREAM lzss test PASSED (%zu bytes in %zu)\n", text_len, packed.len);
+    return 0;
+}
+
+// a flood from origin, seq, with ttl left, as heard from neighbour from
+static size_t test_flood_frame(uint8_t *buf, NodeId from, NodeId origin, uint8_t seq, uint8_t ttl)
+{
+    LoraMessage cmd = {0};
+    cmd.message_type = LORA_COMMAND_REQUEST;
+    cmd.metadata.source = origin;
+    cmd.metadata.dest = LORA_NODE_BROADCAST_ID;
+
+    LoraMessage msg = {0};
+    msg.message_type = LORA_ROUTED;
+    msg.metadata.source = from;
+    msg.metadata.dest = LORA_NODE_BROADCAST_ID;
+    lora_routed_wrap(&msg.payload.routed, &cmd, ttl);
+    msg.payload.routed.seq = seq;
+    return lora_encode(&msg, buf, LORA_MAX_ENCODED_SIZE);
+}
+
+static void test_flood_handlers(void)
+{
+    for (int i = 0; i < TEST_NODES; i++) {
+        test_nodes[i].engine.on_command_req = test_on_command;
+        test_commands[i] = 0;
+    }
+}
+
+static int test_flood()
+{
+    // rebroadcast delays spread over LORA_FLOOD_DELAY_SLOTS times on air
+    static LoraFlood flood;
+    lora_flood_init(&flood, 7);
+    uint32_t lo = UINT32_MAX, hi = 0;
+    for (int i = 0; i < 200; i++) {
+        uint32_t delay = lora_flood_delay_ms(&flood, 40);
+        lo = delay < lo ? delay : lo;
+        hi = delay > hi ? delay : hi;
+    }
+    if (hi >= LORA_FLOOD_DELAY_SLOTS * 40 || lo >= 40 || hi < (LORA_FLOOD_DELAY_SLOTS - 1) * 40) {
+        printf("FLOOD delay FAILED: %u .. %u ms\n", (unsigned)lo, (unsigned)hi);
+        return -1;
+    }
+
+    // node 2 alone, fed frames from neighbours 7 .. 9; only node 3 hears it
+    uint8_t frame[LORA_MAX_ENCODED_SIZE];
+    size_t len;
+    test_net_init(3);
+    memset(test_range, 0, sizeof(test_range));
+    test_range[1][2] = 1;
+    test_flood_handlers();
+    LoraEngine *node = &test_nodes[1].engine;
+    LoraFlood *state = &node->flood;
+    uint32_t start = test_clock_ms;
+
+    // first copy handled and held for rebroadcast, two more copies only
+    // counted: enough to drop it
+    len = test_flood_frame(frame, 9, 9, 1, 3);
+    lora_engine_handle_frame(node, frame, (uint8_t)len);
+    uint32_t window = LORA_FLOOD_DELAY_SLOTS * ((lora_airtime_us(&test_nodes[1].driver.phy, (uint8_t)len) + 999) / 1000);
+    if (test_commands[1] != 1 || !state->pending[0].in_use ||
+        !lora_timer_running(&state->pending[0].timer) ||
+        state->pending[0].timer.expires_ms - start >= window) {
+        printf("FLOOD first copy FAILED\n");
+        return -1;
+    }
+    len = test_flood_frame(frame, 8, 9, 1, 3);
+    lora_engine_handle_frame(node, frame, (uint8_t)len);
+    len = test_flood_frame(frame, 7, 9, 1, 2);
+    lora_engine_handle_frame(node, frame, (uint8_t)len);
+    if (test_commands[1] != 1 || state->pending[0].copies != LORA_FLOOD_SUPPRESS_COPIES) {
+        printf("FLOOD dedup FAILED: handled %u, copies %u\n",
+               (unsigned)test_commands[1], (unsigned)state->pending[0].copies);
+        return -1;
+    }
+
+    // the second flood takes the last pending slot, the third finds none,
+    // a fourth is out of ttl; all are handled. Our own flood is not news
+    len = test_flood_frame(frame, 9, 9, 2, 3);
+    lora_engine_handle_frame(node, frame, (uint8_t)len);
+    len = test_flood_frame(frame, 9, 9, 3, 3);
+    lora_engine_handle_frame(node, frame, (uint8_t)len);
+    len = test_flood_frame(frame, 9, 6, 1, 1);
+    lora_engine_handle_frame(node, frame, (uint8_t)len);
+    len = test_flood_frame(frame, 9, 2, 1, 3);
+    lora_engine_handle_frame(node, frame, (uint8_t)len);
+    if (test_commands[1] != 4 || state->stats.dropped != 2) {
+        printf("FLOOD slots/ttl FAILED: handled %u, dropped %u\n",
+               (unsigned)test_commands[1], (unsigned)state->stats.dropped);
+        return -1;
+    }
+
+    // within the window the suppressed one is dropped, the other goes out
+    // one hop further, and node 3 learns the way to 9
+    test_run(window + 100);
+    const LoraRouteEntry *route = lora_route_lookup(&test_nodes[2].engine.routes, 9, test_clock_ms);
+    if (state->stats.suppressed != 1 || state->stats.rebroadcast != 1 ||
+        test_nodes[1].sent != 1 || test_commands[2] != 1 ||
+        !route || route->next_hop != 2 || route->hops != 2) {
+        printf("FLOOD rebroadcast FAILED: suppressed %u, rebroadcast %u, sent %u\n",
+               (unsigned)state->stats.suppressed, (unsigned)state->stats.rebroadcast,
+               (unsigned)test_nodes[1].sent);
+        return -1;
+    }
+
+    // a line 1 - 2 - 3 - 4 and ttl 2: node 3 handles it but does not pass
+    // it on, node 4 never hears of it
+    LoraMessage cmd = {0};
+    cmd.message_type = LORA_COMMAND_REQUEST;
+    test_net_init(4);
+    memset(test_range, 0, sizeof(test_range));
+    for (int i = 0; i < 3; i++) {
+        test_range[i][i + 1] = test_range[i + 1][i] = 1;
+    }
+    test_flood_handlers();
+    lora_engine_flood(&test_nodes[0].engine, &cmd, 2, 1000);
+    test_run(3000);
+    if (test_commands[0] || test_commands[1] != 1 || test_commands[2] != 1 || test_commands[3] ||
+        test_nodes[1].sent != 1 || test_nodes[2].sent != 0 ||
+        test_nodes[2].engine.flood.stats.dropped != 1) {
+        printf("FLOOD ttl FAILED: handled %u %u %u\n", (unsigned)test_commands[1],
+               (unsigned)test_commands[2], (unsigned)test_commands[3]);
+        return -1;
+    }
+
+    // four in range of each other: everyone handles it once, and the copies
+    // heard spare at least the last rebroadcast
+    test_net_init(4);
+    test_flood_handlers();
+    lora_engine_flood(&test_nodes[0].engine, &cmd, 0, 1000);
+    test_run(3000);
+    uint32_t frames = 0, suppressed = 0;
+    for (int i = 0; i < 4; i++) {
+        frames += test_nodes[i].sent;
+        suppressed += test_nodes[i].engine.flood.stats.suppressed;
+    }
+    if (test_commands[0] || test_commands[1] != 1 || test_commands[2] != 1 || test_commands[3] != 1 ||
+        !suppressed || frames + suppressed != 4) {
+        printf("FLOOD suppression FAILED: %u frames, %u suppressed\n",
+               (unsigned)frames, (unsigned)suppressed);
+        return -1;
+    }
+
+    printf("FLOOD test PASSED (%u frames for 4 nodes)\n", (unsigned)frames);
+    return 0;
+}
 
 int main(void)
 {
@@ -201,6 +2356,31 @@ int main(void)
     failures += test_data();
     failures += test_command();
     failures += test_stream();
+    failures += test_view();
+    failures += test_sizes();
+    failures += test_sink();
+    failures += test_packed();
+    failures += test_compact_header();
+    failures += test_lzss();
+    failures += test_climate_series();
+    failures += test_climate_batch();
+    failures += test_aggregate();
+    failures += test_raw();
+    failures += test_crc();
+    failures += test_dedup();
+    failures += test_timer_wheel();
+    failures += test_routed();
+    failures += test_engine_seed();
+    failures += test_engine_events();
+    failures += test_engine_frames();
+    failures += test_tx_queue();
+    failures += test_reliable();
+    failures += test_engine_aggregate();
+    failures += test_arena();
+    failures += test_stream_transfer();
+    failures += test_stream_source();
+    failures += test_stream_lzss();
+    failures += test_flood();
 
     if (failures == 0) {
         printf("\nALL TESTS PASSED!\n");
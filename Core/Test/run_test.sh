@@ -1,2 +1,2 @@
 #!/bin/bash
-gcc -I../Inc/lora ../Src/lora/lora_message_types.c ../Src/lora/lora_codec.c codec_test.c -o codec_test && ./codec_test
+gcc -I../Inc/lora ../Src/lora/lora_codec.c ../Src/lora/lora_lzss.c ../Src/lora/lora_crc.c ../Src/lora/lora_dedup.c ../Src/lora/lora_timer.c ../Src/lora/lora_route.c ../Src/lora/lora_flood.c ../Src/lora/lora_airtime.c ../Src/lora/lora_reliable.c ../Src/lora/lora_arena.c ../Src/lora/lora_stream.c ../Src/lora/lora_climate_batch.c ../Src/lora/lora_engine.c codec_test.c -o codec_test && ./codec_test
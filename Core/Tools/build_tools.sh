@@ -0,0 +1,3 @@
+#!/bin/bash
+gcc -I../Inc/lora spi_trace_analyze.c -o spi_trace_analyze
+gcc -I../Inc/lora frame_replay.c ../Src/lora/lora_codec.c ../Src/lora/lora_engine.c ../Src/lora/lora_airtime.c ../Src/lora/lora_reliable.c ../Src/lora/lora_dedup.c ../Src/lora/lora_stream.c ../Src/lora/lora_arena.c ../Src/lora/lora_crc.c ../Src/lora/lora_timer.c ../Src/lora/lora_route.c ../Src/lora/lora_flood.c -o frame_replay
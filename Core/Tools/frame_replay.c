@@ -0,0 +1,301 @@
+/*
+ * frame_replay.c
+ *
+ * Host harness: replays a lora_capture log through lora_engine_handle_frame()
+ * and lora_engine_poll(), and reports frames/s and per message type latency,
+ * replies included, so engine changes can be measured against real traffic.
+ *
+ * usage: frame_replay [-r] [-s speed] [-l loops] [-n node_id] [-o out.bin] capture
+ *
+ *   capture  binary log, or a UART log containing lora_capture_dump() lines
+ *   -r       replay at the original timing instead of as fast as possible
+ *   -s       speed factor for -r, eg 10 plays ten times faster
+ *   -l       replay the log this many times (default 1)
+ *   -n       node id to receive as (default: the id recorded in the log)
+ *   -o       write the log in binary form, eg to convert a UART dump
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lora_capture.h"
+#include "lora_codec.h"
+#include "lora_engine.h"
+
+#define MAX_TYPES 256
+
+typedef struct {
+    unsigned long frames;
+    unsigned long long total_ns;
+    unsigned long long min_ns;
+    unsigned long long max_ns;
+} TypeStats;
+
+static volatile uint32_t sink;
+static uint32_t virtual_time_ms;
+static unsigned long frames_sent;
+
+#define SINK_HANDLER(name, payload_type)                                   \
+    static void name(LoraEngine *engine,                                   \
+                     const payload_type *msg,                              \
+                     const LoraMetadata *meta)                             \
+    {                                                                      \
+        (void)engine;                                                      \
+        sink += *(const uint8_t *)msg + meta->source;                      \
+    }
+
+SINK_HANDLER(on_ping_req,          LoraPingReq)
+SINK_HANDLER(on_ping_resp,         LoraPingResp)
+SINK_HANDLER(on_data_req,          LoraDataReq)
+SINK_HANDLER(on_data,              LoraData)
+SINK_HANDLER(on_command_req,       LoraCommandReq)
+SINK_HANDLER(on_command_resp,      LoraCommandResp)
+SINK_HANDLER(on_stream_req,        LoraStreamRequest)
+SINK_HANDLER(on_stream_announce,   LoraStreamAnnounce)
+SINK_HANDLER(on_stream_announce_ack, LoraStreamAnnounceAck)
+SINK_HANDLER(on_stream_sequence,   LoraStreamSequence)
+SINK_HANDLER(on_stream_seq_ack,    LoraStreamSequenceAck)
+SINK_HANDLER(on_stream_complete,   LoraStreamComplete)
+
+static uint8_t fake_transmit(void *ctx, uint8_t *data, uint8_t length, uint16_t timeout)
+{
+    (void)ctx; (void)data; (void)length; (void)timeout;
+    frames_sent++;
+    return 1;
+}
+
+static uint8_t fake_receive(void *ctx, uint8_t *data, uint8_t length)
+{
+    (void)ctx; (void)data; (void)length;
+    return 0;
+}
+
+static uint32_t fake_time_ms(void)
+{
+    return virtual_time_ms;
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int hex_nibble(int c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Load a binary log, or collect the bytes of every "LCAP <hex>" line of a text log
+static uint8_t *load_log(const char *path, size_t *out_len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *raw = malloc(size > 0 ? (size_t)size : 1);
+    if (!raw || fread(raw, 1, (size_t)size, f) != (size_t)size) {
+        fclose(f);
+        free(raw);
+        return NULL;
+    }
+    fclose(f);
+
+    if (size >= LORA_CAPTURE_HEADER_SIZE &&
+        memcmp(raw, LORA_CAPTURE_MAGIC, 4) == 0 && raw[4] == LORA_CAPTURE_VERSION) {
+        *out_len = (size_t)size;
+        return raw;
+    }
+
+    uint8_t *log = malloc(size > 0 ? (size_t)size : 1);
+    size_t len = 0;
+    for (long i = 0; i + 5 <= size; i++) {
+        if (memcmp(&raw[i], "LCAP ", 5) != 0) {
+            continue;
+        }
+        i += 5;
+        while (i + 1 < size && hex_nibble(raw[i]) >= 0 && hex_nibble(raw[i + 1]) >= 0) {
+            log[len++] = (uint8_t)(hex_nibble(raw[i]) << 4 | hex_nibble(raw[i + 1]));
+            i += 2;
+        }
+    }
+    free(raw);
+
+    if (len < LORA_CAPTURE_HEADER_SIZE || memcmp(log, LORA_CAPTURE_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s: no capture log found\n", path);
+        free(log);
+        return NULL;
+    }
+    if (log[4] != LORA_CAPTURE_VERSION) {
+        fprintf(stderr, "%s: unsupported capture version %d\n", path, log[4]);
+        free(log);
+        return NULL;
+    }
+
+    *out_len = len;
+    return log;
+}
+
+int main(int argc, char **argv)
+{
+    int realtime = 0, loops = 1, node_id = -1;
+    double speed = 1.0;
+    const char *out_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rs:l:n:o:")) != -1) {
+        switch (opt) {
+        case 'r': realtime = 1; break;
+        case 's': speed = atof(optarg); break;
+        case 'l': loops = atoi(optarg); break;
+        case 'n': node_id = atoi(optarg); break;
+        case 'o': out_path = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-r] [-s speed] [-l loops] [-n node_id] [-o out.bin] capture\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || speed <= 0 || loops <= 0) {
+        fprintf(stderr, "usage: %s [-r] [-s speed] [-l loops] [-n node_id] [-o out.bin] capture\n", argv[0]);
+        return 1;
+    }
+
+    size_t log_len;
+    uint8_t *log = load_log(argv[optind], &log_len);
+    if (!log) {
+        return 1;
+    }
+
+    if (out_path) {
+        FILE *out = fopen(out_path, "wb");
+        if (!out || fwrite(log, 1, log_len, out) != log_len) {
+            perror(out_path);
+            return 1;
+        }
+        fclose(out);
+    }
+
+    LoraDriver driver = {0};
+    driver.transmit = fake_transmit;
+    driver.receive = fake_receive;
+    driver.get_time_ms = fake_time_ms;
+
+    LoraEngine engine;
+    lora_engine_init(&engine, &driver);
+    engine.local_id = node_id >= 0 ? (NodeId)node_id : log[5];
+
+    engine.on_ping_req            = on_ping_req;
+    engine.on_ping_resp           = on_ping_resp;
+    engine.on_data_req            = on_data_req;
+    engine.on_data                = on_data;
+    engine.on_command_req         = on_command_req;
+    engine.on_command_resp        = on_command_resp;
+    engine.on_stream_req          = on_stream_req;
+    engine.on_stream_announce     = on_stream_announce;
+    engine.on_stream_announce_ack = on_stream_announce_ack;
+    engine.on_stream_sequence     = on_stream_sequence;
+    engine.on_stream_seq_ack      = on_stream_seq_ack;
+    engine.on_stream_complete     = on_stream_complete;
+
+    static TypeStats stats[MAX_TYPES];
+    unsigned long frames = 0, decode_errors = 0, dropped = 0, truncated = 0;
+    unsigned long long busy_ns = 0;
+    unsigned long long wall_start = now_ns();
+
+    for (int loop = 0; loop < loops; loop++) {
+        size_t pos = LORA_CAPTURE_HEADER_SIZE;
+        uint32_t first_ms = 0;
+        unsigned long long loop_start = now_ns();
+
+        while (pos + LORA_CAPTURE_RECORD_SIZE <= log_len) {
+            const uint8_t *rec = &log[pos];
+            uint32_t time_ms = (uint32_t)rec[0] | (uint32_t)rec[1] << 8
+                             | (uint32_t)rec[2] << 16 | (uint32_t)rec[3] << 24;
+            uint8_t len = rec[6];
+            if (pos + LORA_CAPTURE_RECORD_SIZE + len > log_len) {
+                truncated++;
+                break;
+            }
+            if (pos == LORA_CAPTURE_HEADER_SIZE) {
+                first_ms = time_ms;
+            }
+            const uint8_t *frame = &rec[LORA_CAPTURE_RECORD_SIZE];
+            pos += LORA_CAPTURE_RECORD_SIZE + len;
+
+            if (realtime) {
+                unsigned long long due = loop_start
+                    + (unsigned long long)((double)(uint32_t)(time_ms - first_ms) * 1e6 / speed);
+                unsigned long long now = now_ns();
+                if (due > now) {
+                    struct timespec ts = { (time_t)((due - now) / 1000000000ULL),
+                                           (long)((due - now) % 1000000000ULL) };
+                    nanosleep(&ts, NULL);
+                }
+            }
+
+            virtual_time_ms = time_ms;
+
+            unsigned long long t0 = now_ns();
+            uint8_t handled = lora_engine_handle_frame(&engine, frame, len);
+            // replies queued by the handlers go out on the next polls, as on the node
+            do {
+                lora_engine_poll(&engine);
+            } while (lora_engine_tx_pending(&engine));
+            unsigned long long dt = now_ns() - t0;
+
+            frames++;
+            busy_ns += dt;
+            LoraMessageType type;
+            LoraMetadata meta;
+            if (lora_decode_header(frame, len, &type, &meta) == 0) {
+                decode_errors++;
+                continue;
+            }
+            if (!handled) {
+                dropped++;
+            }
+
+            TypeStats *s = &stats[(uint8_t)type];
+            if (s->frames == 0 || dt < s->min_ns) s->min_ns = dt;
+            if (dt > s->max_ns) s->max_ns = dt;
+            s->frames++;
+            s->total_ns += dt;
+        }
+    }
+
+    double wall_s = (double)(now_ns() - wall_start) / 1e9;
+
+    printf("%lu frames (%d loop%s), %lu bad headers, %lu dropped, %lu truncated records, %lu responses sent\n",
+           frames, loops, loops == 1 ? "" : "s", decode_errors, dropped, truncated, frames_sent);
+    printf("engine time %.3f ms, %.0f frames/s engine-bound, %.0f frames/s wall clock\n",
+           busy_ns / 1e6,
+           busy_ns ? frames / (busy_ns / 1e9) : 0.0,
+           wall_s > 0 ? frames / wall_s : 0.0);
+
+    printf("\n%-6s %10s %10s %10s %10s\n", "type", "frames", "mean_ns", "min_ns", "max_ns");
+    for (int t = 0; t < MAX_TYPES; t++) {
+        const TypeStats *s = &stats[t];
+        if (!s->frames) continue;
+        printf("%-6d %10lu %10llu %10llu %10llu\n",
+               t, s->frames, s->total_ns / s->frames, s->min_ns, s->max_ns);
+    }
+
+    free(log);
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * spi_trace_analyze.c
+ *
+ * Host tool: reads a UART log containing a lora_spi_trace_dump() and reports
+ * SPI transactions per high level LoRa_* operation, redundant register reads
+ * and total bus time.
+ *
+ * usage: spi_trace_analyze [capture.log]   (reads stdin without an argument)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lora_spi_trace.h"
+
+#define OP_NAME(name) #name,
+static const char *const op_names[LORA_SPI_OP_COUNT] = {
+    LORA_SPI_TRACE_OPS(OP_NAME)
+};
+#undef OP_NAME
+
+// SX127x registers whose value changes under the radio's feet, reading them
+// twice is never redundant
+static int is_volatile_reg(uint8_t reg)
+{
+    switch (reg) {
+    case 0x00: // RegFifo
+    case 0x10: // RegFifoRxCurrentAddr
+    case 0x12: // RegIrqFlags
+    case 0x13: // RegRxNbBytes
+    case 0x18: // RegModemStat
+    case 0x19: // RegPktSnrValue
+    case 0x1A: // RegPktRssiValue
+    case 0x1B: // RegRssiValue
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static const char *reg_name(uint8_t reg)
+{
+    switch (reg) {
+    case 0x00: return "RegFiFo";
+    case 0x01: return "RegOpMode";
+    case 0x06: return "RegFrMsb";
+    case 0x07: return "RegFrMid";
+    case 0x08: return "RegFrLsb";
+    case 0x09: return "RegPaConfig";
+    case 0x0B: return "RegOcp";
+    case 0x0C: return "RegLna";
+    case 0x0D: return "RegFiFoAddPtr";
+    case 0x0E: return "RegFiFoTxBaseAddr";
+    case 0x0F: return "RegFiFoRxBaseAddr";
+    case 0x10: return "RegFiFoRxCurrentAddr";
+    case 0x12: return "RegIrqFlags";
+    case 0x13: return "RegRxNbBytes";
+    case 0x1A: return "RegPktRssiValue";
+    case 0x1D: return "RegModemConfig1";
+    case 0x1E: return "RegModemConfig2";
+    case 0x1F: return "RegSymbTimeoutL";
+    case 0x20: return "RegPreambleMsb";
+    case 0x21: return "RegPreambleLsb";
+    case 0x22: return "RegPayloadLength";
+    case 0x26: return "RegModemConfig3";
+    case 0x39: return "RegSyncWord";
+    case 0x40: return "RegDioMapping1";
+    case 0x41: return "RegDioMapping2";
+    case 0x42: return "RegVersion";
+    case 0x4D: return "RegPaDac";
+    default:   return "?";
+    }
+}
+
+typedef struct {
+    unsigned long transactions;
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long bytes;
+    unsigned long redundant_reads;
+    unsigned long redundant_writes;
+    unsigned long long bus_cycles;
+} Counters;
+
+int main(int argc, char **argv)
+{
+    FILE *in = stdin;
+    if (argc > 1) {
+        in = fopen(argv[1], "r");
+        if (!in) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    Counters per_op[LORA_SPI_OP_COUNT] = {0};
+    Counters per_reg[128] = {0};
+    Counters total = {0};
+
+    // last known register contents, from a read or a single byte write
+    uint8_t shadow[128];
+    uint8_t shadow_valid[128] = {0};
+
+    unsigned long cpu_hz = 170000000UL;
+    unsigned long first_start = 0, last_end = 0;
+    int version = 0, have_records = 0;
+    char line[256];
+
+    while (fgets(line, sizeof(line), in)) {
+        // the dump may be embedded in other UART output, look for our prefixes anywhere
+        char *p;
+        if ((p = strstr(line, "SPITRACE ")) && !strstr(p, "END")) {
+            unsigned long n;
+            if (sscanf(p, "SPITRACE %d %lu %lu", &version, &cpu_hz, &n) != 3) {
+                continue;
+            }
+            if (version != LORA_SPI_TRACE_VERSION) {
+                fprintf(stderr, "unsupported trace version %d\n", version);
+                return 1;
+            }
+            memset(shadow_valid, 0, sizeof(shadow_valid));
+            continue;
+        }
+
+        p = strstr(line, "T ");
+        if (!p || !version) {
+            continue;
+        }
+
+        unsigned long start, bus;
+        unsigned reg, flags, len, op, value;
+        if (sscanf(p, "T %lx %lx %x %x %x %x %x",
+                   &start, &bus, &reg, &flags, &len, &op, &value) != 7) {
+            continue;
+        }
+        reg &= 0x7F;
+        if (op >= LORA_SPI_OP_COUNT) {
+            op = LORA_SPI_OP_NONE;
+        }
+
+        if (!have_records) {
+            first_start = start;
+            have_records = 1;
+        }
+        last_end = start + bus;
+
+        Counters *c[3] = { &per_op[op], &per_reg[reg], &total };
+        int redundant_read = 0, redundant_write = 0;
+
+        if (flags & LORA_SPI_TRACE_WRITE) {
+            if (!(flags & LORA_SPI_TRACE_BURST) && len == 1) {
+                redundant_write = shadow_valid[reg] && shadow[reg] == value && !is_volatile_reg(reg);
+                shadow[reg] = (uint8_t)value;
+                shadow_valid[reg] = 1;
+            } else {
+                shadow_valid[reg] = 0;
+            }
+        } else {
+            redundant_read = shadow_valid[reg] && shadow[reg] == value && !is_volatile_reg(reg);
+            shadow[reg] = (uint8_t)value;
+            shadow_valid[reg] = 1;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            c[i]->transactions++;
+            c[i]->bytes += len + 1; // address byte
+            c[i]->bus_cycles += bus;
+            if (flags & LORA_SPI_TRACE_WRITE) c[i]->writes++; else c[i]->reads++;
+            c[i]->redundant_reads += redundant_read;
+            c[i]->redundant_writes += redundant_write;
+        }
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    if (!have_records) {
+        fprintf(stderr, "no SPITRACE records found\n");
+        return 1;
+    }
+
+    double us_per_cycle = 1e6 / (double)cpu_hz;
+
+    printf("%-22s %8s %7s %7s %8s %9s %9s %12s\n",
+           "operation", "xfers", "reads", "writes", "bytes", "red.rd", "red.wr", "bus_us");
+    for (int op = 0; op < LORA_SPI_OP_COUNT; op++) {
+        const Counters *c = &per_op[op];
+        if (!c->transactions) continue;
+        printf("%-22s %8lu %7lu %7lu %8lu %9lu %9lu %12.1f\n",
+               op_names[op], c->transactions, c->reads, c->writes, c->bytes,
+               c->redundant_reads, c->redundant_writes, c->bus_cycles * us_per_cycle);
+    }
+
+    printf("\n%-22s %8s %7s %7s %8s %9s %9s %12s\n",
+           "register", "xfers", "reads", "writes", "bytes", "red.rd", "red.wr", "bus_us");
+    for (int reg = 0; reg < 128; reg++) {
+        const Counters *c = &per_reg[reg];
+        if (!c->transactions) continue;
+        char name[32];
+        snprintf(name, sizeof(name), "0x%02x %s", reg, reg_name((uint8_t)reg));
+        printf("%-22s %8lu %7lu %7lu %8lu %9lu %9lu %12.1f\n",
+               name, c->transactions, c->reads, c->writes, c->bytes,
+               c->redundant_reads, c->redundant_writes, c->bus_cycles * us_per_cycle);
+    }
+
+    double span_us = (double)(uint32_t)(last_end - first_start) * us_per_cycle;
+    double bus_us = total.bus_cycles * us_per_cycle;
+
+    printf("\ntotal: %lu transactions, %lu bytes, %lu redundant reads, %lu redundant writes\n",
+           total.transactions, total.bytes, total.redundant_reads, total.redundant_writes);
+    printf("bus time %.1f us over %.1f us traced (%.1f%%)\n",
+           bus_us, span_us, span_us > 0 ? 100.0 * bus_us / span_us : 0.0);
+
+    return 0;
+}